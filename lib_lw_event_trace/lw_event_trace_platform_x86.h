@@ -7,6 +7,7 @@
 
 #include <pthread.h>
 #include <functional>
+#include <cstdint>
 
 
 namespace lw_event_trace
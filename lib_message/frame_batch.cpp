@@ -0,0 +1,194 @@
+#include "frame_batch.h"
+
+namespace motesque {
+
+// the size of the features stored once per batch
+static uint32_t shared_size_of(uint16_t feature_mask) {
+    const FeatureOffsetTables& tables = feature_offset_tables();
+    const uint16_t shared = feature_mask & kFrameBatchSharedFeatures;
+    return tables.low[shared & 0xff] + tables.high[shared >> 8];
+}
+
+FrameBatchEncoder::FrameBatchEncoder(uint8_t* buffer, uint32_t capacity)
+: m_buffer(buffer),
+  m_capacity(capacity < 0xffff ? capacity : 0xffff),
+  m_size(0),
+  m_feature_mask(0),
+  m_frame_count(0),
+  m_last_timestamp_us(0),
+  m_finished(false)
+{
+    clear();
+}
+
+void FrameBatchEncoder::clear()
+{
+    m_size = sizeof(FrameBatchHeader);
+    m_feature_mask = 0;
+    m_frame_count = 0;
+    m_last_timestamp_us = 0;
+    m_finished = false;
+}
+
+int FrameBatchEncoder::add(const uint8_t* frame, uint32_t frame_size)
+{
+    if (m_finished || m_frame_count == 0xffff) {
+        return -1;
+    }
+    FrameMessageView view(frame, frame_size);
+    if (!view.valid() || view.size() != frame_message_size(feature_offset_tables(), view.feature_mask())) {
+        return -1;
+    }
+    const bool first = m_frame_count == 0;
+    if (first) {
+        m_feature_mask = view.feature_mask();
+    }
+    else if (view.feature_mask() != m_feature_mask) {
+        // belongs to another batch
+        return -1;
+    }
+    const uint32_t shared_size = shared_size_of(m_feature_mask);
+    uint8_t timestamp[kMaxVarintSize];
+    uint32_t timestamp_size = 0;
+    uint64_t timestamp_us = 0;
+    if (view.has<TimestampData>()) {
+        memcpy(&timestamp_us, view.get<TimestampData>(), sizeof(uint64_t));
+        timestamp_size = encode_varint(zigzag_encode((int64_t)(timestamp_us - m_last_timestamp_us)), timestamp);
+    }
+    const uint32_t start = first ? sizeof(FrameBatchHeader) + shared_size : m_size;
+    const uint32_t encoded_size = timestamp_size + frame_size - sizeof(FrameMessageHeader) - shared_size
+                                  - (view.has<TimestampData>() ? sizeof(TimestampData) : 0);
+    if (start + encoded_size > m_capacity) {
+        return -1;
+    }
+    // nothing counts before m_size is moved, a frame which turns out not to fit leaves the batch untouched
+    auto& features = all_feature_ids();
+    auto& feature_sizes = all_feature_sizes();
+    const uint8_t* src = frame + sizeof(FrameMessageHeader);
+    uint8_t* shared = m_buffer + sizeof(FrameBatchHeader);
+    uint8_t* dst = m_buffer + start;
+    for (size_t i=0; i < features.size(); i++) {
+        if ((m_feature_mask & features[i]) == 0) {
+            continue;
+        }
+        if (features[i] & kFrameBatchSharedFeatures) {
+            if (first) {
+                memcpy(shared, src, feature_sizes[i]);
+            }
+            else if (memcmp(shared, src, feature_sizes[i]) != 0) {
+                // another stream
+                return -1;
+            }
+            shared += feature_sizes[i];
+        }
+        else if (features[i] == TimestampData::feature_id) {
+            memcpy(dst, timestamp, timestamp_size);
+            dst += timestamp_size;
+        }
+        else {
+            memcpy(dst, src, feature_sizes[i]);
+            dst += feature_sizes[i];
+        }
+        src += feature_sizes[i];
+    }
+    m_size = start + encoded_size;
+    m_last_timestamp_us = timestamp_us;
+    m_frame_count++;
+    return 0;
+}
+
+int FrameBatchEncoder::finish()
+{
+    if (m_finished) {
+        return 0;
+    }
+    FrameBatchHeader hdr;
+    hdr.batch_size = (uint16_t)m_size;
+    hdr.feature_mask = m_feature_mask;
+    hdr.frame_count = (uint16_t)m_frame_count;
+    memcpy(m_buffer, &hdr, sizeof(FrameBatchHeader));
+    m_finished = true;
+    return 0;
+}
+
+FrameBatchDecoder::FrameBatchDecoder(const uint8_t* batch, uint32_t batch_size)
+: m_ptr(batch),
+  m_end(batch),
+  m_feature_mask(0),
+  m_frame_count(0),
+  m_frame_size(0),
+  m_decoded(0),
+  m_last_timestamp_us(0),
+  m_shared(NULL),
+  m_valid(false)
+{
+    if (batch_size < sizeof(FrameBatchHeader)) {
+        return;
+    }
+    FrameBatchHeader hdr;
+    memcpy(&hdr, batch, sizeof(FrameBatchHeader));
+    if (hdr.batch_size < sizeof(FrameBatchHeader) || hdr.batch_size > batch_size) {
+        return;
+    }
+    m_ptr = batch + sizeof(FrameBatchHeader);
+    m_end = batch + hdr.batch_size;
+    m_feature_mask = hdr.feature_mask;
+    m_frame_count = hdr.frame_count;
+    m_frame_size = frame_message_size(feature_offset_tables(), m_feature_mask);
+    const uint32_t shared_size = shared_size_of(m_feature_mask);
+    if (m_ptr + shared_size > m_end) {
+        return;
+    }
+    m_shared = m_ptr;
+    m_ptr += shared_size;
+    m_valid = true;
+}
+
+int FrameBatchDecoder::next(uint8_t* frame, uint32_t capacity, uint32_t* frame_size)
+{
+    if (!m_valid || m_decoded >= m_frame_count || capacity < m_frame_size) {
+        return -1;
+    }
+    FrameMessageHeader hdr;
+    hdr.message_size = (uint16_t)m_frame_size;
+    hdr.feature_mask = m_feature_mask;
+    memcpy(frame, &hdr, sizeof(FrameMessageHeader));
+    auto& features = all_feature_ids();
+    auto& feature_sizes = all_feature_sizes();
+    const uint8_t* shared = m_shared;
+    uint8_t* dst = frame + sizeof(FrameMessageHeader);
+    for (size_t i=0; i < features.size(); i++) {
+        if ((m_feature_mask & features[i]) == 0) {
+            continue;
+        }
+        if (features[i] & kFrameBatchSharedFeatures) {
+            memcpy(dst, shared, feature_sizes[i]);
+            shared += feature_sizes[i];
+        }
+        else if (features[i] == TimestampData::feature_id) {
+            uint64_t delta = 0;
+            const uint32_t consumed = decode_varint(m_ptr, m_end, &delta);
+            if (consumed == 0) {
+                m_valid = false;
+                return -1;
+            }
+            m_ptr += consumed;
+            m_last_timestamp_us += (uint64_t)zigzag_decode(delta);
+            memcpy(dst, &m_last_timestamp_us, sizeof(uint64_t));
+        }
+        else {
+            if (m_ptr + feature_sizes[i] > m_end) {
+                m_valid = false;
+                return -1;
+            }
+            memcpy(dst, m_ptr, feature_sizes[i]);
+            m_ptr += feature_sizes[i];
+        }
+        dst += feature_sizes[i];
+    }
+    m_decoded++;
+    *frame_size = m_frame_size;
+    return 0;
+}
+
+}
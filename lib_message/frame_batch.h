@@ -0,0 +1,139 @@
+#pragma once
+#include "message_frame.h"
+
+namespace motesque {
+
+// A batch of frames with the same feature mask from one sensor. The per stream features (SensorMetaData) are stored
+// once and the timestamps as zigzag varint deltas to the previous frame (the first one to 0), so a 1 kHz stream needs
+// 2 bytes per timestamp.
+//
+//   FrameBatchHeader | shared features in feature_mask | per frame: [varint timestamp delta] remaining features
+//
+// The remaining features of a frame are stored compacted as in a FrameMessage. Decoding yields the original frames.
+struct FrameBatchHeader
+{
+    uint16_t batch_size;    // the total size in byte of this batch, including FrameBatchHeader
+    uint16_t feature_mask;  // feature bits of every frame in the batch
+    uint16_t frame_count;
+};
+
+// the features stored once per batch, they are equal in every frame of a batch
+enum { kFrameBatchSharedFeatures = SensorMetaData::feature_id };
+
+// the largest varint, a 64 bit value
+enum { kMaxVarintSize = 10 };
+
+inline uint32_t encode_varint(uint64_t value, uint8_t* out)
+{
+    uint32_t size = 0;
+    while (value >= 0x80) {
+        out[size++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[size++] = (uint8_t)value;
+    return size;
+}
+
+// returns the bytes consumed, 0 if the varint is incomplete
+inline uint32_t decode_varint(const uint8_t* in, const uint8_t* end, uint64_t* value)
+{
+    uint64_t result = 0;
+    for (uint32_t i=0; i < kMaxVarintSize && in + i < end; i++) {
+        result |= (uint64_t)(in[i] & 0x7f) << (7 * i);
+        if ((in[i] & 0x80) == 0) {
+            *value = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+inline uint64_t zigzag_encode(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+inline int64_t zigzag_decode(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// Appends finished frames (FrameMessageBuilder, FrameMessage) to a batch in |buffer|. add() fails once a frame
+// does not fit or does not belong to the batch (other feature mask or shared features); finish the batch and
+// start a new one with clear() then.
+class FrameBatchEncoder
+{
+public:
+    FrameBatchEncoder(uint8_t* buffer, uint32_t capacity);
+
+    int add(const uint8_t* frame, uint32_t frame_size);
+
+    // writes the header. No more frames can be added afterwards
+    int finish();
+
+    void clear();
+
+    const uint8_t* get_buffer_pointer() const
+    {
+        return m_buffer;
+    }
+
+    uint32_t get_size() const
+    {
+        return m_size;
+    }
+
+    uint32_t get_frame_count() const
+    {
+        return m_frame_count;
+    }
+
+private:
+    uint8_t*        m_buffer;
+    uint32_t        m_capacity;
+    uint32_t        m_size;
+    uint16_t        m_feature_mask;
+    uint32_t        m_frame_count;
+    uint64_t        m_last_timestamp_us;
+    bool            m_finished;
+};
+
+// Restores the frames of a batch one after another
+class FrameBatchDecoder
+{
+public:
+    FrameBatchDecoder(const uint8_t* batch, uint32_t batch_size);
+
+    // false if the header is damaged or the batch truncated
+    bool valid() const
+    {
+        return m_valid;
+    }
+
+    uint32_t get_frame_count() const
+    {
+        return m_frame_count;
+    }
+
+    // the size of every decoded frame, including FrameMessageHeader
+    uint32_t get_frame_size() const
+    {
+        return m_frame_size;
+    }
+
+    // writes the next frame to |frame|. Returns -1 after the last frame or if the batch is corrupt
+    int next(uint8_t* frame, uint32_t capacity, uint32_t* frame_size);
+
+private:
+    const uint8_t*  m_ptr;
+    const uint8_t*  m_end;
+    uint16_t        m_feature_mask;
+    uint32_t        m_frame_count;
+    uint32_t        m_frame_size;
+    uint32_t        m_decoded;
+    uint64_t        m_last_timestamp_us;
+    const uint8_t*  m_shared;
+    bool            m_valid;
+};
+
+}
@@ -0,0 +1,296 @@
+#include "frame_codec.h"
+#include "frame_batch.h"
+#include <algorithm>
+
+namespace motesque {
+
+// worst case per frame: the largest timestamp and every word with a new zero window
+enum { kMaxTimestampBits = 4 + 64, kMaxWordBits = 2 + 5 + 5 + 32 };
+
+FrameCodecState::FrameCodecState()
+{
+    reset();
+}
+
+void FrameCodecState::reset()
+{
+    timestamp_us = 0;
+    delta_us = 0;
+    memset(words, 0, sizeof(words));
+    memset(leading, 0xff, sizeof(leading));
+    memset(trailing, 0, sizeof(trailing));
+}
+
+// the bytes of a frame before the timestamp, the timestamp itself and the bytes after are handled separately
+static uint32_t timestamp_offset_of(uint16_t feature_mask) {
+    return frame_feature_offset(feature_offset_tables(), feature_mask, TimestampData::feature_id);
+}
+
+static uint32_t word_count_of(uint16_t feature_mask) {
+    const uint32_t timestamp_size = (feature_mask & TimestampData::feature_id) ? sizeof(TimestampData) : 0;
+    const uint32_t frame_size = frame_message_size(feature_offset_tables(), feature_mask);
+    return (frame_size - sizeof(FrameMessageHeader) - timestamp_size) / sizeof(uint32_t);
+}
+
+FrameBlockEncoder::FrameBlockEncoder(uint8_t* buffer, uint32_t capacity)
+: m_buffer(buffer),
+  m_capacity(capacity < 0xffff ? capacity : 0xffff),
+  m_bits(0),
+  m_feature_mask(0),
+  m_frame_count(0),
+  m_state(),
+  m_finished(false)
+{
+}
+
+void FrameBlockEncoder::clear()
+{
+    m_bits = 0;
+    m_feature_mask = 0;
+    m_frame_count = 0;
+    m_state.reset();
+    m_finished = false;
+}
+
+void FrameBlockEncoder::write_bits(uint64_t value, uint32_t count)
+{
+    uint8_t* out = m_buffer + sizeof(FrameCodecBlockHeader);
+    while (count > 0) {
+        const uint32_t used = (uint32_t)(m_bits % 8);
+        const uint32_t n = std::min(8 - used, count);
+        const uint8_t bits = (uint8_t)((value >> (count - n)) & ((1u << n) - 1));
+        if (used == 0) {
+            out[m_bits / 8] = 0;
+        }
+        out[m_bits / 8] |= (uint8_t)(bits << (8 - used - n));
+        m_bits += n;
+        count -= n;
+    }
+}
+
+int FrameBlockEncoder::add(const uint8_t* frame, uint32_t frame_size)
+{
+    if (m_finished || m_frame_count == 0xffff || frame_size < sizeof(FrameMessageHeader)) {
+        return -1;
+    }
+    FrameMessageHeader hdr;
+    memcpy(&hdr, frame, sizeof(FrameMessageHeader));
+    if (hdr.message_size != frame_size || frame_size != frame_message_size(feature_offset_tables(), hdr.feature_mask)) {
+        return -1;
+    }
+    if (m_frame_count == 0) {
+        m_feature_mask = hdr.feature_mask;
+    }
+    else if (hdr.feature_mask != m_feature_mask) {
+        // belongs to the next block
+        return -1;
+    }
+    const uint32_t word_count = word_count_of(m_feature_mask);
+    if (word_count > kFrameCodecMaxWords ||
+        m_bits + kMaxTimestampBits + word_count * kMaxWordBits > (uint64_t)(m_capacity - sizeof(FrameCodecBlockHeader)) * 8) {
+        return -1;
+    }
+    uint32_t words[kFrameCodecMaxWords];
+    const uint8_t* payload = frame + sizeof(FrameMessageHeader);
+    if (m_feature_mask & TimestampData::feature_id) {
+        const uint32_t timestamp_offset = timestamp_offset_of(m_feature_mask);
+        const uint32_t before = timestamp_offset - sizeof(FrameMessageHeader);
+        memcpy(words, payload, before);
+        memcpy((uint8_t*)words + before, frame + timestamp_offset + sizeof(TimestampData), word_count * 4 - before);
+        uint64_t timestamp_us = 0;
+        memcpy(&timestamp_us, frame + timestamp_offset, sizeof(uint64_t));
+        const int64_t delta_us = (int64_t)(timestamp_us - m_state.timestamp_us);
+        const uint64_t dod = zigzag_encode(delta_us - m_state.delta_us);
+        if (dod == 0) {
+            write_bits(0, 1);
+        }
+        else if (dod < (1 << 7)) {
+            write_bits(2, 2);
+            write_bits(dod, 7);
+        }
+        else if (dod < (1 << 12)) {
+            write_bits(6, 3);
+            write_bits(dod, 12);
+        }
+        else if (dod < (1 << 20)) {
+            write_bits(14, 4);
+            write_bits(dod, 20);
+        }
+        else {
+            write_bits(15, 4);
+            write_bits(dod, 64);
+        }
+        m_state.timestamp_us = timestamp_us;
+        m_state.delta_us = delta_us;
+    }
+    else {
+        memcpy(words, payload, word_count * 4);
+    }
+    for (uint32_t i=0; i < word_count; i++) {
+        const uint32_t xored = words[i] ^ m_state.words[i];
+        if (xored == 0) {
+            write_bits(0, 1);
+            continue;
+        }
+        const uint32_t leading = __builtin_clz(xored);
+        const uint32_t trailing = __builtin_ctz(xored);
+        if (m_state.leading[i] != 0xff && leading >= m_state.leading[i] && trailing >= m_state.trailing[i]) {
+            // fits into the window of the previous value
+            write_bits(2, 2);
+            write_bits(xored >> m_state.trailing[i], 32 - m_state.leading[i] - m_state.trailing[i]);
+        }
+        else {
+            const uint32_t length = 32 - leading - trailing;
+            write_bits(3, 2);
+            write_bits(leading, 5);
+            write_bits(length - 1, 5);
+            write_bits(xored >> trailing, length);
+            m_state.leading[i] = (uint8_t)leading;
+            m_state.trailing[i] = (uint8_t)trailing;
+        }
+        m_state.words[i] = words[i];
+    }
+    m_frame_count++;
+    return 0;
+}
+
+int FrameBlockEncoder::finish()
+{
+    if (m_finished) {
+        return 0;
+    }
+    FrameCodecBlockHeader hdr;
+    hdr.block_size = (uint16_t)get_size();
+    hdr.feature_mask = m_feature_mask;
+    hdr.frame_count = (uint16_t)m_frame_count;
+    hdr.reserved = 0;
+    memcpy(m_buffer, &hdr, sizeof(FrameCodecBlockHeader));
+    m_finished = true;
+    return 0;
+}
+
+FrameBlockDecoder::FrameBlockDecoder(const uint8_t* block, uint32_t block_size)
+: m_bit_stream(block + sizeof(FrameCodecBlockHeader)),
+  m_bit_count(0),
+  m_bit_pos(0),
+  m_block_size(0),
+  m_feature_mask(0),
+  m_frame_count(0),
+  m_frame_size(0),
+  m_decoded(0),
+  m_state(),
+  m_valid(false)
+{
+    if (block_size < sizeof(FrameCodecBlockHeader)) {
+        return;
+    }
+    FrameCodecBlockHeader hdr;
+    memcpy(&hdr, block, sizeof(FrameCodecBlockHeader));
+    if (hdr.block_size < sizeof(FrameCodecBlockHeader) || hdr.block_size > block_size ||
+        word_count_of(hdr.feature_mask) > kFrameCodecMaxWords) {
+        return;
+    }
+    m_block_size = hdr.block_size;
+    m_bit_count = (uint64_t)(hdr.block_size - sizeof(FrameCodecBlockHeader)) * 8;
+    m_feature_mask = hdr.feature_mask;
+    m_frame_count = hdr.frame_count;
+    m_frame_size = frame_message_size(feature_offset_tables(), m_feature_mask);
+    m_valid = true;
+}
+
+int FrameBlockDecoder::read_bits(uint32_t count, uint64_t* value)
+{
+    if (m_bit_pos + count > m_bit_count) {
+        return -1;
+    }
+    uint64_t result = 0;
+    while (count > 0) {
+        const uint32_t used = (uint32_t)(m_bit_pos % 8);
+        const uint32_t n = std::min(8 - used, count);
+        const uint8_t bits = (uint8_t)(m_bit_stream[m_bit_pos / 8] >> (8 - used - n)) & ((1u << n) - 1);
+        result = (result << n) | bits;
+        m_bit_pos += n;
+        count -= n;
+    }
+    *value = result;
+    return 0;
+}
+
+int FrameBlockDecoder::next(uint8_t* frame, uint32_t capacity, uint32_t* frame_size)
+{
+    if (!m_valid || m_decoded >= m_frame_count || capacity < m_frame_size) {
+        return -1;
+    }
+    const uint32_t word_count = word_count_of(m_feature_mask);
+    uint64_t bits = 0;
+    int rc = 0;
+    if (m_feature_mask & TimestampData::feature_id) {
+        // the number of leading ones selects the size of the delta of delta
+        static const uint32_t kDodBits[] = {0, 7, 12, 20, 64};
+        uint32_t ones = 0;
+        while (ones < 4 && (rc = read_bits(1, &bits)) == 0 && bits == 1) {
+            ones++;
+        }
+        uint64_t dod = 0;
+        if (rc != 0 || (ones > 0 && read_bits(kDodBits[ones], &dod) != 0)) {
+            m_valid = false;
+            return -1;
+        }
+        m_state.delta_us += zigzag_decode(dod);
+        m_state.timestamp_us += (uint64_t)m_state.delta_us;
+    }
+    for (uint32_t i=0; i < word_count; i++) {
+        if (read_bits(1, &bits) != 0) {
+            m_valid = false;
+            return -1;
+        }
+        if (bits == 0) {
+            continue;
+        }
+        uint64_t new_window = 0;
+        if (read_bits(1, &new_window) != 0) {
+            m_valid = false;
+            return -1;
+        }
+        if (new_window) {
+            uint64_t leading = 0;
+            uint64_t length = 0;
+            if (read_bits(5, &leading) != 0 || read_bits(5, &length) != 0 || leading + length + 1 > 32) {
+                m_valid = false;
+                return -1;
+            }
+            m_state.leading[i] = (uint8_t)leading;
+            m_state.trailing[i] = (uint8_t)(32 - leading - (length + 1));
+        }
+        else if (m_state.leading[i] == 0xff) {
+            m_valid = false;
+            return -1;
+        }
+        uint64_t xored = 0;
+        if (read_bits(32 - m_state.leading[i] - m_state.trailing[i], &xored) != 0) {
+            m_valid = false;
+            return -1;
+        }
+        m_state.words[i] ^= (uint32_t)(xored << m_state.trailing[i]);
+    }
+    FrameMessageHeader hdr;
+    hdr.message_size = (uint16_t)m_frame_size;
+    hdr.feature_mask = m_feature_mask;
+    memcpy(frame, &hdr, sizeof(FrameMessageHeader));
+    uint8_t* payload = frame + sizeof(FrameMessageHeader);
+    if (m_feature_mask & TimestampData::feature_id) {
+        const uint32_t timestamp_offset = timestamp_offset_of(m_feature_mask);
+        const uint32_t before = timestamp_offset - sizeof(FrameMessageHeader);
+        memcpy(payload, m_state.words, before);
+        memcpy(frame + timestamp_offset, &m_state.timestamp_us, sizeof(uint64_t));
+        memcpy(frame + timestamp_offset + sizeof(TimestampData), (const uint8_t*)m_state.words + before, word_count * 4 - before);
+    }
+    else {
+        memcpy(payload, m_state.words, word_count * 4);
+    }
+    m_decoded++;
+    *frame_size = m_frame_size;
+    return 0;
+}
+
+}
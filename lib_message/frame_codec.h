@@ -0,0 +1,128 @@
+#pragma once
+#include "message_frame.h"
+
+namespace motesque {
+
+// Lossless compression of FrameMessage streams for recordings. Frames with the same feature_mask are packed into
+// self contained blocks, so every block can be decoded on its own (e.g. one per slotfs write):
+//
+//   FrameCodecBlockHeader | bit stream of frame_count frames
+//
+// Per frame the timestamp is stored as delta of delta, every other 32 bit word of the frame (floats, ids, two int16
+// counts) is XORed with the same word of the previous frame and only the meaningful bits are kept (Gorilla, VLDB 2015):
+//   timestamp:  '0' unchanged delta, '10' + 7 bits, '110' + 12 bits, '1110' + 20 bits, '1111' + 64 bits (zigzag)
+//   word:       '0' same value, '10' + bits within the previous leading/trailing zero window,
+//               '11' + 5 bits leading zeros + 5 bits (length - 1) + length bits
+struct FrameCodecBlockHeader
+{
+    uint16_t block_size;    // the total size in byte of this block, including FrameCodecBlockHeader
+    uint16_t feature_mask;  // feature bits of every frame in the block
+    uint16_t frame_count;
+    uint16_t reserved;
+};
+
+// 32 bit words per frame without header and timestamp, enough for every feature at once
+enum { kFrameCodecMaxWords = 64 };
+
+// the state of a block, the same on both sides
+struct FrameCodecState
+{
+    FrameCodecState();
+    void reset();
+
+    uint64_t timestamp_us;
+    int64_t  delta_us;
+    uint32_t words[kFrameCodecMaxWords];
+    uint8_t  leading[kFrameCodecMaxWords];    // the zero window of the last stored XOR, leading 0xff for none
+    uint8_t  trailing[kFrameCodecMaxWords];
+};
+
+// Compresses frames into a block in |buffer|. add() fails once the frame might not fit or has another feature mask;
+// finish() the block, store it and start the next one with clear() then.
+class FrameBlockEncoder
+{
+public:
+    FrameBlockEncoder(uint8_t* buffer, uint32_t capacity);
+
+    int add(const uint8_t* frame, uint32_t frame_size);
+
+    // flushes the bit stream and writes the header. No more frames can be added afterwards
+    int finish();
+
+    void clear();
+
+    const uint8_t* get_buffer_pointer() const
+    {
+        return m_buffer;
+    }
+
+    // the bytes used so far, final after finish()
+    uint32_t get_size() const
+    {
+        return sizeof(FrameCodecBlockHeader) + (m_bits + 7) / 8;
+    }
+
+    uint32_t get_frame_count() const
+    {
+        return m_frame_count;
+    }
+
+private:
+    void write_bits(uint64_t value, uint32_t count);
+
+    uint8_t*        m_buffer;
+    uint32_t        m_capacity;
+    uint64_t        m_bits;             // written to the bit stream
+    uint16_t        m_feature_mask;
+    uint32_t        m_frame_count;
+    FrameCodecState m_state;
+    bool            m_finished;
+};
+
+// Restores the frames of a block one after another
+class FrameBlockDecoder
+{
+public:
+    FrameBlockDecoder(const uint8_t* block, uint32_t block_size);
+
+    // false if the header is damaged or the block truncated
+    bool valid() const
+    {
+        return m_valid;
+    }
+
+    // the size of the block, the next one follows
+    uint32_t get_block_size() const
+    {
+        return m_block_size;
+    }
+
+    uint32_t get_frame_count() const
+    {
+        return m_frame_count;
+    }
+
+    uint32_t get_frame_size() const
+    {
+        return m_frame_size;
+    }
+
+    // writes the next frame to |frame|. Returns -1 after the last frame or if the block is corrupt
+    int next(uint8_t* frame, uint32_t capacity, uint32_t* frame_size);
+
+private:
+    int read_bits(uint32_t count, uint64_t* value);
+
+    const uint8_t*  m_bit_stream;
+    uint64_t        m_bit_count;
+    uint64_t        m_bit_pos;
+    uint32_t        m_block_size;
+    uint16_t        m_feature_mask;
+    uint32_t        m_frame_count;
+    uint32_t        m_frame_size;
+    uint32_t        m_decoded;
+    FrameCodecState m_state;
+    bool            m_valid;
+};
+
+}
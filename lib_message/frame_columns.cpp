@@ -0,0 +1,210 @@
+#include "frame_columns.h"
+#include <cstddef>
+#include <thread>
+
+namespace motesque {
+
+// all features this build knows
+static uint16_t known_features() {
+    uint16_t mask = 0;
+    auto& features = all_feature_ids();
+    for (size_t i=0; i < features.size(); i++) {
+        mask |= features[i];
+    }
+    return mask;
+}
+
+// copies the field at the same offset of |rows| frames with |stride| bytes into a column
+template<typename T>
+static void transpose(const uint8_t* src, size_t stride, size_t rows, uint8_t* column) {
+    T* dst = (T*)column;
+    for (size_t r=0; r < rows; r++) {
+        memcpy(&dst[r], src + r * stride, sizeof(T));
+    }
+}
+
+static void transpose(size_t field_size, const uint8_t* src, size_t stride, size_t rows, uint8_t* column) {
+    switch (field_size) {
+        case 2: transpose<uint16_t>(src, stride, rows, column); break;
+        case 4: transpose<uint32_t>(src, stride, rows, column); break;
+        case 8: transpose<uint64_t>(src, stride, rows, column); break;
+    }
+}
+
+FrameColumnDecoder::FrameColumnDecoder()
+: m_feature_masks(),
+  m_columns(),
+  m_rows()
+{
+    clear();
+}
+
+void FrameColumnDecoder::clear()
+{
+    auto& feature_sizes = all_feature_sizes();
+    auto& field_sizes = all_feature_field_sizes();
+    m_feature_masks.clear();
+    for (size_t i=0; i < kNumFeatures; i++) {
+        m_columns[i].assign(feature_sizes[i] / field_sizes[i], std::vector<uint8_t>());
+        m_rows[i] = 0;
+    }
+}
+
+size_t FrameColumnDecoder::get_rows(uint32_t feature_id) const
+{
+    auto& features = all_feature_ids();
+    for (size_t i=0; i < kNumFeatures; i++) {
+        if (features[i] == feature_id) {
+            return m_rows[i];
+        }
+    }
+    return 0;
+}
+
+size_t FrameColumnDecoder::get_num_fields(uint32_t feature_id) const
+{
+    auto& features = all_feature_ids();
+    for (size_t i=0; i < kNumFeatures; i++) {
+        if (features[i] == feature_id) {
+            return m_columns[i].size();
+        }
+    }
+    return 0;
+}
+
+const std::vector<uint8_t>* FrameColumnDecoder::find_column(uint32_t feature_id, size_t field, size_t field_size) const
+{
+    auto& features = all_feature_ids();
+    auto& field_sizes = all_feature_field_sizes();
+    for (size_t i=0; i < kNumFeatures; i++) {
+        if (features[i] == feature_id) {
+            if (field >= m_columns[i].size() || field_sizes[i] != field_size) {
+                return NULL;
+            }
+            return &m_columns[i][field];
+        }
+    }
+    return NULL;
+}
+
+int FrameColumnDecoder::decode(const uint8_t* data, size_t size, size_t* consumed, int num_threads)
+{
+    auto& features = all_feature_ids();
+    const FeatureOffsetTables& tables = feature_offset_tables();
+    const uint16_t known = known_features();
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+    // walk the headers once: split at frame boundaries and count the rows of every feature per chunk
+    std::vector<Chunk> chunks(num_threads);
+    memset(chunks.data(), 0, chunks.size() * sizeof(Chunk));
+    const size_t chunk_bytes = size / num_threads + 1;
+    const uint8_t* ptr = data;
+    const uint8_t* end = data + size;
+    size_t chunk_idx = 0;
+    chunks[0].begin = ptr;
+    int rc = 0;
+    while (end - ptr >= (ptrdiff_t)sizeof(FrameMessageHeader)) {
+        FrameMessageHeader hdr;
+        memcpy(&hdr, ptr, sizeof(FrameMessageHeader));
+        if ((hdr.feature_mask & ~known) != 0 ||
+            hdr.message_size != frame_message_size(tables, hdr.feature_mask)) {
+            rc = -1;
+            break;
+        }
+        if (hdr.message_size > end - ptr) {
+            break;
+        }
+        if (ptr - data >= (ptrdiff_t)((chunk_idx + 1) * chunk_bytes) && chunk_idx + 1 < chunks.size()) {
+            chunks[chunk_idx].end = ptr;
+            chunks[++chunk_idx].begin = ptr;
+        }
+        Chunk& chunk = chunks[chunk_idx];
+        chunk.frames++;
+        for (size_t i=0; i < kNumFeatures; i++) {
+            chunk.rows[i] += (hdr.feature_mask & features[i]) != 0;
+        }
+        ptr += hdr.message_size;
+    }
+    chunks[chunk_idx].end = ptr;
+    chunks.resize(chunk_idx + 1);
+    *consumed = ptr - data;
+
+    // every chunk writes its own rows of the columns
+    std::vector<size_t> first_frames(chunks.size());
+    std::vector<size_t> first_rows(chunks.size() * kNumFeatures);
+    size_t frames = m_feature_masks.size();
+    size_t rows[kNumFeatures];
+    memcpy(rows, m_rows, sizeof(rows));
+    for (size_t c=0; c < chunks.size(); c++) {
+        first_frames[c] = frames;
+        frames += chunks[c].frames;
+        for (size_t i=0; i < kNumFeatures; i++) {
+            first_rows[c * kNumFeatures + i] = rows[i];
+            rows[i] += chunks[c].rows[i];
+        }
+    }
+    auto& field_sizes = all_feature_field_sizes();
+    m_feature_masks.resize(frames);
+    for (size_t i=0; i < kNumFeatures; i++) {
+        for (size_t f=0; f < m_columns[i].size(); f++) {
+            m_columns[i][f].resize(rows[i] * field_sizes[i]);
+        }
+        m_rows[i] = rows[i];
+    }
+    std::vector<std::thread> threads;
+    for (size_t c=1; c < chunks.size(); c++) {
+        threads.push_back(std::thread([this, &chunks, &first_frames, &first_rows, c]() {
+            decode_chunk(chunks[c], first_frames[c], &first_rows[c * kNumFeatures]);
+        }));
+    }
+    decode_chunk(chunks[0], first_frames[0], &first_rows[0]);
+    for (size_t t=0; t < threads.size(); t++) {
+        threads[t].join();
+    }
+    return rc;
+}
+
+void FrameColumnDecoder::decode_chunk(const Chunk& chunk, size_t first_frame, const size_t* first_rows)
+{
+    auto& features = all_feature_ids();
+    auto& field_sizes = all_feature_field_sizes();
+    const FeatureOffsetTables& tables = feature_offset_tables();
+    size_t frame = first_frame;
+    size_t rows[kNumFeatures];
+    memcpy(rows, first_rows, sizeof(rows));
+    const uint8_t* ptr = chunk.begin;
+    while (ptr < chunk.end) {
+        // a run of frames with the same layout, the offsets and the stride are fixed within
+        FrameMessageHeader hdr;
+        memcpy(&hdr, ptr, sizeof(FrameMessageHeader));
+        const size_t stride = hdr.message_size;
+        size_t run = 1;
+        while (ptr + run * stride < chunk.end) {
+            FrameMessageHeader next;
+            memcpy(&next, ptr + run * stride, sizeof(FrameMessageHeader));
+            if (next.feature_mask != hdr.feature_mask) {
+                break;
+            }
+            run++;
+        }
+        for (size_t r=0; r < run; r++) {
+            m_feature_masks[frame + r] = hdr.feature_mask;
+        }
+        for (size_t i=0; i < kNumFeatures; i++) {
+            if ((hdr.feature_mask & features[i]) == 0) {
+                continue;
+            }
+            const uint8_t* src = ptr + frame_feature_offset(tables, hdr.feature_mask, features[i]);
+            for (size_t f=0; f < m_columns[i].size(); f++) {
+                uint8_t* column = m_columns[i][f].data() + rows[i] * field_sizes[i];
+                transpose(field_sizes[i], src + f * field_sizes[i], stride, run, column);
+            }
+            rows[i] += run;
+        }
+        frame += run;
+        ptr += run * stride;
+    }
+}
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include "message_frame.h"
+#include <vector>
+
+namespace motesque {
+
+// Decodes a stream of FrameMessages into one column per field (struct of arrays), e.g. for numpy on the host.
+// Every feature has a column per scalar field: TimestampData one uint64_t column, LowNoiseImuData six float
+// columns (acc x/y/z, gyr x/y/z), QuantizedLowNoiseImuData six int16_t columns and so on. A column has one row per
+// frame which contains the feature, feature_masks() tells which frames these are.
+// Consecutive frames with the same feature_mask are transposed together with fixed offsets and stride; large inputs
+// are split at frame boundaries and decoded by several threads into the same columns. Host only, uses std::thread.
+class FrameColumnDecoder
+{
+public:
+    enum { kNumFeatures = std::tuple_size<FeatureArray>::value };
+
+    FrameColumnDecoder();
+
+    // appends the complete frames in |data| to the columns. |consumed| are the bytes of the decoded frames, an
+    // incomplete frame at the end is left for the next call. Returns -1 if a frame is damaged; the frames before are
+    // decoded
+    int decode(const uint8_t* data, size_t size, size_t* consumed, int num_threads = 1);
+
+    void clear();
+
+    size_t get_frame_count() const
+    {
+        return m_feature_masks.size();
+    }
+
+    // the feature_mask of every decoded frame
+    const std::vector<uint16_t>& get_feature_masks() const
+    {
+        return m_feature_masks;
+    }
+
+    // the number of frames containing the feature
+    size_t get_rows(uint32_t feature_id) const;
+
+    size_t get_num_fields(uint32_t feature_id) const;
+
+    // the values of the field'th scalar of the feature, NULL if the feature or field do not exist or have another size
+    template<typename T>
+    const T* get_column(uint32_t feature_id, size_t field) const
+    {
+        const std::vector<uint8_t>* column = find_column(feature_id, field, sizeof(T));
+        return column ? (const T*)column->data() : NULL;
+    }
+
+private:
+    // a part of the input, decoded by one thread
+    struct Chunk {
+        const uint8_t* begin;
+        const uint8_t* end;
+        size_t         frames;
+        size_t         rows[kNumFeatures];
+    };
+
+    const std::vector<uint8_t>* find_column(uint32_t feature_id, size_t field, size_t field_size) const;
+    void decode_chunk(const Chunk& chunk, size_t first_frame, const size_t* first_rows);
+
+    std::vector<uint16_t>               m_feature_masks;
+    std::vector<std::vector<uint8_t> >  m_columns[kNumFeatures];
+    size_t                              m_rows[kNumFeatures];
+};
+
+}
@@ -0,0 +1,222 @@
+#pragma once
+#include "message_frame.h"
+#include "spsc_sequential_buffer.h"
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <thread>
+#include <vector>
+
+namespace motesque {
+
+// the lane of frames without SensorMetaData
+enum { kFrameDemuxNoSensor = 0xffffffff };
+
+// Fans an interleaved stream of FrameMessages out to one lane per SensorMetaData::sensor_id. Every lane is a
+// SpscSequentialBufferT with its own worker thread, which hands the frames to the handler of that sensor, so per sensor
+// pipelines (sync correction, fusion, writing) run in parallel and need no locking. The frame is copied once, into the
+// lane; the handler reads it in place. With a mirrored STORAGE a frame is never split at the wrap point, otherwise such
+// a frame is put together in a scratch buffer of the worker first.
+// push() must be called from one thread only. Host only, uses std::thread.
+template<typename EVENT_FLAG, typename STORAGE = HeapRingStorage>
+class FrameDemuxT
+{
+    FrameDemuxT(const FrameDemuxT& rhs);
+    FrameDemuxT& operator=(const FrameDemuxT& rhs);
+
+public:
+    // called on the worker of the sensor for every frame, the frame is valid during the call only
+    typedef std::function<void(const uint8_t* frame, uint32_t frame_size)> Handler;
+    // called by push() for the first frame of a sensor, creates the handler of the new lane
+    typedef std::function<Handler(uint32_t sensor_id)> HandlerFactory;
+
+    FrameDemuxT(size_t lane_size, HandlerFactory make_handler);
+    ~FrameDemuxT();
+
+    // routes the complete frames in |data| to their lanes, waits while a lane is full. |consumed| are the bytes of
+    // the routed frames, an incomplete frame at the end is left for the next call. Returns -1 if a frame is damaged
+    int push(const uint8_t* data, size_t size, size_t* consumed);
+
+    // lets the workers handle what is queued and joins them. Lanes cannot be used afterwards
+    void stop();
+
+    size_t get_lane_count() const
+    {
+        return m_lanes.size();
+    }
+
+    // the frames routed to a sensor so far
+    uint64_t get_frame_count(uint32_t sensor_id) const
+    {
+        typename std::map<uint32_t, Lane*>::const_iterator it = m_lanes.find(sensor_id);
+        return it != m_lanes.end() ? it->second->frames : 0;
+    }
+
+private:
+    typedef SpscSequentialBufferT<EVENT_FLAG, STORAGE> Queue;
+
+    struct Lane {
+        Lane(size_t size, const Handler& handler)
+        : queue(size),
+          handler(handler),
+          frames(0),
+          stopped(false)
+        {
+        }
+        Queue             queue;
+        Handler           handler;
+        uint64_t          frames;   // producer side
+        std::atomic<bool> stopped;
+        std::thread       worker;
+    };
+
+    Lane* lane(uint32_t sensor_id);
+    static void run(Lane* lane);
+
+    size_t                   m_lane_size;
+    HandlerFactory           m_make_handler;
+    std::map<uint32_t, Lane*> m_lanes;
+    Lane*                    m_last_lane;
+    uint32_t                 m_last_sensor_id;
+};
+
+template<typename EVENT_FLAG, typename STORAGE>
+FrameDemuxT<EVENT_FLAG, STORAGE>::FrameDemuxT(size_t lane_size, HandlerFactory make_handler)
+: m_lane_size(lane_size),
+  m_make_handler(make_handler),
+  m_lanes(),
+  m_last_lane(NULL),
+  m_last_sensor_id(0)
+{
+}
+
+template<typename EVENT_FLAG, typename STORAGE>
+FrameDemuxT<EVENT_FLAG, STORAGE>::~FrameDemuxT()
+{
+    stop();
+    for (typename std::map<uint32_t, Lane*>::iterator it = m_lanes.begin(); it != m_lanes.end(); ++it) {
+        delete it->second;
+    }
+}
+
+template<typename EVENT_FLAG, typename STORAGE>
+typename FrameDemuxT<EVENT_FLAG, STORAGE>::Lane* FrameDemuxT<EVENT_FLAG, STORAGE>::lane(uint32_t sensor_id)
+{
+    // frames of a sensor mostly come in runs
+    if (m_last_lane && m_last_sensor_id == sensor_id) {
+        return m_last_lane;
+    }
+    Lane*& lane = m_lanes[sensor_id];
+    if (lane == NULL) {
+        lane = new Lane(m_lane_size, m_make_handler(sensor_id));
+        lane->worker = std::thread(&FrameDemuxT::run, lane);
+    }
+    m_last_lane = lane;
+    m_last_sensor_id = sensor_id;
+    return lane;
+}
+
+template<typename EVENT_FLAG, typename STORAGE>
+int FrameDemuxT<EVENT_FLAG, STORAGE>::push(const uint8_t* data, size_t size, size_t* consumed)
+{
+    const uint8_t* ptr = data;
+    const uint8_t* end = data + size;
+    int rc = 0;
+    while (end - ptr >= (ptrdiff_t)sizeof(FrameMessageHeader)) {
+        FrameMessageView view(ptr, end - ptr);
+        if (!view.valid()) {
+            FrameMessageHeader hdr;
+            memcpy(&hdr, ptr, sizeof(FrameMessageHeader));
+            if (hdr.message_size > end - ptr && hdr.message_size <= m_lane_size) {
+                // incomplete
+                break;
+            }
+            rc = -1;
+            break;
+        }
+        if (view.size() > m_lane_size) {
+            rc = -1;
+            break;
+        }
+        uint32_t sensor_id = kFrameDemuxNoSensor;
+        if (view.has<SensorMetaData>()) {
+            memcpy(&sensor_id, &view.get<SensorMetaData>()->sensor_id, sizeof(uint32_t));
+        }
+        Lane* target = lane(sensor_id);
+        // the worker makes room
+        while (target->queue.write(ptr, view.size()) != 0) {
+            std::this_thread::yield();
+        }
+        target->frames++;
+        ptr += view.size();
+    }
+    *consumed = ptr - data;
+    return rc;
+}
+
+template<typename EVENT_FLAG, typename STORAGE>
+void FrameDemuxT<EVENT_FLAG, STORAGE>::stop()
+{
+    for (typename std::map<uint32_t, Lane*>::iterator it = m_lanes.begin(); it != m_lanes.end(); ++it) {
+        it->second->stopped.store(true);
+    }
+    for (typename std::map<uint32_t, Lane*>::iterator it = m_lanes.begin(); it != m_lanes.end(); ++it) {
+        if (it->second->worker.joinable()) {
+            it->second->worker.join();
+        }
+    }
+    m_last_lane = NULL;
+}
+
+template<typename EVENT_FLAG, typename STORAGE>
+void FrameDemuxT<EVENT_FLAG, STORAGE>::run(Lane* lane)
+{
+    std::vector<uint8_t> scratch;
+    while (true) {
+        // read stopped first, the frames written before are visible then
+        const bool stopped = lane->stopped.load();
+        const uint8_t* data = NULL;
+        size_t available = 0;
+        if (lane->queue.request_read(&data, &available, 10) != 0) {
+            if (stopped) {
+                return;
+            }
+            continue;
+        }
+        size_t done = 0;
+        while (available - done >= sizeof(FrameMessageHeader)) {
+            FrameMessageHeader hdr;
+            memcpy(&hdr, data + done, sizeof(FrameMessageHeader));
+            if (hdr.message_size > available - done) {
+                break;
+            }
+            lane->handler(data + done, hdr.message_size);
+            done += hdr.message_size;
+        }
+        if (done == 0) {
+            // a frame split at the end of a plain ring: collect both parts
+            FrameMessageHeader hdr;
+            scratch.assign(data, data + available);
+            lane->queue.commit_read(available);
+            while (scratch.size() < sizeof(FrameMessageHeader) ||
+                   (memcpy(&hdr, scratch.data(), sizeof(FrameMessageHeader)), scratch.size() < hdr.message_size)) {
+                if (lane->queue.request_read(&data, &available, 0) != 0) {
+                    continue;
+                }
+                size_t needed = sizeof(FrameMessageHeader);
+                if (scratch.size() >= sizeof(FrameMessageHeader)) {
+                    needed = hdr.message_size;
+                }
+                const size_t n = std::min(needed - scratch.size(), available);
+                scratch.insert(scratch.end(), data, data + n);
+                lane->queue.commit_read(n);
+            }
+            lane->handler(scratch.data(), hdr.message_size);
+            continue;
+        }
+        lane->queue.commit_read(done);
+    }
+}
+
+}
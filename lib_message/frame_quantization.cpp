@@ -0,0 +1,143 @@
+#include "frame_quantization.h"
+#include <algorithm>
+#include <cmath>
+
+namespace motesque {
+
+// the structs are read as plain arrays
+static_assert(sizeof(LowNoiseImuData) == 6 * sizeof(float), "LowNoiseImuData is padded");
+static_assert(sizeof(HighRangeImuData) == 6 * sizeof(float), "HighRangeImuData is padded");
+static_assert(sizeof(MagnetometerData) == 3 * sizeof(float), "MagnetometerData is padded");
+static_assert(sizeof(QuantizedLowNoiseImuData) == 6 * sizeof(int16_t), "QuantizedLowNoiseImuData is padded");
+static_assert(sizeof(QuantizedHighRangeImuData) == 6 * sizeof(int16_t), "QuantizedHighRangeImuData is padded");
+static_assert(sizeof(QuantizedMagnetometerData) == 4 * sizeof(int16_t), "QuantizedMagnetometerData is padded");
+
+static inline int16_t to_count(float value) {
+    // a NaN sample, or 0 * inf with a zero scale, would pass the clamp and the cast would be undefined.
+    // A select instead of a branch, so the loops still vectorize
+    value = std::isnan(value) ? 0.0f : value;
+    value = std::min(std::max(value, -32768.0f), 32767.0f);
+    return (int16_t)(value + (value < 0.0f ? -0.5f : 0.5f));
+}
+
+// N values per frame with their own inverse scale, the strides are the values per struct
+template<size_t N>
+static void quantize_frames(const float* in, size_t in_stride, const float (&inv_scales)[N], int16_t* out, size_t out_stride, size_t n) {
+    for (size_t i=0; i < n; i++) {
+        for (size_t j=0; j < N; j++) {
+            out[i * out_stride + j] = to_count(in[i * in_stride + j] * inv_scales[j]);
+        }
+    }
+}
+
+template<size_t N>
+static void dequantize_frames(const int16_t* in, size_t in_stride, const float (&scales)[N], float* out, size_t out_stride, size_t n) {
+    for (size_t i=0; i < n; i++) {
+        for (size_t j=0; j < N; j++) {
+            out[i * out_stride + j] = in[i * in_stride + j] * scales[j];
+        }
+    }
+}
+
+void quantize_int16(const float* values, float scale, int16_t* counts, size_t n) {
+    const float inv_scale = 1.0f / scale;
+    for (size_t i=0; i < n; i++) {
+        counts[i] = to_count(values[i] * inv_scale);
+    }
+}
+
+void dequantize_int16(const int16_t* counts, float scale, float* values, size_t n) {
+    for (size_t i=0; i < n; i++) {
+        values[i] = counts[i] * scale;
+    }
+}
+
+void quantize(const LowNoiseImuData* in, size_t n, const QuantizationScaleData& scale, QuantizedLowNoiseImuData* out) {
+    const float a = 1.0f / scale.acc_g;
+    const float g = 1.0f / scale.gyr_rps;
+    const float inv_scales[6] = {a, a, a, g, g, g};
+    quantize_frames((const float*)in, 6, inv_scales, (int16_t*)out, 6, n);
+}
+
+void dequantize(const QuantizedLowNoiseImuData* in, size_t n, const QuantizationScaleData& scale, LowNoiseImuData* out) {
+    const float scales[6] = {scale.acc_g, scale.acc_g, scale.acc_g, scale.gyr_rps, scale.gyr_rps, scale.gyr_rps};
+    dequantize_frames((const int16_t*)in, 6, scales, (float*)out, 6, n);
+}
+
+void quantize(const HighRangeImuData* in, size_t n, const QuantizationScaleData& scale, QuantizedHighRangeImuData* out) {
+    const float a = 1.0f / scale.acc_g;
+    const float g = 1.0f / scale.gyr_rps;
+    const float inv_scales[6] = {a, a, a, g, g, g};
+    quantize_frames((const float*)in, 6, inv_scales, (int16_t*)out, 6, n);
+}
+
+void dequantize(const QuantizedHighRangeImuData* in, size_t n, const QuantizationScaleData& scale, HighRangeImuData* out) {
+    const float scales[6] = {scale.acc_g, scale.acc_g, scale.acc_g, scale.gyr_rps, scale.gyr_rps, scale.gyr_rps};
+    dequantize_frames((const int16_t*)in, 6, scales, (float*)out, 6, n);
+}
+
+void quantize(const MagnetometerData* in, size_t n, const QuantizationScaleData& scale, QuantizedMagnetometerData* out) {
+    const float m = 1.0f / scale.mag_gauss;
+    const float inv_scales[3] = {m, m, m};
+    quantize_frames((const float*)in, 3, inv_scales, (int16_t*)out, 4, n);
+    for (size_t i=0; i < n; i++) {
+        out[i].reserved = 0;
+    }
+}
+
+void dequantize(const QuantizedMagnetometerData* in, size_t n, const QuantizationScaleData& scale, MagnetometerData* out) {
+    const float scales[3] = {scale.mag_gauss, scale.mag_gauss, scale.mag_gauss};
+    dequantize_frames((const int16_t*)in, 4, scales, (float*)out, 3, n);
+}
+
+QuantizationScaleCache::QuantizationScaleCache()
+: m_count(0)
+{
+}
+
+void QuantizationScaleCache::clear()
+{
+    m_count = 0;
+}
+
+int QuantizationScaleCache::update(const uint8_t* frame, uint32_t frame_size)
+{
+    FrameMessageView view(frame, frame_size);
+    if (!view.valid() || !view.has<SensorMetaData>() || !view.has<QuantizationScaleData>()) {
+        return 0;
+    }
+    SensorMetaData meta;
+    QuantizationScaleData scale;
+    memcpy(&meta, view.get<SensorMetaData>(), sizeof(SensorMetaData));
+    memcpy(&scale, view.get<QuantizationScaleData>(), sizeof(QuantizationScaleData));
+    return set(meta.sensor_id, scale);
+}
+
+int QuantizationScaleCache::set(uint32_t sensor_id, const QuantizationScaleData& scale)
+{
+    for (size_t i=0; i < m_count; i++) {
+        if (m_entries[i].sensor_id == sensor_id) {
+            m_entries[i].scale = scale;
+            return 0;
+        }
+    }
+    if (m_count == kMaxStreams) {
+        return -1;
+    }
+    m_entries[m_count].sensor_id = sensor_id;
+    m_entries[m_count].scale = scale;
+    m_count++;
+    return 0;
+}
+
+const QuantizationScaleData* QuantizationScaleCache::find(uint32_t sensor_id) const
+{
+    for (size_t i=0; i < m_count; i++) {
+        if (m_entries[i].sensor_id == sensor_id) {
+            return &m_entries[i].scale;
+        }
+    }
+    return NULL;
+}
+
+}
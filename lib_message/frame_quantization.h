@@ -0,0 +1,53 @@
+#pragma once
+#include "message_frame.h"
+
+namespace motesque {
+
+// Conversion between the float features and their quantized int16 variants, value = count * scale.
+// Counts are rounded to the nearest integer and saturate at the int16 range. The scales must be > 0. NaN samples,
+// and 0 with a zero scale, become count 0.
+// The loops have no calls and no branches, so the compiler vectorizes them; convert blocks of frames at once.
+
+void quantize_int16(const float* values, float scale, int16_t* counts, size_t n);
+void dequantize_int16(const int16_t* counts, float scale, float* values, size_t n);
+
+void quantize(const LowNoiseImuData* in, size_t n, const QuantizationScaleData& scale, QuantizedLowNoiseImuData* out);
+void dequantize(const QuantizedLowNoiseImuData* in, size_t n, const QuantizationScaleData& scale, LowNoiseImuData* out);
+
+void quantize(const HighRangeImuData* in, size_t n, const QuantizationScaleData& scale, QuantizedHighRangeImuData* out);
+void dequantize(const QuantizedHighRangeImuData* in, size_t n, const QuantizationScaleData& scale, HighRangeImuData* out);
+
+void quantize(const MagnetometerData* in, size_t n, const QuantizationScaleData& scale, QuantizedMagnetometerData* out);
+void dequantize(const QuantizedMagnetometerData* in, size_t n, const QuantizationScaleData& scale, MagnetometerData* out);
+
+// The scales of the streams a reader has seen, by SensorMetaData::sensor_id. Pass every frame to update(); the frames
+// carrying QuantizationScaleData (once per stream) set the scales for the quantized frames of their sensor.
+class QuantizationScaleCache
+{
+public:
+    enum { kMaxStreams = 32 };
+
+    QuantizationScaleCache();
+
+    // takes the scales from a frame with SensorMetaData and QuantizationScaleData, other frames are ignored.
+    // Returns -1 if a new stream does not fit anymore
+    int update(const uint8_t* frame, uint32_t frame_size);
+
+    int set(uint32_t sensor_id, const QuantizationScaleData& scale);
+
+    // the scales of the stream, NULL if none were received yet
+    const QuantizationScaleData* find(uint32_t sensor_id) const;
+
+    void clear();
+
+private:
+    struct Entry {
+        uint32_t              sensor_id;
+        QuantizationScaleData scale;
+    };
+
+    Entry  m_entries[kMaxStreams];
+    size_t m_count;
+};
+
+}
@@ -0,0 +1,86 @@
+#include "frame_stream.h"
+#include "util_crc32.h"
+
+namespace motesque {
+
+const uint8_t kFrameStreamSync[4] = {0xa5, 'M', 'Q', 'S'};
+
+int frame_stream_header(const uint8_t* payload, uint32_t payload_size, FrameStreamHeader* hdr)
+{
+    if (payload_size > 0xffff) {
+        return -1;
+    }
+    memcpy(hdr->sync, kFrameStreamSync, sizeof(kFrameStreamSync));
+    hdr->payload_size = (uint16_t)payload_size;
+    hdr->payload_size_inv = (uint16_t)~payload_size;
+    hdr->crc32 = crc32(payload, payload_size);
+    return 0;
+}
+
+FrameStreamScanner::FrameStreamScanner()
+: m_lost_bytes(0),
+  m_record_count(0),
+  m_crc_errors(0)
+{
+}
+
+void FrameStreamScanner::clear()
+{
+    m_lost_bytes = 0;
+    m_record_count = 0;
+    m_crc_errors = 0;
+}
+
+int FrameStreamScanner::scan(const uint8_t* data, size_t size, size_t* consumed, const uint8_t** payload,
+                             uint32_t* payload_size)
+{
+    const uint8_t* ptr = data;
+    const uint8_t* end = data + size;
+    while (true) {
+        // the next marker; a partial one at the end is kept for the next call
+        const uint8_t* marker = ptr;
+        while ((marker = (const uint8_t*)memchr(marker, kFrameStreamSync[0], end - marker)) != NULL) {
+            if ((size_t)(end - marker) < sizeof(kFrameStreamSync) ||
+                memcmp(marker, kFrameStreamSync, sizeof(kFrameStreamSync)) == 0) {
+                break;
+            }
+            marker++;
+        }
+        if (marker == NULL) {
+            marker = end;
+        }
+        m_lost_bytes += marker - ptr;
+        ptr = marker;
+        if ((size_t)(end - ptr) < sizeof(FrameStreamHeader)) {
+            *consumed = ptr - data;
+            return -1;
+        }
+        FrameStreamHeader hdr;
+        memcpy(&hdr, ptr, sizeof(FrameStreamHeader));
+        if (hdr.payload_size != (uint16_t)~hdr.payload_size_inv) {
+            // a false marker
+            m_lost_bytes++;
+            ptr++;
+            continue;
+        }
+        if ((size_t)(end - ptr) < sizeof(FrameStreamHeader) + hdr.payload_size) {
+            *consumed = ptr - data;
+            return -1;
+        }
+        const uint8_t* record = ptr + sizeof(FrameStreamHeader);
+        if (crc32(record, hdr.payload_size) != hdr.crc32) {
+            // damaged, or a false marker; the search goes on right after the marker
+            m_crc_errors++;
+            m_lost_bytes++;
+            ptr++;
+            continue;
+        }
+        m_record_count++;
+        *payload = record;
+        *payload_size = hdr.payload_size;
+        *consumed = (record + hdr.payload_size) - data;
+        return 0;
+    }
+}
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "message_frame.h"
+
+namespace motesque {
+
+// Optional framing for FrameMessages, FrameBatches or codec blocks sent over TCP or written to a recording, so a
+// reader can find the next record after a cut or a damaged region:
+//
+//   FrameStreamHeader | payload
+//
+// The sync marker is searched for, the size and its complement reject most false markers right away and the crc32
+// of the payload decides. A payload is not escaped, a marker inside of it is only found after a damaged record.
+struct FrameStreamHeader
+{
+    uint8_t  sync[4];           // kFrameStreamSync
+    uint16_t payload_size;
+    uint16_t payload_size_inv;  // ~payload_size
+    uint32_t crc32;             // of the payload
+};
+
+extern const uint8_t kFrameStreamSync[4];
+
+// fills |hdr| for |payload|, write it right before the payload. Returns -1 if the payload is too large
+int frame_stream_header(const uint8_t* payload, uint32_t payload_size, FrameStreamHeader* hdr);
+
+// Finds the records in a framed stream which arrives in pieces. Damaged or cut records and garbage in between are
+// skipped by searching for the next marker with memchr (vectorized by the C library) and counted as lost bytes.
+class FrameStreamScanner
+{
+public:
+    FrameStreamScanner();
+
+    // looks for the next record in |data|. Returns 0 and the payload of the record, or -1 if more data is needed. In
+    // both cases the first |consumed| bytes are done with and must not be passed again; the rest must be passed again
+    // together with the following data. Bytes still unconsumed at the end of the stream are lost as well
+    int scan(const uint8_t* data, size_t size, size_t* consumed, const uint8_t** payload, uint32_t* payload_size);
+
+    void clear();
+
+    // bytes skipped because they did not belong to an intact record
+    uint64_t get_lost_bytes() const
+    {
+        return m_lost_bytes;
+    }
+
+    uint64_t get_record_count() const
+    {
+        return m_record_count;
+    }
+
+    // records with a plausible header and a crc mismatch
+    uint64_t get_crc_errors() const
+    {
+        return m_crc_errors;
+    }
+
+private:
+    uint64_t m_lost_bytes;
+    uint64_t m_record_count;
+    uint64_t m_crc_errors;
+};
+
+}
@@ -6,17 +6,55 @@ namespace motesque {
 const FeatureArray& all_feature_ids() {
     static 
     FeatureArray features = {{SensorMetaData::feature_id, TimestampData::feature_id, LowNoiseImuData::feature_id, HighRangeImuData::feature_id,ExtremeRangeAccData::feature_id,
-                                        BarometerData::feature_id, MagnetometerData::feature_id, FusionData::feature_id, BatteryData::feature_id}};
+                                        BarometerData::feature_id, MagnetometerData::feature_id, FusionData::feature_id, BatteryData::feature_id,
+                                        QuantizationScaleData::feature_id, QuantizedLowNoiseImuData::feature_id,
+                                        QuantizedHighRangeImuData::feature_id, QuantizedMagnetometerData::feature_id}};
     return features;                                      
 }
 
 const FeatureArray& all_feature_sizes() {
     static 
     FeatureArray feature_sizes = {{sizeof(SensorMetaData), sizeof(TimestampData), sizeof(LowNoiseImuData), sizeof(HighRangeImuData),sizeof(ExtremeRangeAccData),
-                                             sizeof(BarometerData), sizeof(MagnetometerData), sizeof(FusionData),sizeof(BatteryData)}};
+                                             sizeof(BarometerData), sizeof(MagnetometerData), sizeof(FusionData),sizeof(BatteryData),
+                                             sizeof(QuantizationScaleData), sizeof(QuantizedLowNoiseImuData),
+                                             sizeof(QuantizedHighRangeImuData), sizeof(QuantizedMagnetometerData)}};
     return feature_sizes;                                      
 }
 
+const FeatureArray& all_feature_field_sizes() {
+    static
+    FeatureArray field_sizes = {{sizeof(uint32_t), sizeof(uint64_t), sizeof(float), sizeof(float), sizeof(float),
+                                 sizeof(float), sizeof(float), sizeof(float), sizeof(float),
+                                 sizeof(float), sizeof(int16_t), sizeof(int16_t), sizeof(int16_t)}};
+    return field_sizes;
+}
+
+static void fill_offset_table(std::array<uint16_t, 256>* table, uint32_t first_bit) {
+    auto& features = all_feature_ids();
+    auto& feature_sizes = all_feature_sizes();
+    for (uint32_t mask=0; mask < table->size(); mask++) {
+        uint16_t sum = 0;
+        for (size_t i=0; i < features.size(); i++) {
+            if (((mask << first_bit) & features[i]) != 0) {
+                sum += feature_sizes[i];
+            }
+        }
+        (*table)[mask] = sum;
+    }
+}
+
+static FeatureOffsetTables make_feature_offset_tables() {
+    FeatureOffsetTables tables;
+    fill_offset_table(&tables.low, 0);
+    fill_offset_table(&tables.high, 8);
+    return tables;
+}
+
+const FeatureOffsetTables& feature_offset_tables() {
+    static const FeatureOffsetTables tables = make_feature_offset_tables();
+    return tables;
+}
+
 // uint16_t get_frame_message_size(uint8_t* msg) {
 //     return ((FrameMessageHeader*)msg)->message_size;
 // }
@@ -78,6 +78,40 @@ struct BatteryData
     float state_of_charge;  // 0..1
 };
 
+// The quantized features carry the raw 16 bit counts of the sensors, value = count * scale. The scales are constant
+// for a stream (one sensor) and not part of the data frames: a sensor sends them once, in a frame with SensorMetaData
+// and QuantizationScaleData, and the reader keeps them per sensor_id (QuantizationScaleCache). See
+// frame_quantization.h to convert from and to the float structs.
+// The sizes are kept a multiple of 4 bytes, so the following features stay aligned
+struct QuantizationScaleData
+{
+    enum  { feature_id = 1 << 9};
+    float acc_g;            // g per count
+    float gyr_rps;          // rad/s per count
+    float mag_gauss;        // gauss per count
+};
+
+struct QuantizedLowNoiseImuData
+{
+    enum  { feature_id = 1 << 10};
+    int16_t acc[3];
+    int16_t gyr[3];
+};
+
+struct QuantizedHighRangeImuData
+{
+    enum  { feature_id = 1 << 11};
+    int16_t acc[3];
+    int16_t gyr[3];
+};
+
+struct QuantizedMagnetometerData
+{
+    enum  { feature_id = 1 << 12};
+    int16_t mag[3];
+    int16_t reserved;
+};
+
 
 // Recursive template patterns to compute the offsets for each sensor -data type at compile time
 // The order is obviously important and follows the order of the feature_id
@@ -141,12 +175,60 @@ struct FrameMessageOffset<BatteryData>
      enum { value = sizeof(FusionData) + FrameMessageOffset<FusionData>::value};
 };
 
+template <>
+struct FrameMessageOffset<QuantizationScaleData>
+{
+     enum { value = sizeof(BatteryData) + FrameMessageOffset<BatteryData>::value};
+};
+
+template <>
+struct FrameMessageOffset<QuantizedLowNoiseImuData>
+{
+     enum { value = sizeof(QuantizationScaleData) + FrameMessageOffset<QuantizationScaleData>::value};
+};
+
+template <>
+struct FrameMessageOffset<QuantizedHighRangeImuData>
+{
+     enum { value = sizeof(QuantizedLowNoiseImuData) + FrameMessageOffset<QuantizedLowNoiseImuData>::value};
+};
+
+template <>
+struct FrameMessageOffset<QuantizedMagnetometerData>
+{
+     enum { value = sizeof(QuantizedHighRangeImuData) + FrameMessageOffset<QuantizedHighRangeImuData>::value};
+};
+
 // for convenience, hold a list of of ordered ids and respective sizes
-typedef std::array<uint32_t,9> FeatureArray;
+typedef std::array<uint32_t,13> FeatureArray;
 const FeatureArray& all_feature_ids();
 const FeatureArray& all_feature_sizes();
+// the size of the scalar fields of each feature, e.g. 4 for float, 2 for the quantized int16 counts
+const FeatureArray& all_feature_field_sizes();
 
 
+// Sum of the feature sizes for every combination of 8 feature bits, one table for the low and one for the high byte of
+// a feature_mask. The offset of a feature is the header plus the sizes of the present features with a lower bit
+struct FeatureOffsetTables
+{
+    std::array<uint16_t, 256> low;
+    std::array<uint16_t, 256> high;
+};
+const FeatureOffsetTables& feature_offset_tables();
+
+// the offset of |feature_id| in a message with |feature_mask|, in O(1)
+inline uint32_t frame_feature_offset(const FeatureOffsetTables& tables, uint16_t feature_mask, uint32_t feature_id)
+{
+    const uint32_t below = feature_mask & (feature_id - 1);
+    return sizeof(FrameMessageHeader) + tables.low[below & 0xff] + tables.high[below >> 8];
+}
+
+// the size of a message with |feature_mask|, including FrameMessageHeader, in O(1)
+inline uint32_t frame_message_size(const FeatureOffsetTables& tables, uint16_t feature_mask)
+{
+    return sizeof(FrameMessageHeader) + tables.low[feature_mask & 0xff] + tables.high[feature_mask >> 8];
+}
+
 // obtain the message size of this buffer by extracting the FrameMessageHeader
 //uint16_t get_frame_message_size(uint8_t* msg);
 
@@ -175,6 +257,73 @@ int get_frame_message_data(const uint8_t* buffer, uint32_t buffer_size, DataType
 }
 
 
+// A read only view on a message in a buffer. Fields are located with the offset tables instead of walking all
+// features and are not copied. The returned pointers point into the buffer and may be unaligned, fine on the hosts
+// which decode recordings; dereferencing them on a Cortex-M needs care for 64 bit members.
+class FrameMessageView
+{
+public:
+    FrameMessageView(const uint8_t* buffer, uint32_t buffer_size)
+    : m_buffer(buffer),
+      m_size(0),
+      m_feature_mask(0),
+      m_tables(feature_offset_tables())
+    {
+        if (buffer_size >= sizeof(FrameMessageHeader)) {
+            FrameMessageHeader hdr;
+            memcpy(&hdr, buffer, sizeof(FrameMessageHeader));
+            // a truncated message has no fields
+            if (hdr.message_size >= sizeof(FrameMessageHeader) && hdr.message_size <= buffer_size) {
+                m_size = hdr.message_size;
+                m_feature_mask = hdr.feature_mask;
+            }
+        }
+    }
+
+    bool valid() const
+    {
+        return m_size > 0;
+    }
+
+    // the size of the message, including the header
+    uint32_t size() const
+    {
+        return m_size;
+    }
+
+    uint16_t feature_mask() const
+    {
+        return m_feature_mask;
+    }
+
+    template<typename DataTypeT>
+    bool has() const
+    {
+        return (m_feature_mask & DataTypeT::feature_id) != 0;
+    }
+
+    // NULL if the message does not contain DataTypeT
+    template<typename DataTypeT>
+    const DataTypeT* get() const
+    {
+        if (!has<DataTypeT>()) {
+            return NULL;
+        }
+        const uint32_t offset = frame_feature_offset(m_tables, m_feature_mask, DataTypeT::feature_id);
+        if (offset + sizeof(DataTypeT) > m_size) {
+            return NULL;
+        }
+        return (const DataTypeT*)(m_buffer + offset);
+    }
+
+private:
+    const uint8_t*              m_buffer;
+    uint32_t                    m_size;
+    uint16_t                    m_feature_mask;
+    const FeatureOffsetTables&  m_tables;
+};
+
+
 // Build a FrameMessage by adding data structs (order does not matter) and then calling finish. This last op "compacts" the buffer to 
 // not having to send optional fields. 
 // When extending the data model do the following:
@@ -182,7 +331,8 @@ int get_frame_message_data(const uint8_t* buffer, uint32_t buffer_size, DataType
 // or 
 // 1. Add a new struct and assign it a free |feature_mask bit| as feature_id 
 // 2. Create FrameMessageOffset<> specialization template to compute the correct offset. Easiest here would be to append the struct at the end. 
-// 3. Update 'all_feature_ids()' and 'all_feature_sizes' and increase the array datatype size  const std::array<uint32_t,N>& all_feature_ids();
+// 3. Update 'all_feature_ids()', 'all_feature_sizes' and 'all_feature_field_sizes' and increase the array datatype size  const std::array<uint32_t,N>& all_feature_ids();
+// FrameMessage<> below derives its layout from the feature ids and needs no changes
 
 // Whatever changes you make, keep python/pymotesque_mpu_sdk/pymotesque_mpu_sdk/messages/py_message_frame.py in sync!
 
@@ -272,6 +422,121 @@ private:
 };
 
 
+// Compile time layout of a message with a fixed set of features, see FrameMessage
+template <typename... DataTypes>
+struct FrameFeatureMask
+{
+    enum { value = 0 };
+};
+
+template <typename DataTypeT, typename... Rest>
+struct FrameFeatureMask<DataTypeT, Rest...>
+{
+    enum { value = DataTypeT::feature_id | FrameFeatureMask<Rest...>::value };
+};
+
+// the sum of the ids equals the mask only if no feature is given twice
+template <typename... DataTypes>
+struct FrameFeatureSum
+{
+    enum { value = 0 };
+};
+
+template <typename DataTypeT, typename... Rest>
+struct FrameFeatureSum<DataTypeT, Rest...>
+{
+    enum { value = DataTypeT::feature_id + FrameFeatureSum<Rest...>::value };
+};
+
+template <typename... DataTypes>
+struct FramePayloadSize
+{
+    enum { value = 0 };
+};
 
+template <typename DataTypeT, typename... Rest>
+struct FramePayloadSize<DataTypeT, Rest...>
+{
+    enum { value = sizeof(DataTypeT) + FramePayloadSize<Rest...>::value };
+};
+
+// the compacted offset of Feature: the header plus every feature of the message with a lower feature_id
+template <typename Feature, typename... DataTypes>
+struct FrameCompactedOffset
+{
+    enum { value = sizeof(FrameMessageHeader) };
+};
+
+template <typename Feature, typename DataTypeT, typename... Rest>
+struct FrameCompactedOffset<Feature, DataTypeT, Rest...>
+{
+    enum { value = ((uint32_t)DataTypeT::feature_id < (uint32_t)Feature::feature_id ? sizeof(DataTypeT) : 0)
+                   + FrameCompactedOffset<Feature, Rest...>::value };
+};
+
+// A message with the features DataTypes (order does not matter). Offsets, feature mask and size are known at compile
+// time, so every field is written straight to its final position; no clear, no compaction. The bytes are the same
+// as the ones of a finished FrameMessageBuilder with the same features.
+// Either fill the own buffer with set(), or serialize into foreign memory (e.g. SequentialBufferT::reserve_write)
+// with FrameMessage<...>::write(buffer, data...)
+template <typename... DataTypes>
+class FrameMessage
+{
+public:
+    enum {
+        feature_mask = FrameFeatureMask<DataTypes...>::value,
+        size = sizeof(FrameMessageHeader) + FramePayloadSize<DataTypes...>::value
+    };
+    static_assert(sizeof...(DataTypes) > 0, "a FrameMessage needs at least one feature");
+    static_assert((int)feature_mask == (int)FrameFeatureSum<DataTypes...>::value, "a feature is given more than once");
+    static_assert(size <= 0xffff, "the message size does not fit into FrameMessageHeader");
+
+    template <typename Feature>
+    struct Offset
+    {
+        static_assert((feature_mask & Feature::feature_id) != 0, "the feature is not part of this FrameMessage");
+        enum { value = FrameCompactedOffset<Feature, DataTypes...>::value };
+    };
+
+    FrameMessage()
+    {
+        write_header(m_buffer);
+    }
+
+    template <typename Feature>
+    void set(const Feature& data)
+    {
+        memcpy(m_buffer + Offset<Feature>::value, &data, sizeof(Feature));
+    }
+
+    // serialize a complete message into |buffer|, which holds at least |size| bytes
+    static void write(uint8_t* buffer, const DataTypes&... data)
+    {
+        write_header(buffer);
+        const int unused[] = {0, (memcpy(buffer + Offset<DataTypes>::value, &data, sizeof(DataTypes)), 0)...};
+        (void)unused;
+    }
+
+    static void write_header(uint8_t* buffer)
+    {
+        FrameMessageHeader hdr;
+        hdr.message_size = size;
+        hdr.feature_mask = feature_mask;
+        memcpy(buffer, &hdr, sizeof(FrameMessageHeader));
+    }
+
+    const uint8_t* get_buffer_pointer() const
+    {
+        return m_buffer;
+    }
+
+    uint32_t get_size() const
+    {
+        return size;
+    }
+
+private:
+    uint8_t m_buffer[size];
+};
 
 }
\ No newline at end of file
@@ -0,0 +1,114 @@
+// ===========================================================
+//
+// Copyright (c) 2018 Motesque Inc.  All rights reserved.
+//
+// ===========================================================
+#include "../../unittest/catch.hpp"
+#include "frame_batch.h"
+#include <iostream>
+#include <vector>
+
+using namespace motesque;
+
+typedef FrameMessage<SensorMetaData, TimestampData, LowNoiseImuData> ImuFrame;
+
+static void make_imu_frame(ImuFrame* frame, uint64_t timestamp_us, float value) {
+    SensorMetaData meta;
+    meta.semantic = 2;
+    meta.sensor_id = 5;
+    frame->set(meta);
+    TimestampData time_data;
+    time_data.timestamp_us = timestamp_us;
+    frame->set(time_data);
+    LowNoiseImuData imu_data;
+    for (int i=0; i < 3; i++) {
+        imu_data.acc_g[i] = value + i;
+        imu_data.gyr_rps[i] = -value - i;
+    }
+    frame->set(imu_data);
+}
+
+TEST_CASE("varint and zigzag") {
+    uint8_t buffer[kMaxVarintSize];
+    const uint64_t values[] = {0, 1, 127, 128, 1000, 0xffffffffULL, 0xffffffffffffffffULL};
+    for (size_t i=0; i < sizeof(values) / sizeof(values[0]); i++) {
+        const uint32_t size = encode_varint(values[i], buffer);
+        uint64_t decoded = 0;
+        REQUIRE(size == decode_varint(buffer, buffer + size, &decoded));
+        REQUIRE(decoded == values[i]);
+        // truncated
+        REQUIRE(0 == decode_varint(buffer, buffer + size - 1, &decoded));
+    }
+    REQUIRE(1 == encode_varint(zigzag_encode(-1), buffer));
+    REQUIRE(zigzag_decode(zigzag_encode(-1000)) == -1000);
+    REQUIRE(zigzag_decode(zigzag_encode(1000)) == 1000);
+}
+
+TEST_CASE("frame batch round trip") {
+    const int kNumFrames = 100;
+    uint8_t buffer[4096];
+    FrameBatchEncoder encoder(buffer, sizeof(buffer));
+    std::vector<std::vector<uint8_t> > frames;
+    for (int i=0; i < kNumFrames; i++) {
+        ImuFrame frame;
+        // 1 kHz with some jitter, and one step back
+        make_imu_frame(&frame, 1000000000ULL + i * 1000 + (i % 3) - (i == 50 ? 5000 : 0), (float)i);
+        frames.push_back(std::vector<uint8_t>(frame.get_buffer_pointer(), frame.get_buffer_pointer() + frame.get_size()));
+        REQUIRE(0 == encoder.add(frame.get_buffer_pointer(), frame.get_size()));
+    }
+    REQUIRE(0 == encoder.finish());
+    REQUIRE(encoder.get_frame_count() == kNumFrames);
+    // the meta data once, about 2 bytes instead of 12 for the header and timestamp
+    const uint32_t frame_bytes = ImuFrame::size * kNumFrames;
+    std::cout << "FrameBatch, frames: " << kNumFrames << ", " << frame_bytes << " bytes as frames, "
+              << encoder.get_size() << " bytes as batch" << std::endl;
+    REQUIRE(encoder.get_size() < frame_bytes - kNumFrames * (sizeof(FrameMessageHeader) + sizeof(SensorMetaData) + 4));
+
+    FrameBatchDecoder decoder(encoder.get_buffer_pointer(), encoder.get_size());
+    REQUIRE(decoder.valid());
+    REQUIRE(decoder.get_frame_count() == kNumFrames);
+    REQUIRE(decoder.get_frame_size() == ImuFrame::size);
+    uint8_t frame[ImuFrame::size];
+    uint32_t frame_size = 0;
+    for (int i=0; i < kNumFrames; i++) {
+        REQUIRE(0 == decoder.next(frame, sizeof(frame), &frame_size));
+        REQUIRE(frame_size == ImuFrame::size);
+        REQUIRE(0 == memcmp(frame, frames[i].data(), frame_size));
+    }
+    REQUIRE(-1 == decoder.next(frame, sizeof(frame), &frame_size));
+
+    // truncated batches are detected
+    FrameBatchDecoder truncated(encoder.get_buffer_pointer(), encoder.get_size() - 1);
+    REQUIRE(!truncated.valid());
+}
+
+TEST_CASE("frame batch rejects frames of another batch") {
+    uint8_t buffer[256];
+    FrameBatchEncoder encoder(buffer, sizeof(buffer));
+    ImuFrame frame;
+    make_imu_frame(&frame, 10, 1.0f);
+    REQUIRE(0 == encoder.add(frame.get_buffer_pointer(), frame.get_size()));
+    // other sensor
+    SensorMetaData meta;
+    meta.semantic = 2;
+    meta.sensor_id = 6;
+    frame.set(meta);
+    REQUIRE(-1 == encoder.add(frame.get_buffer_pointer(), frame.get_size()));
+    // other features
+    FrameMessage<TimestampData, BatteryData> battery_frame;
+    REQUIRE(-1 == encoder.add(battery_frame.get_buffer_pointer(), battery_frame.get_size()));
+    // full
+    meta.sensor_id = 5;
+    frame.set(meta);
+    int added = 1;
+    while (encoder.add(frame.get_buffer_pointer(), frame.get_size()) == 0) {
+        added++;
+    }
+    REQUIRE(0 == encoder.finish());
+    REQUIRE(encoder.get_size() <= sizeof(buffer));
+    REQUIRE(-1 == encoder.add(frame.get_buffer_pointer(), frame.get_size()));
+    FrameBatchDecoder decoder(encoder.get_buffer_pointer(), encoder.get_size());
+    REQUIRE(decoder.get_frame_count() == (uint32_t)added);
+    encoder.clear();
+    REQUIRE(0 == encoder.add(battery_frame.get_buffer_pointer(), battery_frame.get_size()));
+}
@@ -0,0 +1,166 @@
+// ===========================================================
+//
+// Copyright (c) 2018 Motesque Inc.  All rights reserved.
+//
+// ===========================================================
+#include "../../unittest/catch.hpp"
+#include "frame_codec.h"
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+using namespace motesque;
+
+typedef FrameMessage<SensorMetaData, TimestampData, LowNoiseImuData> ImuFrame;
+typedef FrameMessage<SensorMetaData, TimestampData, BarometerData> BaroFrame;
+
+// IMU like data: float counts of a 16 bit sensor, which mostly move in a few lower bits
+static void make_imu_frame(ImuFrame* frame, uint64_t timestamp_us, int i) {
+    SensorMetaData meta;
+    meta.semantic = 2;
+    meta.sensor_id = 5;
+    frame->set(meta);
+    TimestampData time_data;
+    time_data.timestamp_us = timestamp_us;
+    frame->set(time_data);
+    LowNoiseImuData imu_data;
+    for (int k=0; k < 3; k++) {
+        imu_data.acc_g[k] = (float)(((i / 4 + k) % 16) + 8192) / 8192.0f;
+        imu_data.gyr_rps[k] = (float)((i + k) % 8) / 256.0f;
+    }
+    frame->set(imu_data);
+}
+
+// encodes |frames| into consecutive blocks of at most |block_capacity| bytes
+static std::vector<uint8_t> encode_blocks(const std::vector<std::vector<uint8_t> >& frames, uint32_t block_capacity,
+                                          uint32_t* num_blocks) {
+    std::vector<uint8_t> block(block_capacity);
+    std::vector<uint8_t> stream;
+    FrameBlockEncoder encoder(block.data(), block_capacity);
+    *num_blocks = 0;
+    for (size_t i=0; i < frames.size(); i++) {
+        if (encoder.add(frames[i].data(), frames[i].size()) != 0) {
+            REQUIRE(encoder.get_frame_count() > 0);
+            REQUIRE(0 == encoder.finish());
+            stream.insert(stream.end(), block.begin(), block.begin() + encoder.get_size());
+            (*num_blocks)++;
+            encoder.clear();
+            REQUIRE(0 == encoder.add(frames[i].data(), frames[i].size()));
+        }
+    }
+    REQUIRE(0 == encoder.finish());
+    stream.insert(stream.end(), block.begin(), block.begin() + encoder.get_size());
+    (*num_blocks)++;
+    return stream;
+}
+
+TEST_CASE("frame codec round trip") {
+    std::vector<std::vector<uint8_t> > frames;
+    for (int i=0; i < 1000; i++) {
+        if (i % 100 == 99) {
+            BaroFrame frame;
+            BarometerData baro;
+            memset(&baro, 0, sizeof(baro));
+            baro.pressure_pa = 101325.0f + i;
+            frame.set(baro);
+            TimestampData time_data;
+            time_data.timestamp_us = 1000000000ULL + i * 1000;
+            frame.set(time_data);
+            frame.set(SensorMetaData());
+            frames.push_back(std::vector<uint8_t>(frame.get_buffer_pointer(), frame.get_buffer_pointer() + frame.get_size()));
+            continue;
+        }
+        ImuFrame frame;
+        // 1 kHz with some jitter, a step back and a large gap
+        const uint64_t timestamp_us = 1000000000ULL + i * 1000 + (i % 3) - (i == 50 ? 5000 : 0) + (i > 500 ? 30000000ULL : 0);
+        make_imu_frame(&frame, timestamp_us, i);
+        frames.push_back(std::vector<uint8_t>(frame.get_buffer_pointer(), frame.get_buffer_pointer() + frame.get_size()));
+    }
+    uint32_t num_blocks = 0;
+    const std::vector<uint8_t> stream = encode_blocks(frames, 512, &num_blocks);
+    REQUIRE(num_blocks > 20);
+
+    size_t offset = 0;
+    size_t decoded = 0;
+    uint32_t blocks = 0;
+    uint8_t frame[ImuFrame::size];
+    uint32_t frame_size = 0;
+    while (offset < stream.size()) {
+        FrameBlockDecoder decoder(stream.data() + offset, stream.size() - offset);
+        REQUIRE(decoder.valid());
+        for (uint32_t f=0; f < decoder.get_frame_count(); f++) {
+            REQUIRE(0 == decoder.next(frame, sizeof(frame), &frame_size));
+            REQUIRE(frame_size == frames[decoded].size());
+            REQUIRE(0 == memcmp(frame, frames[decoded].data(), frame_size));
+            decoded++;
+        }
+        REQUIRE(-1 == decoder.next(frame, sizeof(frame), &frame_size));
+        offset += decoder.get_block_size();
+        blocks++;
+    }
+    REQUIRE(decoded == frames.size());
+    REQUIRE(blocks == num_blocks);
+
+    // another feature mask or a frame which does not match its header is rejected
+    uint8_t block[512];
+    FrameBlockEncoder encoder(block, sizeof(block));
+    REQUIRE(0 == encoder.add(frames[0].data(), frames[0].size()));
+    REQUIRE(-1 == encoder.add(frames[99].data(), frames[99].size()));
+    REQUIRE(-1 == encoder.add(frames[1].data(), frames[1].size() - 1));
+    REQUIRE(0 == encoder.finish());
+    REQUIRE(-1 == encoder.add(frames[1].data(), frames[1].size()));
+
+    // a truncated block is detected
+    FrameBlockDecoder truncated(stream.data(), 4);
+    REQUIRE(!truncated.valid());
+    FrameCodecBlockHeader hdr;
+    memcpy(&hdr, stream.data(), sizeof(hdr));
+    std::vector<uint8_t> damaged(stream.begin(), stream.begin() + hdr.block_size);
+    hdr.block_size = (uint16_t)(sizeof(FrameCodecBlockHeader) + 16);
+    memcpy(damaged.data(), &hdr, sizeof(hdr));
+    FrameBlockDecoder short_block(damaged.data(), damaged.size());
+    REQUIRE(short_block.valid());
+    int rc = 0;
+    for (uint32_t f=0; f < short_block.get_frame_count() && rc == 0; f++) {
+        rc = short_block.next(frame, sizeof(frame), &frame_size);
+    }
+    REQUIRE(rc == -1);
+    REQUIRE(!short_block.valid());
+}
+
+TEST_CASE("frame codec compression benchmark") {
+    const int kNumFrames = 20000;
+    std::vector<std::vector<uint8_t> > frames;
+    for (int i=0; i < kNumFrames; i++) {
+        ImuFrame frame;
+        make_imu_frame(&frame, 1000000000ULL + i * 1000 + (i % 7 == 0 ? 1 : 0), i);
+        frames.push_back(std::vector<uint8_t>(frame.get_buffer_pointer(), frame.get_buffer_pointer() + frame.get_size()));
+    }
+    uint32_t num_blocks = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    const std::vector<uint8_t> stream = encode_blocks(frames, 4096, &num_blocks);
+    auto encoded = std::chrono::high_resolution_clock::now();
+    size_t offset = 0;
+    size_t decoded = 0;
+    uint8_t frame[ImuFrame::size];
+    uint32_t frame_size = 0;
+    while (offset < stream.size()) {
+        FrameBlockDecoder decoder(stream.data() + offset, stream.size() - offset);
+        while (decoder.next(frame, sizeof(frame), &frame_size) == 0) {
+            decoded++;
+        }
+        offset += decoder.get_block_size();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    REQUIRE(decoded == (size_t)kNumFrames);
+    REQUIRE(0 == memcmp(frame, frames.back().data(), frame_size));
+
+    const size_t frame_bytes = (size_t)ImuFrame::size * kNumFrames;
+    const double ratio = (double)stream.size() / frame_bytes;
+    std::cout << "FrameCodec, frames: " << kNumFrames << ", " << frame_bytes << " bytes as frames, "
+              << stream.size() << " bytes in " << num_blocks << " blocks, ratio " << ratio
+              << ", encode " << std::chrono::duration<double, std::micro>(encoded - start).count() / kNumFrames << " us/frame"
+              << ", decode " << std::chrono::duration<double, std::micro>(end - encoded).count() / kNumFrames << " us/frame"
+              << std::endl;
+    REQUIRE(ratio < 0.5);
+}
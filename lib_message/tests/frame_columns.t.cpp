@@ -0,0 +1,165 @@
+// ===========================================================
+//
+// Copyright (c) 2018 Motesque Inc.  All rights reserved.
+//
+// ===========================================================
+#include "../../unittest/catch.hpp"
+#include "frame_columns.h"
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+using namespace motesque;
+
+typedef FrameMessage<SensorMetaData, TimestampData, LowNoiseImuData> ImuFrame;
+typedef FrameMessage<TimestampData, BarometerData, QuantizedMagnetometerData> EnvFrame;
+
+// runs of imu frames with an env frame now and then
+static void make_stream(size_t num_frames, std::vector<uint8_t>* stream) {
+    for (size_t i=0; i < num_frames; i++) {
+        TimestampData time_data;
+        time_data.timestamp_us = 1000 * i;
+        if (i % 7 == 6) {
+            EnvFrame frame;
+            frame.set(time_data);
+            BarometerData baro;
+            baro.pressure_pa = 100000.0f + i;
+            baro.temperature_celsius = 20.0f;
+            frame.set(baro);
+            QuantizedMagnetometerData mag;
+            mag.mag[0] = (int16_t)i;
+            mag.mag[1] = -(int16_t)i;
+            mag.mag[2] = 3;
+            mag.reserved = 0;
+            frame.set(mag);
+            stream->insert(stream->end(), frame.get_buffer_pointer(), frame.get_buffer_pointer() + frame.get_size());
+        }
+        else {
+            ImuFrame frame;
+            SensorMetaData meta;
+            meta.semantic = 1;
+            meta.sensor_id = (uint32_t)i % 3;
+            frame.set(meta);
+            frame.set(time_data);
+            LowNoiseImuData imu;
+            for (int k=0; k < 3; k++) {
+                imu.acc_g[k] = 0.5f * i + k;
+                imu.gyr_rps[k] = -0.5f * i - k;
+            }
+            frame.set(imu);
+            stream->insert(stream->end(), frame.get_buffer_pointer(), frame.get_buffer_pointer() + frame.get_size());
+        }
+    }
+}
+
+// compares the columns with a frame by frame decode
+static bool columns_match(const FrameColumnDecoder& decoder, const std::vector<uint8_t>& stream) {
+    const uint64_t* timestamps = decoder.get_column<uint64_t>(TimestampData::feature_id, 0);
+    const float* acc_y = decoder.get_column<float>(LowNoiseImuData::feature_id, 1);
+    const float* gyr_z = decoder.get_column<float>(LowNoiseImuData::feature_id, 5);
+    const uint32_t* sensor_ids = decoder.get_column<uint32_t>(SensorMetaData::feature_id, 1);
+    const float* pressure = decoder.get_column<float>(BarometerData::feature_id, 0);
+    const int16_t* mag_y = decoder.get_column<int16_t>(QuantizedMagnetometerData::feature_id, 1);
+    size_t offset = 0;
+    size_t imu_row = 0;
+    size_t env_row = 0;
+    for (size_t frame=0; offset < stream.size(); frame++) {
+        FrameMessageView view(stream.data() + offset, stream.size() - offset);
+        if (decoder.get_feature_masks()[frame] != view.feature_mask()) {
+            return false;
+        }
+        if (timestamps[frame] != view.get<TimestampData>()->timestamp_us) {
+            return false;
+        }
+        if (view.has<LowNoiseImuData>()) {
+            const LowNoiseImuData* imu = view.get<LowNoiseImuData>();
+            if (acc_y[imu_row] != imu->acc_g[1] || gyr_z[imu_row] != imu->gyr_rps[2] ||
+                sensor_ids[imu_row] != view.get<SensorMetaData>()->sensor_id) {
+                return false;
+            }
+            imu_row++;
+        }
+        else {
+            if (pressure[env_row] != view.get<BarometerData>()->pressure_pa ||
+                mag_y[env_row] != view.get<QuantizedMagnetometerData>()->mag[1]) {
+                return false;
+            }
+            env_row++;
+        }
+        offset += view.size();
+    }
+    return imu_row == decoder.get_rows(LowNoiseImuData::feature_id) && env_row == decoder.get_rows(BarometerData::feature_id);
+}
+
+TEST_CASE("frame column decoder") {
+    const size_t kNumFrames = 1000;
+    std::vector<uint8_t> stream;
+    make_stream(kNumFrames, &stream);
+    FrameColumnDecoder decoder;
+    REQUIRE(decoder.get_num_fields(LowNoiseImuData::feature_id) == 6);
+    REQUIRE(decoder.get_num_fields(TimestampData::feature_id) == 1);
+    REQUIRE(decoder.get_num_fields(QuantizedMagnetometerData::feature_id) == 4);
+    // wrong type
+    REQUIRE(decoder.get_column<double>(LowNoiseImuData::feature_id, 0) == NULL);
+    REQUIRE(decoder.get_column<float>(LowNoiseImuData::feature_id, 6) == NULL);
+
+    // in two calls, the first one ends within a frame
+    size_t consumed = 0;
+    const size_t split = stream.size() / 2 + 3;
+    REQUIRE(0 == decoder.decode(stream.data(), split, &consumed));
+    REQUIRE(consumed < split);
+    size_t rest_consumed = 0;
+    REQUIRE(0 == decoder.decode(stream.data() + consumed, stream.size() - consumed, &rest_consumed));
+    REQUIRE(consumed + rest_consumed == stream.size());
+    REQUIRE(decoder.get_frame_count() == kNumFrames);
+    REQUIRE(decoder.get_rows(TimestampData::feature_id) == kNumFrames);
+    REQUIRE(columns_match(decoder, stream));
+
+    // the same with threads
+    FrameColumnDecoder threaded;
+    REQUIRE(0 == threaded.decode(stream.data(), stream.size(), &consumed, 4));
+    REQUIRE(consumed == stream.size());
+    REQUIRE(columns_match(threaded, stream));
+
+    // a damaged frame stops the decoding
+    std::vector<uint8_t> damaged(stream);
+    FrameMessageHeader hdr;
+    memcpy(&hdr, damaged.data() + ImuFrame::size, sizeof(hdr));
+    hdr.message_size += 4;
+    memcpy(damaged.data() + ImuFrame::size, &hdr, sizeof(hdr));
+    FrameColumnDecoder damaged_decoder;
+    REQUIRE(-1 == damaged_decoder.decode(damaged.data(), damaged.size(), &consumed, 2));
+    REQUIRE(consumed == ImuFrame::size);
+    REQUIRE(damaged_decoder.get_frame_count() == 1);
+}
+
+TEST_CASE("frame column decoder benchmark") {
+    const size_t kNumFrames = 2000000;
+    std::vector<uint8_t> stream;
+    make_stream(kNumFrames, &stream);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint64_t> timestamps;
+    std::vector<float> acc_x;
+    timestamps.reserve(kNumFrames);
+    acc_x.reserve(kNumFrames);
+    for (size_t offset=0; offset < stream.size();) {
+        FrameMessageView view(stream.data() + offset, stream.size() - offset);
+        timestamps.push_back(view.get<TimestampData>()->timestamp_us);
+        if (view.has<LowNoiseImuData>()) {
+            acc_x.push_back(view.get<LowNoiseImuData>()->acc_g[0]);
+        }
+        offset += view.size();
+    }
+    auto frame_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    for (int num_threads=1; num_threads <= 4; num_threads *= 2) {
+        FrameColumnDecoder decoder;
+        size_t consumed = 0;
+        start = std::chrono::steady_clock::now();
+        REQUIRE(0 == decoder.decode(stream.data(), stream.size(), &consumed, num_threads));
+        auto columns_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        REQUIRE(decoder.get_rows(LowNoiseImuData::feature_id) == acc_x.size());
+        REQUIRE(0 == memcmp(decoder.get_column<uint64_t>(TimestampData::feature_id, 0), timestamps.data(), timestamps.size() * sizeof(uint64_t)));
+        std::cout << "FrameColumnDecoder, frames: " << kNumFrames << ", threads: " << num_threads << ", all columns: "
+                  << columns_us << " us, frame by frame (2 fields): " << frame_us << " us" << std::endl;
+    }
+}
@@ -0,0 +1,137 @@
+// ===========================================================
+//
+// Copyright (c) 2018 Motesque Inc.  All rights reserved.
+//
+// ===========================================================
+#include "../../unittest/catch.hpp"
+#include "frame_demux.h"
+#include "futex.h"
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+using namespace motesque;
+
+typedef FrameMessage<SensorMetaData, TimestampData, LowNoiseImuData> ImuFrame;
+typedef FrameMessage<TimestampData, BarometerData> BaroFrame;
+
+// what the handler of one sensor saw
+struct LaneResult {
+    LaneResult() : frames(0), last_timestamp_us(0), in_order(true), thread() {}
+    uint64_t        frames;
+    uint64_t        last_timestamp_us;
+    bool            in_order;
+    std::thread::id thread;
+};
+
+// interleaves |num_frames| frames of |num_sensors| sensors, every 10th frame without SensorMetaData
+static std::vector<uint8_t> make_stream(int num_frames, int num_sensors) {
+    std::vector<uint8_t> stream;
+    for (int i=0; i < num_frames; i++) {
+        TimestampData time_data;
+        time_data.timestamp_us = 1000 + i;
+        if (i % 10 == 9) {
+            BaroFrame frame;
+            frame.set(time_data);
+            frame.set(BarometerData());
+            stream.insert(stream.end(), frame.get_buffer_pointer(), frame.get_buffer_pointer() + frame.get_size());
+            continue;
+        }
+        ImuFrame frame;
+        SensorMetaData meta;
+        meta.semantic = 2;
+        meta.sensor_id = (uint32_t)((i * 7) % num_sensors);
+        frame.set(meta);
+        frame.set(time_data);
+        LowNoiseImuData imu_data;
+        memset(&imu_data, 0, sizeof(imu_data));
+        frame.set(imu_data);
+        stream.insert(stream.end(), frame.get_buffer_pointer(), frame.get_buffer_pointer() + frame.get_size());
+    }
+    return stream;
+}
+
+template<typename DEMUX>
+static void run_demux(const std::vector<uint8_t>& stream, size_t lane_size, size_t piece,
+                      std::map<uint32_t, LaneResult>* results) {
+    std::mutex mutex;
+    DEMUX demux(lane_size, [&](uint32_t sensor_id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        LaneResult* result = &(*results)[sensor_id];
+        return typename DEMUX::Handler([result](const uint8_t* frame, uint32_t frame_size) {
+            FrameMessageView view(frame, frame_size);
+            uint64_t timestamp_us = 0;
+            memcpy(&timestamp_us, view.get<TimestampData>(), sizeof(uint64_t));
+            result->in_order = result->in_order && timestamp_us > result->last_timestamp_us;
+            result->last_timestamp_us = timestamp_us;
+            result->thread = std::this_thread::get_id();
+            result->frames++;
+        });
+    });
+    size_t offset = 0;
+    size_t pending = 0;
+    while (offset + pending < stream.size()) {
+        pending += std::min(piece, stream.size() - offset - pending);
+        size_t consumed = 0;
+        REQUIRE(0 == demux.push(stream.data() + offset, pending, &consumed));
+        offset += consumed;
+        pending -= consumed;
+    }
+    REQUIRE(pending == 0);
+    demux.stop();
+    for (std::map<uint32_t, LaneResult>::iterator it = results->begin(); it != results->end(); ++it) {
+        REQUIRE(demux.get_frame_count(it->first) == it->second.frames);
+    }
+}
+
+TEST_CASE("frame demux routes frames per sensor") {
+    const int kNumFrames = 20000;
+    const int kNumSensors = 6;
+    const std::vector<uint8_t> stream = make_stream(kNumFrames, kNumSensors);
+    for (int mirrored=0; mirrored < 2; mirrored++) {
+        std::map<uint32_t, LaneResult> results;
+        if (mirrored) {
+            run_demux<FrameDemuxT<FutexEventFlag, MirroredRingStorage> >(stream, 4096, 1000, &results);
+        }
+        else {
+            // an odd size, frames get split at the end of the ring
+            run_demux<FrameDemuxT<FutexEventFlag, HeapRingStorage> >(stream, 1001, 333, &results);
+        }
+        REQUIRE(results.size() == kNumSensors + 1);
+        uint64_t frames = 0;
+        for (std::map<uint32_t, LaneResult>::iterator it = results.begin(); it != results.end(); ++it) {
+            REQUIRE(it->second.in_order);
+            REQUIRE(it->second.thread != std::this_thread::get_id());
+            frames += it->second.frames;
+        }
+        REQUIRE(frames == kNumFrames);
+        REQUIRE(results[kFrameDemuxNoSensor].frames == kNumFrames / 10);
+    }
+
+    // a damaged frame stops routing
+    FrameDemuxT<FutexEventFlag> demux(1024, [](uint32_t) {
+        return FrameDemuxT<FutexEventFlag>::Handler([](const uint8_t*, uint32_t) {});
+    });
+    std::vector<uint8_t> damaged(stream.begin(), stream.begin() + ImuFrame::size * 2);
+    FrameMessageHeader hdr;
+    hdr.message_size = 2;
+    hdr.feature_mask = 0;
+    memcpy(damaged.data() + ImuFrame::size, &hdr, sizeof(hdr));
+    size_t consumed = 0;
+    REQUIRE(-1 == demux.push(damaged.data(), damaged.size(), &consumed));
+    REQUIRE(consumed == ImuFrame::size);
+    REQUIRE(demux.get_lane_count() == 1);
+}
+
+TEST_CASE("frame demux benchmark") {
+    const int kNumFrames = 200000;
+    const int kNumSensors = 4;
+    const std::vector<uint8_t> stream = make_stream(kNumFrames, kNumSensors);
+    std::map<uint32_t, LaneResult> results;
+    auto start = std::chrono::high_resolution_clock::now();
+    run_demux<FrameDemuxT<FutexEventFlag, MirroredRingStorage> >(stream, 64 * 1024, 64 * 1024, &results);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "FrameDemux, " << kNumFrames << " frames to " << results.size() << " lanes: "
+              << std::chrono::duration<double, std::micro>(end - start).count() / kNumFrames << " us/frame" << std::endl;
+}
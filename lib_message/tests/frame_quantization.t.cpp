@@ -0,0 +1,205 @@
+// ===========================================================
+//
+// Copyright (c) 2018 Motesque Inc.  All rights reserved.
+//
+// ===========================================================
+#include "../../unittest/catch.hpp"
+#include "frame_quantization.h"
+#include "frame_batch.h"
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+using namespace motesque;
+
+static QuantizationScaleData imu_scale() {
+    QuantizationScaleData scale;
+    // +-16 g and +-2000 dps over the int16 range
+    scale.acc_g = 16.0f / 32768.0f;
+    scale.gyr_rps = 34.9f / 32768.0f;
+    scale.mag_gauss = 0.00015f;
+    return scale;
+}
+
+TEST_CASE("quantized features keep the layout aligned") {
+    const FeatureArray& sizes = all_feature_sizes();
+    for (size_t i=0; i < sizes.size(); i++) {
+        REQUIRE(sizes[i] % 4 == 0);
+    }
+    REQUIRE(all_feature_ids()[12] == QuantizedMagnetometerData::feature_id);
+    REQUIRE(FrameMessageOffset<QuantizedMagnetometerData>::value ==
+            FrameMessageOffset<QuantizedHighRangeImuData>::value + sizeof(QuantizedHighRangeImuData));
+    // half the payload of the float variant
+    REQUIRE(sizeof(QuantizedLowNoiseImuData) * 2 == sizeof(LowNoiseImuData));
+}
+
+TEST_CASE("quantize and dequantize imu data") {
+    const QuantizationScaleData scale = imu_scale();
+    const size_t kNumFrames = 100;
+    std::vector<LowNoiseImuData> imu(kNumFrames);
+    for (size_t i=0; i < kNumFrames; i++) {
+        for (int k=0; k < 3; k++) {
+            imu[i].acc_g[k] = std::sin(0.1f * i + k) * 15.0f;
+            imu[i].gyr_rps[k] = std::cos(0.1f * i + k) * -30.0f;
+        }
+    }
+    // saturates
+    imu[0].acc_g[0] = 100.0f;
+    imu[0].acc_g[1] = -100.0f;
+    std::vector<QuantizedLowNoiseImuData> packed(kNumFrames);
+    quantize(imu.data(), kNumFrames, scale, packed.data());
+    std::vector<LowNoiseImuData> unpacked(kNumFrames);
+    dequantize(packed.data(), kNumFrames, scale, unpacked.data());
+    REQUIRE(packed[0].acc[0] == 32767);
+    REQUIRE(packed[0].acc[1] == -32768);
+    float max_acc_error = 0;
+    float max_gyr_error = 0;
+    for (size_t i=1; i < kNumFrames; i++) {
+        for (int k=0; k < 3; k++) {
+            max_acc_error = std::max(max_acc_error, std::fabs(unpacked[i].acc_g[k] - imu[i].acc_g[k]));
+            max_gyr_error = std::max(max_gyr_error, std::fabs(unpacked[i].gyr_rps[k] - imu[i].gyr_rps[k]));
+        }
+    }
+    // rounded to the nearest count
+    REQUIRE(max_acc_error <= scale.acc_g * 0.5f * 1.01f);
+    REQUIRE(max_gyr_error <= scale.gyr_rps * 0.5f * 1.01f);
+
+    MagnetometerData mag;
+    mag.mag_gauss[0] = 0.3f;
+    mag.mag_gauss[1] = -0.3f;
+    mag.mag_gauss[2] = 0.0f;
+    QuantizedMagnetometerData mag_packed;
+    quantize(&mag, 1, scale, &mag_packed);
+    REQUIRE(mag_packed.mag[0] == 2000);
+    REQUIRE(mag_packed.mag[1] == -2000);
+    REQUIRE(mag_packed.reserved == 0);
+    MagnetometerData mag_unpacked;
+    dequantize(&mag_packed, 1, scale, &mag_unpacked);
+    REQUIRE(std::fabs(mag_unpacked.mag_gauss[0] - 0.3f) < 1e-5f);
+}
+
+TEST_CASE("quantize non finite values and a zero scale") {
+    const float values[5] = {NAN, INFINITY, -INFINITY, 1.0f, 0.0f};
+    int16_t counts[5];
+    quantize_int16(values, 0.5f, counts, 5);
+    REQUIRE(counts[0] == 0);
+    REQUIRE(counts[1] == 32767);
+    REQUIRE(counts[2] == -32768);
+    REQUIRE(counts[3] == 2);
+    // a zero scale saturates what is not 0
+    quantize_int16(values, 0.0f, counts, 5);
+    REQUIRE(counts[0] == 0);
+    REQUIRE(counts[3] == 32767);
+    REQUIRE(counts[4] == 0);
+
+    QuantizationScaleData scale = imu_scale();
+    scale.mag_gauss = 0.0f;
+    MagnetometerData mag;
+    mag.mag_gauss[0] = NAN;
+    mag.mag_gauss[1] = -0.3f;
+    mag.mag_gauss[2] = 0.0f;
+    QuantizedMagnetometerData mag_packed;
+    quantize(&mag, 1, scale, &mag_packed);
+    REQUIRE(mag_packed.mag[0] == 0);
+    REQUIRE(mag_packed.mag[1] == -32768);
+    REQUIRE(mag_packed.mag[2] == 0);
+}
+
+TEST_CASE("quantized frames are smaller than float frames") {
+    typedef FrameMessage<SensorMetaData, TimestampData, QuantizedHighRangeImuData> QuantizedFrame;
+    typedef FrameMessage<SensorMetaData, TimestampData, HighRangeImuData> FloatFrame;
+    typedef FrameMessage<SensorMetaData, QuantizationScaleData> ScaleFrame;
+    std::cout << "Quantized HighRangeImu frames: " << QuantizedFrame::size << " bytes vs " << FloatFrame::size
+              << ", once per stream: " << ScaleFrame::size << " bytes" << std::endl;
+    // the scale is not part of the data frames
+    REQUIRE((size_t)QuantizedFrame::size + sizeof(QuantizedHighRangeImuData) == (size_t)FloatFrame::size);
+    REQUIRE((size_t)QuantizedFrame::size < (size_t)FloatFrame::size);
+}
+
+TEST_CASE("quantized frames in a batch") {
+    typedef FrameMessage<SensorMetaData, TimestampData, QuantizedHighRangeImuData> QuantizedFrame;
+    typedef FrameMessage<SensorMetaData, QuantizationScaleData> ScaleFrame;
+    const QuantizationScaleData scale = imu_scale();
+    SensorMetaData meta;
+    meta.semantic = 1;
+    meta.sensor_id = 4;
+    // the stream starts with its scales
+    ScaleFrame scale_frame;
+    scale_frame.set(meta);
+    scale_frame.set(scale);
+    QuantizationScaleCache cache;
+    REQUIRE(cache.find(4) == NULL);
+    REQUIRE(0 == cache.update(scale_frame.get_buffer_pointer(), scale_frame.get_size()));
+    REQUIRE(cache.find(4) != NULL);
+    REQUIRE(cache.find(5) == NULL);
+
+    const int kNumFrames = 50;
+    uint8_t buffer[2048];
+    FrameBatchEncoder encoder(buffer, sizeof(buffer));
+    for (int i=0; i < kNumFrames; i++) {
+        HighRangeImuData imu;
+        for (int k=0; k < 3; k++) {
+            imu.acc_g[k] = 0.01f * i * k;
+            imu.gyr_rps[k] = -0.02f * i * k;
+        }
+        QuantizedHighRangeImuData packed;
+        quantize(&imu, 1, scale, &packed);
+        QuantizedFrame frame;
+        frame.set(meta);
+        TimestampData time_data;
+        time_data.timestamp_us = 1000 * i;
+        frame.set(time_data);
+        frame.set(packed);
+        // data frames leave the cache alone
+        REQUIRE(0 == cache.update(frame.get_buffer_pointer(), frame.get_size()));
+        REQUIRE(0 == encoder.add(frame.get_buffer_pointer(), frame.get_size()));
+    }
+    REQUIRE(0 == encoder.finish());
+    // 2 bytes timestamp + 12 bytes imu per frame
+    REQUIRE(encoder.get_size() == sizeof(FrameBatchHeader) + sizeof(SensorMetaData) + 14 * (kNumFrames - 1) + 1 + 12);
+    std::cout << "Quantized HighRangeImu batch of " << kNumFrames << ": " << encoder.get_size() << " bytes" << std::endl;
+
+    FrameBatchDecoder decoder(encoder.get_buffer_pointer(), encoder.get_size());
+    uint8_t frame[QuantizedFrame::size];
+    uint32_t frame_size = 0;
+    for (int i=0; i < kNumFrames; i++) {
+        REQUIRE(0 == decoder.next(frame, sizeof(frame), &frame_size));
+    }
+    FrameMessageView view(frame, frame_size);
+    REQUIRE(view.get<TimestampData>()->timestamp_us == 1000 * (kNumFrames - 1));
+    const QuantizationScaleData* stream_scale = cache.find(view.get<SensorMetaData>()->sensor_id);
+    REQUIRE(stream_scale != NULL);
+    REQUIRE(stream_scale->acc_g == scale.acc_g);
+    HighRangeImuData imu;
+    dequantize(view.get<QuantizedHighRangeImuData>(), 1, *stream_scale, &imu);
+    REQUIRE(std::fabs(imu.acc_g[2] - 0.01f * (kNumFrames - 1) * 2) < scale.acc_g);
+
+    // a full cache rejects new streams, known ones are still updated
+    for (uint32_t id=100; cache.set(id, scale) == 0; id++) {
+    }
+    REQUIRE(-1 == cache.set(1000, scale));
+    REQUIRE(0 == cache.set(4, imu_scale()));
+}
+
+TEST_CASE("quantize benchmark") {
+    const size_t kNumFrames = 1000000;
+    const QuantizationScaleData scale = imu_scale();
+    std::vector<LowNoiseImuData> imu(kNumFrames);
+    for (size_t i=0; i < kNumFrames; i++) {
+        for (int k=0; k < 3; k++) {
+            imu[i].acc_g[k] = (float)((i + k) % 32) - 16.0f;
+            imu[i].gyr_rps[k] = (float)((i * k) % 32) - 16.0f;
+        }
+    }
+    std::vector<QuantizedLowNoiseImuData> packed(kNumFrames);
+    auto start = std::chrono::steady_clock::now();
+    quantize(imu.data(), kNumFrames, scale, packed.data());
+    auto quantize_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    dequantize(packed.data(), kNumFrames, scale, imu.data());
+    auto dequantize_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    REQUIRE(imu[kNumFrames - 1].acc_g[0] == 15.0f);
+    std::cout << "LowNoiseImu frames: " << kNumFrames << ", quantize: " << quantize_us << " us, dequantize: "
+              << dequantize_us << " us" << std::endl;
+}
@@ -0,0 +1,161 @@
+// ===========================================================
+//
+// Copyright (c) 2018 Motesque Inc.  All rights reserved.
+//
+// ===========================================================
+#include "../../unittest/catch.hpp"
+#include "frame_stream.h"
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+using namespace motesque;
+
+typedef FrameMessage<SensorMetaData, TimestampData, LowNoiseImuData> ImuFrame;
+
+static void append_record(std::vector<uint8_t>* stream, const uint8_t* payload, uint32_t payload_size) {
+    FrameStreamHeader hdr;
+    REQUIRE(0 == frame_stream_header(payload, payload_size, &hdr));
+    stream->insert(stream->end(), (const uint8_t*)&hdr, (const uint8_t*)&hdr + sizeof(hdr));
+    stream->insert(stream->end(), payload, payload + payload_size);
+}
+
+static std::vector<uint8_t> make_imu_payload(int i) {
+    ImuFrame frame;
+    TimestampData time_data;
+    time_data.timestamp_us = 1000000ULL + i * 1000;
+    frame.set(time_data);
+    LowNoiseImuData imu_data;
+    for (int k=0; k < 3; k++) {
+        imu_data.acc_g[k] = (float)(i + k);
+        imu_data.gyr_rps[k] = -(float)(i + k);
+    }
+    frame.set(imu_data);
+    SensorMetaData meta;
+    meta.semantic = 2;
+    meta.sensor_id = (uint16_t)i;
+    frame.set(meta);
+    return std::vector<uint8_t>(frame.get_buffer_pointer(), frame.get_buffer_pointer() + frame.get_size());
+}
+
+// feeds |stream| in pieces of |piece| bytes like a socket would and collects the payloads
+static std::vector<std::vector<uint8_t> > scan_stream(FrameStreamScanner* scanner, const std::vector<uint8_t>& stream,
+                                                      size_t piece, size_t* unconsumed) {
+    std::vector<std::vector<uint8_t> > payloads;
+    std::vector<uint8_t> pending;
+    size_t offset = 0;
+    while (offset < stream.size()) {
+        const size_t n = std::min(piece, stream.size() - offset);
+        pending.insert(pending.end(), stream.begin() + offset, stream.begin() + offset + n);
+        offset += n;
+        size_t done = 0;
+        size_t consumed = 0;
+        const uint8_t* payload = NULL;
+        uint32_t payload_size = 0;
+        while (scanner->scan(pending.data() + done, pending.size() - done, &consumed, &payload, &payload_size) == 0) {
+            payloads.push_back(std::vector<uint8_t>(payload, payload + payload_size));
+            done += consumed;
+        }
+        done += consumed;
+        pending.erase(pending.begin(), pending.begin() + done);
+    }
+    *unconsumed = pending.size();
+    return payloads;
+}
+
+TEST_CASE("frame stream resynchronizes after damage") {
+    std::vector<uint8_t> stream;
+    std::vector<std::vector<uint8_t> > expected;
+    size_t lost = 0;
+    for (int i=0; i < 200; i++) {
+        const std::vector<uint8_t> payload = make_imu_payload(i);
+        if (i == 20) {
+            // cut mid frame, e.g. a reconnect
+            std::vector<uint8_t> record;
+            append_record(&record, payload.data(), payload.size());
+            stream.insert(stream.end(), record.begin(), record.begin() + 30);
+            lost += 30;
+            continue;
+        }
+        if (i == 50) {
+            // garbage full of partial markers
+            for (int k=0; k < 300; k++) {
+                stream.push_back(k % 3 == 0 ? kFrameStreamSync[0] : (uint8_t)k);
+            }
+            stream.insert(stream.end(), kFrameStreamSync, kFrameStreamSync + 4);
+            lost += 304;
+        }
+        if (i == 120) {
+            // a flipped bit
+            std::vector<uint8_t> record;
+            append_record(&record, payload.data(), payload.size());
+            record[sizeof(FrameStreamHeader) + 17] ^= 0x10;
+            stream.insert(stream.end(), record.begin(), record.end());
+            lost += record.size();
+            continue;
+        }
+        append_record(&stream, payload.data(), payload.size());
+        expected.push_back(payload);
+    }
+    // a cut at the very end stays unconsumed
+    std::vector<uint8_t> last;
+    append_record(&last, expected[0].data(), expected[0].size());
+    stream.insert(stream.end(), last.begin(), last.begin() + 10);
+
+    const size_t pieces[] = {1, 7, 97, 4096};
+    for (size_t p=0; p < sizeof(pieces) / sizeof(pieces[0]); p++) {
+        FrameStreamScanner scanner;
+        size_t unconsumed = 0;
+        const std::vector<std::vector<uint8_t> > payloads = scan_stream(&scanner, stream, pieces[p], &unconsumed);
+        REQUIRE(payloads.size() == expected.size());
+        for (size_t i=0; i < payloads.size(); i++) {
+            REQUIRE(payloads[i] == expected[i]);
+        }
+        REQUIRE(scanner.get_record_count() == expected.size());
+        // the flipped bit and the cut record, which reaches into the next one
+        REQUIRE(scanner.get_crc_errors() == 2);
+        REQUIRE(unconsumed == 10);
+        REQUIRE(scanner.get_lost_bytes() == lost);
+    }
+
+    // too large
+    FrameStreamHeader hdr;
+    REQUIRE(-1 == frame_stream_header(stream.data(), 0x10000, &hdr));
+}
+
+TEST_CASE("frame stream scanner benchmark") {
+    // intact records, then a damaged region of the same size
+    std::vector<uint8_t> stream;
+    while (stream.size() < 8 * 1024 * 1024) {
+        const std::vector<uint8_t> payload = make_imu_payload((int)stream.size());
+        append_record(&stream, payload.data(), payload.size());
+    }
+    const size_t intact = stream.size();
+    uint32_t seed = 1;
+    for (size_t i=0; i < intact; i++) {
+        seed = seed * 1103515245 + 12345;
+        const uint8_t byte = (uint8_t)(seed >> 16);
+        stream.push_back(byte == kFrameStreamSync[0] ? 0 : byte);
+    }
+    FrameStreamScanner scanner;
+    size_t offset = 0;
+    size_t consumed = 0;
+    const uint8_t* payload = NULL;
+    uint32_t payload_size = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    while (scanner.scan(stream.data() + offset, intact - offset, &consumed, &payload, &payload_size) == 0) {
+        offset += consumed;
+    }
+    auto scanned = std::chrono::high_resolution_clock::now();
+    REQUIRE(offset == intact);
+    REQUIRE(0 == scanner.scan(stream.data(), stream.size(), &consumed, &payload, &payload_size));
+    REQUIRE(-1 == scanner.scan(stream.data() + intact, stream.size() - intact, &consumed, &payload, &payload_size));
+    auto skipped = std::chrono::high_resolution_clock::now();
+    REQUIRE(consumed == stream.size() - intact);
+    REQUIRE(scanner.get_lost_bytes() == consumed);
+
+    const double mb = intact / (1024.0 * 1024.0);
+    std::cout << "FrameStreamScanner, " << scanner.get_record_count() << " records: "
+              << mb / std::chrono::duration<double>(scanned - start).count() << " MB/s intact, "
+              << mb / std::chrono::duration<double>(skipped - scanned).count() << " MB/s skipped" << std::endl;
+}
@@ -5,6 +5,11 @@
 // ===========================================================
 #include "../../unittest/catch.hpp"
 #include "message_frame.h"
+#include "sequential_buffer.h"
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
 
 
 TEST_CASE( "all_feature_ids") {
@@ -133,3 +138,210 @@ TEST_CASE("battery data type")
     REQUIRE( 3.0f ==  b.acc_g[2]);
 
 }
+
+TEST_CASE("FrameMessage matches FrameMessageBuilder")
+{
+    using namespace motesque;
+    // not in feature_id order on purpose
+    typedef FrameMessage<BatteryData, HighRangeImuData, TimestampData> Frame;
+    static_assert(Frame::size == sizeof(FrameMessageHeader) + sizeof(TimestampData) + sizeof(HighRangeImuData) + sizeof(BatteryData), "size");
+    static_assert(Frame::feature_mask == (TimestampData::feature_id | HighRangeImuData::feature_id | BatteryData::feature_id), "mask");
+    REQUIRE(Frame::Offset<TimestampData>::value == sizeof(FrameMessageHeader));
+    REQUIRE(Frame::Offset<BatteryData>::value == sizeof(FrameMessageHeader) + sizeof(TimestampData) + sizeof(HighRangeImuData));
+    REQUIRE(Frame::size == frame_message_size(feature_offset_tables(), Frame::feature_mask));
+    REQUIRE(sizeof(FrameMessageHeader) == frame_message_size(feature_offset_tables(), 0));
+
+    TimestampData time_data;
+    time_data.timestamp_us = 12344ULL;
+    HighRangeImuData imu_data;
+    memset(&imu_data, 0, sizeof(imu_data));
+    imu_data.acc_g[0] = 1.0f;
+    imu_data.gyr_rps[2] = 3.0f;
+    BatteryData battery_data;
+    battery_data.state_of_charge = 0.5f;
+
+    FrameMessageBuilder builder;
+    builder.add(imu_data);
+    builder.add(battery_data);
+    builder.add(time_data);
+    builder.finish();
+
+    Frame frame;
+    frame.set(imu_data);
+    frame.set(time_data);
+    frame.set(battery_data);
+    REQUIRE(frame.get_size() == builder.get_size());
+    REQUIRE(0 == memcmp(frame.get_buffer_pointer(), builder.get_buffer_pointer(), frame.get_size()));
+
+    uint8_t buffer[Frame::size];
+    Frame::write(buffer, battery_data, imu_data, time_data);
+    REQUIRE(0 == memcmp(buffer, builder.get_buffer_pointer(), Frame::size));
+    HighRangeImuData imu_copy;
+    REQUIRE(0 == get_frame_message_data(buffer, Frame::size, &imu_copy));
+    REQUIRE(3.0f == imu_copy.gyr_rps[2]);
+    BatteryData battery_copy;
+    REQUIRE(0 == get_frame_message_data(buffer, Frame::size, &battery_copy));
+    REQUIRE(0.5f == battery_copy.state_of_charge);
+}
+
+TEST_CASE("FrameMessageView reads fields in place")
+{
+    using namespace motesque;
+    typedef FrameMessage<SensorMetaData, TimestampData, HighRangeImuData, MagnetometerData, BatteryData> Frame;
+    Frame frame;
+    SensorMetaData meta;
+    meta.semantic = 7;
+    meta.sensor_id = 3;
+    frame.set(meta);
+    TimestampData time_data;
+    time_data.timestamp_us = 12344ULL;
+    frame.set(time_data);
+    MagnetometerData mag_data;
+    memset(&mag_data, 0, sizeof(mag_data));
+    mag_data.mag_gauss[1] = 0.25f;
+    frame.set(mag_data);
+    BatteryData battery_data;
+    battery_data.state_of_charge = 0.5f;
+    frame.set(battery_data);
+
+    FrameMessageView view(frame.get_buffer_pointer(), frame.get_size());
+    REQUIRE(view.valid());
+    REQUIRE(view.size() == Frame::size);
+    REQUIRE(view.get<SensorMetaData>()->sensor_id == 3);
+    REQUIRE(view.get<TimestampData>()->timestamp_us == 12344ULL);
+    REQUIRE(view.get<MagnetometerData>()->mag_gauss[1] == 0.25f);
+    REQUIRE(view.get<BatteryData>()->state_of_charge == 0.5f);
+    REQUIRE(view.get<LowNoiseImuData>() == NULL);
+    // no copy, the pointers point into the buffer
+    REQUIRE((const uint8_t*)view.get<BatteryData>() == frame.get_buffer_pointer() + Frame::Offset<BatteryData>::value);
+
+    // truncated
+    FrameMessageView truncated(frame.get_buffer_pointer(), frame.get_size() - 1);
+    REQUIRE(!truncated.valid());
+    REQUIRE(truncated.get<SensorMetaData>() == NULL);
+}
+
+TEST_CASE("FrameMessageView vs get_frame_message_data benchmark")
+{
+    using namespace motesque;
+    typedef FrameMessage<SensorMetaData, TimestampData, HighRangeImuData, MagnetometerData, BatteryData> Frame;
+    const size_t kNumFrames = 1000000;
+    Frame frame;
+    BatteryData battery_data;
+    battery_data.state_of_charge = 0.5f;
+    frame.set(battery_data);
+    double sum_copy = 0;
+    double sum_view = 0;
+    // no REQUIRE in the loops, it would dominate the timing
+    size_t missing = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i=0; i < kNumFrames; i++) {
+        TimestampData time_data;
+        time_data.timestamp_us = i;
+        frame.set(time_data);
+        SensorMetaData meta;
+        HighRangeImuData imu_data;
+        MagnetometerData mag_data;
+        BatteryData battery_copy;
+        get_frame_message_data(frame.get_buffer_pointer(), frame.get_size(), &meta);
+        get_frame_message_data(frame.get_buffer_pointer(), frame.get_size(), &time_data);
+        get_frame_message_data(frame.get_buffer_pointer(), frame.get_size(), &imu_data);
+        get_frame_message_data(frame.get_buffer_pointer(), frame.get_size(), &mag_data);
+        get_frame_message_data(frame.get_buffer_pointer(), frame.get_size(), &battery_copy);
+        sum_copy += time_data.timestamp_us + battery_copy.state_of_charge;
+    }
+    auto copy_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (size_t i=0; i < kNumFrames; i++) {
+        TimestampData time_data;
+        time_data.timestamp_us = i;
+        frame.set(time_data);
+        FrameMessageView view(frame.get_buffer_pointer(), frame.get_size());
+        const SensorMetaData* meta = view.get<SensorMetaData>();
+        const HighRangeImuData* imu_data = view.get<HighRangeImuData>();
+        const MagnetometerData* mag_data = view.get<MagnetometerData>();
+        missing += meta == NULL || imu_data == NULL || mag_data == NULL;
+        sum_view += view.get<TimestampData>()->timestamp_us + view.get<BatteryData>()->state_of_charge;
+    }
+    auto view_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    REQUIRE(missing == 0);
+    REQUIRE(sum_copy == sum_view);
+    std::cout << "FrameMessage read 5 fields, frames: " << kNumFrames << ", get_frame_message_data: " << copy_us
+              << " us, FrameMessageView: " << view_us << " us" << std::endl;
+}
+
+struct FrameTestStatus {
+    FrameTestStatus() : status(0) {}
+    void set() {
+        status = 1;
+    }
+    void clear() {
+        status = 0;
+    }
+    int wait_for(uint32_t timeout_ms) {
+        return status.exchange(0) == 1 ? 0 : -1;
+    }
+    std::atomic<int> status;
+};
+
+TEST_CASE("FrameMessageBuilder vs reserve_write benchmark")
+{
+    using namespace motesque;
+    typedef SequentialBufferT<std::mutex, FrameTestStatus> FrameBuffer;
+    // 1kHz x 5 sensors, for 60 seconds
+    const size_t kNumFrames = 1000 * 5 * 60;
+    const size_t kFrameSize = sizeof(FrameMessageHeader) + sizeof(SensorMetaData) + sizeof(TimestampData) + sizeof(LowNoiseImuData);
+    FrameBuffer sqb(4096);
+    SensorMetaData meta;
+    memset(&meta, 0, sizeof(meta));
+    TimestampData time_data;
+    LowNoiseImuData imu_data;
+    memset(&imu_data, 0, sizeof(imu_data));
+    const uint8_t* read_ptr;
+    size_t available;
+
+    // staged: build the message in the builder, then copy it into the ring
+    FrameMessageBuilder builder;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i=0; i < kNumFrames; i++) {
+        time_data.timestamp_us = i;
+        builder.clear();
+        builder.add(meta);
+        builder.add(time_data);
+        builder.add(imu_data);
+        builder.finish();
+        while (sqb.write(builder.get_buffer_pointer(), builder.get_size()) != 0) {
+            REQUIRE(0 == sqb.request_read(&read_ptr, &available, 0));
+            sqb.commit_read(available);
+        }
+    }
+    auto staged_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    // direct: serialize the compacted message straight into the ring, layout known at compile time
+    sqb.clear();
+    start = std::chrono::steady_clock::now();
+    for (size_t i=0; i < kNumFrames; i++) {
+        time_data.timestamp_us = i;
+        uint8_t* write_ptr;
+        while (sqb.reserve_write(kFrameSize, &write_ptr) != 0) {
+            REQUIRE(0 == sqb.request_read(&read_ptr, &available, 0));
+            sqb.commit_read(available);
+        }
+        FrameMessage<SensorMetaData, TimestampData, LowNoiseImuData>::write(write_ptr, meta, time_data, imu_data);
+        sqb.commit_write(kFrameSize);
+    }
+    auto direct_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    // both paths produce the same bytes
+    builder.clear();
+    builder.add(meta);
+    builder.add(time_data);
+    builder.add(imu_data);
+    builder.finish();
+    REQUIRE(0 == sqb.request_read(&read_ptr, &available, 0));
+    REQUIRE(available >= kFrameSize);
+    REQUIRE(0 == memcmp(read_ptr + available - kFrameSize, builder.get_buffer_pointer(), kFrameSize));
+
+    std::cout << "FrameMessage into SequentialBuffer, frames: " << kNumFrames << ", builder + write: " << staged_us
+              << " us, reserve_write: " << direct_us << " us, " << kFrameSize << " bytes copy saved per frame" << std::endl;
+}
@@ -3,6 +3,7 @@
 #include <deque>
 #include <array>
 #include <cstring>
+#include <cstdint>
 namespace motesque {
 
 /*
@@ -0,0 +1,309 @@
+#pragma once
+#include <array>
+#include <cassert>
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+#include "ring_storage.h"
+namespace motesque
+{
+
+// What the writer does with a reader that has not consumed enough to make room for a write.
+// Data handed out by request_read and not committed yet is never overwritten, whatever the policy
+enum LagPolicy {
+    LagPolicy_Block,    // the write fails, like in SequentialBufferT. The slowest reader bounds the free space
+    LagPolicy_Skip,     // the reader loses its unread data and continues at the current write position
+    LagPolicy_Detach    // the reader is detached and has to attach again
+};
+
+/* A thread safe single producer, multiple consumer byte buffer. Every byte written is delivered to every attached
+ * reader, each reader has its own cursor and its own watermark event, e.g. one for the sd card and one for a tcp client.
+ * Reads work like SequentialBufferT::request_read / commit_read, with an additional reader id.
+ * Readers attached with LagPolicy_Skip or LagPolicy_Detach do not stall the writer, except while they are reading:
+ * the span handed out by request_read stays valid until it is committed, a write which would overwrite it fails. */
+template<typename LOCK, typename EVENT_FLAG, int MAX_READERS, typename STORAGE = HeapRingStorage>
+class BroadcastSequentialBufferT
+{
+    BroadcastSequentialBufferT(const BroadcastSequentialBufferT& rhs);
+    BroadcastSequentialBufferT& operator=(const BroadcastSequentialBufferT& rhs);
+
+class ScopedLock
+{
+public:
+  ScopedLock(LOCK* lock) : m_lock(lock){
+      m_lock->lock();
+  }
+  ~ScopedLock() {
+      m_lock->unlock();
+  }
+private:
+  LOCK* m_lock;
+
+};
+
+struct Reader {
+    Reader() : pos(0), held(0), lost_bytes(0), policy(LagPolicy_Block), attached(false) {}
+    uint64_t  pos;          // absolute read position
+    size_t    held;         // bytes from pos handed out by request_read and not committed yet
+    uint64_t  lost_bytes;   // bytes skipped because the reader was lagging
+    LagPolicy policy;
+    bool      attached;
+};
+
+public:
+    BroadcastSequentialBufferT(size_t size);
+    virtual ~BroadcastSequentialBufferT();
+    // attach a reader. It will receive all data written from now on. Returns the reader id or -1 if all slots are taken
+    int attach_reader(LagPolicy policy);
+    // detach a reader, it no longer bounds the free space
+    int detach_reader(int reader);
+    // whether the reader is (still) attached. A LagPolicy_Detach reader gets detached by the writer when lagging
+    bool is_attached(int reader) const;
+    // write data to buffer. Fails if a blocking reader has not consumed enough to write all the data, or if
+    // it would overwrite data a lagging reader is still reading
+    int write(const uint8_t* data, size_t data_size);
+    // get a read pointer to the data the reader has not consumed yet. Optionally waits for reached watermark timeout milliseconds
+    int request_read(int reader, const uint8_t** data, size_t* available_size, uint32_t timeout_ms);
+    // advance the read cursor of the reader, by at most what the last request_read handed out. Returns -1 if the
+    // reader was detached
+    int commit_read(int reader, size_t size);
+    // the amount of data available for writes without failing. Lagging readers which are not reading do not count
+    size_t free() const;
+    // the amount of data stored for this reader
+    size_t size(int reader) const;
+    // the amount of data the reader lost because it was skipped
+    uint64_t lost_bytes(int reader) const;
+    // watermark for signalling mechanism
+    int set_watermark(size_t threshold_bytes);
+private:
+    bool valid(int reader) const {
+        return reader >= 0 && reader < MAX_READERS;
+    }
+    uint8_t* pointer(uint64_t pos) const {
+        return m_data + (size_t)(pos % m_capacity);
+    }
+
+    STORAGE        m_storage;
+    uint8_t* const m_data;
+    const size_t   m_capacity;
+    uint64_t       m_write_pos;        // absolute write position
+    size_t         m_watermark_bytes;
+    mutable LOCK   m_lock;
+    std::array<Reader, MAX_READERS>     m_readers;
+    std::array<EVENT_FLAG, MAX_READERS> m_watermark_events;
+};
+
+template<typename LOCK, typename EVENT_FLAG, int MAX_READERS, typename STORAGE>
+BroadcastSequentialBufferT<LOCK, EVENT_FLAG, MAX_READERS, STORAGE>::BroadcastSequentialBufferT(size_t size)
+: m_storage(size),
+  m_data(m_storage.data()),
+  m_capacity(m_storage.size()),
+  m_write_pos(0),
+  m_watermark_bytes(1),
+  m_lock(),
+  m_readers(),
+  m_watermark_events()
+{
+}
+
+template<typename LOCK, typename EVENT_FLAG, int MAX_READERS, typename STORAGE>
+BroadcastSequentialBufferT<LOCK, EVENT_FLAG, MAX_READERS, STORAGE>::~BroadcastSequentialBufferT()
+{
+}
+
+template<typename LOCK, typename EVENT_FLAG, int MAX_READERS, typename STORAGE>
+int BroadcastSequentialBufferT<LOCK, EVENT_FLAG, MAX_READERS, STORAGE>::set_watermark(size_t mark_bytes)
+{
+    m_watermark_bytes = mark_bytes;
+    return 0;
+}
+
+template<typename LOCK, typename EVENT_FLAG, int MAX_READERS, typename STORAGE>
+int BroadcastSequentialBufferT<LOCK, EVENT_FLAG, MAX_READERS, STORAGE>::attach_reader(LagPolicy policy)
+{
+    ScopedLock sl(&m_lock);
+    for (int i=0; i < MAX_READERS; i++) {
+        Reader& r = m_readers[i];
+        if (!r.attached) {
+            r = Reader();
+            r.pos = m_write_pos;
+            r.policy = policy;
+            r.attached = true;
+            m_watermark_events[i].clear();
+            return i;
+        }
+    }
+    return -1;
+}
+
+template<typename LOCK, typename EVENT_FLAG, int MAX_READERS, typename STORAGE>
+int BroadcastSequentialBufferT<LOCK, EVENT_FLAG, MAX_READERS, STORAGE>::detach_reader(int reader)
+{
+    if (!valid(reader)) {
+        return -1;
+    }
+    ScopedLock sl(&m_lock);
+    m_readers[reader].attached = false;
+    return 0;
+}
+
+template<typename LOCK, typename EVENT_FLAG, int MAX_READERS, typename STORAGE>
+bool BroadcastSequentialBufferT<LOCK, EVENT_FLAG, MAX_READERS, STORAGE>::is_attached(int reader) const
+{
+    if (!valid(reader)) {
+        return false;
+    }
+    ScopedLock sl(&m_lock);
+    return m_readers[reader].attached;
+}
+
+template<typename LOCK, typename EVENT_FLAG, int MAX_READERS, typename STORAGE>
+size_t BroadcastSequentialBufferT<LOCK, EVENT_FLAG, MAX_READERS, STORAGE>::free() const
+{
+    ScopedLock sl(&m_lock);
+    uint64_t max_used = 0;
+    for (int i=0; i < MAX_READERS; i++) {
+        const Reader& r = m_readers[i];
+        if (r.attached && (r.policy == LagPolicy_Block || r.held > 0)) {
+            max_used = std::max<uint64_t>(max_used, m_write_pos - r.pos);
+        }
+    }
+    return m_capacity - (size_t)max_used;
+}
+
+template<typename LOCK, typename EVENT_FLAG, int MAX_READERS, typename STORAGE>
+size_t BroadcastSequentialBufferT<LOCK, EVENT_FLAG, MAX_READERS, STORAGE>::size(int reader) const
+{
+    if (!valid(reader)) {
+        return 0;
+    }
+    ScopedLock sl(&m_lock);
+    const Reader& r = m_readers[reader];
+    return r.attached ? (size_t)(m_write_pos - r.pos) : 0;
+}
+
+template<typename LOCK, typename EVENT_FLAG, int MAX_READERS, typename STORAGE>
+uint64_t BroadcastSequentialBufferT<LOCK, EVENT_FLAG, MAX_READERS, STORAGE>::lost_bytes(int reader) const
+{
+    if (!valid(reader)) {
+        return 0;
+    }
+    ScopedLock sl(&m_lock);
+    return m_readers[reader].lost_bytes;
+}
+
+template<typename LOCK, typename EVENT_FLAG, int MAX_READERS, typename STORAGE>
+int BroadcastSequentialBufferT<LOCK, EVENT_FLAG, MAX_READERS, STORAGE>::write(const uint8_t* data, size_t data_size)
+{
+    if (data_size == 0 || data_size > m_capacity) {
+        return -1;
+    }
+    {
+        ScopedLock sl(&m_lock);
+        // any reader further behind than this would get overwritten
+        const uint64_t lag_limit = m_write_pos + data_size - m_capacity;
+        bool blocked = false;
+        for (int i=0; i < MAX_READERS; i++) {
+            const Reader& r = m_readers[i];
+            // the span a reader holds starts at its read position, a lagging reader would lose part of it
+            if (r.attached && (r.policy == LagPolicy_Block || r.held > 0) && (int64_t)(lag_limit - r.pos) > 0) {
+                blocked = true;
+            }
+        }
+        if (blocked) {
+            // buffer is full. Notify any waiting readers to do their job...
+            for (int i=0; i < MAX_READERS; i++) {
+                if (m_readers[i].attached) {
+                    m_watermark_events[i].set();
+                }
+            }
+            return -1;
+        }
+        // make room by skipping or detaching the lagging readers
+        for (int i=0; i < MAX_READERS; i++) {
+            Reader& r = m_readers[i];
+            if (!r.attached || (int64_t)(lag_limit - r.pos) <= 0) {
+                continue;
+            }
+            if (r.policy == LagPolicy_Skip) {
+                // continue at a write boundary, not somewhere in the middle of a message
+                r.lost_bytes += m_write_pos - r.pos;
+                r.pos = m_write_pos;
+            }
+            else {
+                r.attached = false;
+            }
+        }
+
+        uint8_t* write_ptr = pointer(m_write_pos);
+        if (m_storage.is_mirrored()) {
+            memcpy(write_ptr, data, data_size);
+        }
+        else {
+            // write the data until the end and maybe wrap around
+            size_t append_size = std::min<size_t>(data_size, m_data + m_capacity - write_ptr);
+            memcpy(write_ptr, data, append_size);
+            if (data_size > append_size) {
+                memcpy(m_data, data + append_size, data_size - append_size);
+            }
+        }
+        m_write_pos += data_size;
+    }
+    for (int i=0; i < MAX_READERS; i++) {
+        // notfiy readers on watermark
+        if (size(i) >= m_watermark_bytes) {
+            m_watermark_events[i].set();
+        }
+    }
+    return 0;
+}
+
+template<typename LOCK, typename EVENT_FLAG, int MAX_READERS, typename STORAGE>
+int BroadcastSequentialBufferT<LOCK, EVENT_FLAG, MAX_READERS, STORAGE>::commit_read(int reader, size_t commit_size)
+{
+    if (!valid(reader)) {
+        return -1;
+    }
+    ScopedLock sl(&m_lock);
+    Reader& r = m_readers[reader];
+    if (!r.attached) {
+        return -1;
+    }
+    assert(commit_size <= r.held);
+    r.pos += commit_size;
+    r.held -= commit_size;
+    return 0;
+}
+
+template<typename LOCK, typename EVENT_FLAG, int MAX_READERS, typename STORAGE>
+int BroadcastSequentialBufferT<LOCK, EVENT_FLAG, MAX_READERS, STORAGE>::request_read(int reader, const uint8_t** data,
+                                                                                     size_t* available_size, uint32_t timeout_ms)
+{
+    *available_size = 0;
+    if (!valid(reader) || !is_attached(reader)) {
+        return -1;
+    }
+    // if we use timeouts, we wait until the watermark is reached. If it is not, my might read whatever is present
+    if (timeout_ms > 0 && m_watermark_events[reader].wait_for(timeout_ms) != 0) {
+        if (size(reader) == 0) {
+            return -1; // timed out, no data to read
+        }
+    }
+    ScopedLock sl(&m_lock);
+    Reader& r = m_readers[reader];
+    if (!r.attached) {
+        return -1;
+    }
+    const uint8_t* read_ptr = pointer(r.pos);
+    // hand out the read pointer, at most until the end unless the storage is mirrored
+    *available_size = (size_t)(m_write_pos - r.pos);
+    if (!m_storage.is_mirrored()) {
+        *available_size = std::min<size_t>(*available_size, m_data + m_capacity - read_ptr);
+    }
+    *data = read_ptr;
+    // pinned until commit_read, or until the next request_read
+    r.held = *available_size;
+    return *available_size > 0 ? 0 : -1;
+}
+
+}
@@ -0,0 +1,298 @@
+#pragma once
+#include "command_queue.h"
+
+namespace motesque {
+
+/**
+ * A command executor with NUM_WORKERS worker threads, with the same scheduling API as CommandQueue.
+ * Every worker has its own deque of commands; new commands are spread round robin and a worker without work steals
+ * from the back of the other deques, so one slow command (e.g. a flash write) does not hold up the others.
+ * Commands with a serial key are pinned to the worker key % NUM_WORKERS and never stolen, hence commands with the
+ * same key run in the order they were scheduled. Delayed and interval commands wait in a shared timer heap.
+ * Each worker thread calls process(worker, timeout_ms) in a loop. LOCK needs lock, unlock and try_lock.
+ */
+template<typename LOCK, typename EVENT_FLAG, int SIZE, int NUM_WORKERS, size_t FUNC_CAPACITY = kDefaultFuncCapacity>
+class CommandPool
+{
+    CommandPool(const CommandPool& rhs);
+    CommandPool& operator=(const CommandPool& rhs);
+
+class ScopedLock
+{
+public:
+  ScopedLock(LOCK* lock) : m_lock(lock){
+      m_lock->lock();
+  }
+  ~ScopedLock() {
+      m_lock->unlock();
+  }
+private:
+  LOCK* m_lock;
+
+};
+
+    // fixed size deque of context indices, every context is in at most one of them
+    struct Deque {
+        Deque() : items(), head(0), count(0) {}
+        void push_back(uint32_t idx) {
+            assert(count < SIZE);
+            items[(head + count++) % SIZE] = idx;
+        }
+        uint32_t front() const {
+            return items[head];
+        }
+        uint32_t pop_front() {
+            const uint32_t idx = items[head];
+            head = (head + 1) % SIZE;
+            count--;
+            return idx;
+        }
+        uint32_t pop_back() {
+            return items[(head + --count) % SIZE];
+        }
+        std::array<uint32_t, SIZE> items;
+        size_t head;
+        size_t count;
+    };
+
+    // no timer pending, out of the range of the 32 bit deadlines
+    static const uint64_t kNoDeadline = ~0ULL;
+
+    struct Worker {
+        LOCK       lock;
+        Deque      shared;       // may be stolen by other workers
+        Deque      serial;       // commands with a serial key, only run by this worker
+        EVENT_FLAG work_event;
+    };
+
+public:
+    typedef FuncContextT<EVENT_FLAG, FUNC_CAPACITY> FuncContext;
+
+    CommandPool() :
+        m_func_contexts(),
+        m_workers(),
+        m_sequences(),
+        m_next_sequence(0),
+        m_next_worker(0),
+        m_timers(),
+        m_next_deadline(kNoDeadline)
+    {
+    }
+
+    virtual ~CommandPool() {
+    }
+
+    // cancels all pending commands with this id
+    int cancel(int id) {
+        return m_func_contexts.cancel(id);
+    }
+
+    /**
+     * Put a function on one of the worker deques. Commands with the same serial_key >= 0 are executed in order.
+     * With wait the call returns after the function was executed
+     */
+    template<typename FuncT>
+    int execute_async(FuncT func, bool wait=false, int serial_key=-1) {
+        size_t func_context_idx = 0;
+        if (m_func_contexts.acquire(&func_context_idx) < 0) {
+            return -1;
+        }
+        FuncContext* func_context = m_func_contexts[func_context_idx];
+        // stored inline, fails to compile if the captures exceed FUNC_CAPACITY
+        func_context->func = func;
+        func_context->status.clear();
+        if (wait) {
+            // the waiter holds its own reference, otherwise the context could be reused before we woke up
+            func_context->inc_ref_count();
+        }
+        enqueue(func_context_idx, serial_key);
+        if (wait) {
+            func_context->status.wait_for(WICED_NEVER_TIMEOUT);
+            m_func_contexts.release(func_context_idx);
+        }
+        return 0;
+    }
+
+    /**
+     * Execute a function after delay_ms on any worker
+     */
+    template<typename FuncT>
+    int execute_async_later(FuncT func, uint32_t delay_ms, int id = -1) {
+        return schedule(func, delay_ms, -1, id);
+    }
+
+    template<typename FuncT>
+    int execute_async_interval(FuncT func, uint32_t interval_ms, int id = -1) {
+        return schedule(func, interval_ms, (int)interval_ms, id);
+    }
+
+    /**
+     * Execute the next command of this worker, or a stolen one, and move due timers to the workers.
+     * Waits at most timeout_ms for work, less if a timer is due earlier.
+     */
+    void process(int worker, uint32_t timeout_ms) {
+        assert(worker >= 0 && worker < NUM_WORKERS);
+        uint32_t wait_ms = dispatch_timers(timeout_ms);
+        // clear before looking, a command enqueued after the check sets the event again
+        m_workers[worker].work_event.clear();
+        size_t func_context_idx = 0;
+        if (take(worker, &func_context_idx) != 0) {
+            if (wait_ms == 0 || m_workers[worker].work_event.wait_for(wait_ms) != 0) {
+                return;
+            }
+            dispatch_timers(0);
+            if (take(worker, &func_context_idx) != 0) {
+                return;
+            }
+        }
+        execute(func_context_idx);
+    }
+
+    // the number of commands waiting in the worker deques, without timers
+    size_t pending() {
+        size_t count = 0;
+        for (int i=0; i < NUM_WORKERS; i++) {
+            ScopedLock sl(&m_workers[i].lock);
+            count += m_workers[i].shared.count + m_workers[i].serial.count;
+        }
+        return count;
+    }
+
+private:
+    template<typename FuncT>
+    int schedule(FuncT func, uint32_t delay_ms, int interval_ms, int id) {
+        size_t func_context_idx = 0;
+        if (m_func_contexts.acquire(&func_context_idx) < 0) {
+            return -1;
+        }
+        FuncContext* func_context = m_func_contexts[func_context_idx];
+        func_context->func = func;
+        func_context->status.clear();
+        func_context->interval_ms = interval_ms;
+        m_func_contexts.set_id(func_context_idx, id);
+        {
+            ScopedLock sl(&m_timer_lock);
+            func_context->scheduled_ms = nowMs() + delay_ms;
+            m_timers.push(func_context_idx, func_context->scheduled_ms);
+            publish_deadline();
+        }
+        // a sleeping worker has to pick up the new deadline
+        m_workers[next_worker()].work_event.set();
+        return 0;
+    }
+
+    int next_worker() {
+        return (int)(m_next_worker.fetch_add(1, std::memory_order_relaxed) % NUM_WORKERS);
+    }
+
+    void enqueue(size_t func_context_idx, int serial_key) {
+        const int worker = serial_key >= 0 ? serial_key % NUM_WORKERS : next_worker();
+        Worker& w = m_workers[worker];
+        bool busy = false;
+        {
+            ScopedLock sl(&w.lock);
+            m_sequences[func_context_idx] = m_next_sequence.fetch_add(1, std::memory_order_relaxed);
+            busy = w.shared.count + w.serial.count > 0;
+            if (serial_key >= 0) {
+                w.serial.push_back((uint32_t)func_context_idx);
+            }
+            else {
+                w.shared.push_back((uint32_t)func_context_idx);
+            }
+        }
+        w.work_event.set();
+        if (busy && serial_key < 0 && NUM_WORKERS > 1) {
+            // the worker has a backlog, give a neighbour the chance to steal
+            m_workers[(worker + 1) % NUM_WORKERS].work_event.set();
+        }
+    }
+
+    // own commands first, the older of the shared and the serial deque. Otherwise steal from the back of the others
+    int take(int worker, size_t* func_context_idx) {
+        {
+            Worker& w = m_workers[worker];
+            ScopedLock sl(&w.lock);
+            if (w.shared.count > 0 && w.serial.count > 0) {
+                const bool shared_first = (int32_t)(m_sequences[w.shared.front()] - m_sequences[w.serial.front()]) < 0;
+                *func_context_idx = shared_first ? w.shared.pop_front() : w.serial.pop_front();
+                return 0;
+            }
+            if (w.shared.count > 0) {
+                *func_context_idx = w.shared.pop_front();
+                return 0;
+            }
+            if (w.serial.count > 0) {
+                *func_context_idx = w.serial.pop_front();
+                return 0;
+            }
+        }
+        for (int i=1; i < NUM_WORKERS; i++) {
+            Worker& victim = m_workers[(worker + i) % NUM_WORKERS];
+            ScopedLock sl(&victim.lock);
+            if (victim.shared.count > 0) {
+                *func_context_idx = victim.shared.pop_back();
+                return 0;
+            }
+        }
+        return -1;
+    }
+
+    // moves due timers to the workers. Returns how long we may wait at most
+    uint32_t dispatch_timers(uint32_t timeout_ms) {
+        if (!m_timer_lock.try_lock()) {
+            // another worker is at it already, do not sleep past the next deadline in case it misses it
+            const uint64_t deadline = m_next_deadline.load(std::memory_order_acquire);
+            if (deadline == kNoDeadline) {
+                return timeout_ms;
+            }
+            const int32_t until_due = (int32_t)((uint32_t)deadline - nowMs());
+            return std::min<uint32_t>(timeout_ms, until_due > 0 ? (uint32_t)until_due : 0);
+        }
+        const uint32_t now = nowMs();
+        while (m_timers.due(now)) {
+            enqueue(m_timers.pop(), -1);
+        }
+        publish_deadline();
+        const uint32_t wait_ms = m_timers.wait_ms(now, timeout_ms);
+        m_timer_lock.unlock();
+        return wait_ms;
+    }
+
+    // the earliest deadline for workers which do not get the timer lock. Must be called with the timer lock held
+    void publish_deadline() {
+        m_next_deadline.store(m_timers.empty() ? kNoDeadline : m_timers.next_ms(), std::memory_order_release);
+    }
+
+    void execute(size_t func_context_idx) {
+        FuncContext* func_context = m_func_contexts[func_context_idx];
+        if (func_context->cancelled) {
+            m_func_contexts.release(func_context_idx);
+            return;
+        }
+        // call the function
+        func_context->func();
+        if (func_context->interval_ms > 0) {
+            // execute after interval time
+            ScopedLock sl(&m_timer_lock);
+            func_context->scheduled_ms = nowMs() + func_context->interval_ms;
+            m_timers.push(func_context_idx, func_context->scheduled_ms);
+            publish_deadline();
+        }
+        else {
+            // set the status to wake up waiting threads
+            func_context->status.set();
+            m_func_contexts.release(func_context_idx);
+        }
+    }
+
+    FuncContextPoolT<FuncContext, SIZE>  m_func_contexts;
+    std::array<Worker, NUM_WORKERS>      m_workers;
+    std::array<uint32_t, SIZE>           m_sequences;      // enqueue order, to keep the own deques in order
+    std::atomic<uint32_t>                m_next_sequence;
+    std::atomic<uint32_t>                m_next_worker;
+    LOCK                                 m_timer_lock;
+    TimerHeapT<SIZE>                     m_timers;
+    std::atomic<uint64_t>                m_next_deadline;  // m_timers.next_ms(), kNoDeadline without timers
+};
+
+} // end ns
@@ -6,12 +6,23 @@
 #include <assert.h>
 #include <atomic>
 #include <array>
+#include "inline_function.h"
 #ifdef __linux__
-    #define wiced_rtos_thread_yield()
+    #include <thread>
+    #define wiced_rtos_thread_yield() std::this_thread::yield()
     #define WICED_NEVER_TIMEOUT 0xffffffff
 #else
     #include <wiced.h>
 #endif
+// per command id latency statistics, see CommandQueue::get_command_stats. Off by default, costs nothing then
+#if defined(MOTESQUE_ENABLE_COMMAND_STATS) && defined(MOTESQUE_ENABLE_EVENT_TRACE)
+    #include "lw_event_trace.h"
+    #ifdef __unix__
+        #include "lw_event_trace_platform_x86.h"
+    #else
+        #include "lw_event_trace_platform.h"
+    #endif
+#endif
 
 
 namespace motesque {
@@ -20,9 +31,15 @@ namespace motesque {
 
 extern void delayMs(uint32_t ms);
 extern uint32_t nowMs();
+extern uint64_t nowUs();
 
 typedef std::function<void(void)> FuncType;
 
+// bytes available for the captures of a command, e.g. four pointers
+enum { kDefaultFuncCapacity = 32 };
+// bytes available for the result of a command, see CommandQueue::submit
+enum { kCommandResultCapacity = 16 };
+
 enum CommandID
 {
     Unknown,
@@ -31,9 +48,124 @@ enum CommandID
     WifiSetCredentials,
     FrameStreamStart,
     FrameStreamStop,
-    SendDiscoveryMessage
+    SendDiscoveryMessage,
+    kNumCommandIDs
+};
+
+// for traces, the names live as long as the program
+inline const char* command_name(int cmd_id)
+{
+    switch (cmd_id) {
+        case WifiUp:                return "WifiUp";
+        case WifiDown:              return "WifiDown";
+        case WifiSetCredentials:    return "WifiSetCredentials";
+        case FrameStreamStart:      return "FrameStreamStart";
+        case FrameStreamStop:       return "FrameStreamStop";
+        case SendDiscoveryMessage:  return "SendDiscoveryMessage";
+        default:                    return "Unknown";
+    }
+}
+
+enum CommandPriority
+{
+    CommandPriority_High,
+    CommandPriority_Normal,
+    CommandPriority_Low,
+    kNumCommandPriorities
+};
+
+// which lane the commands with an id go to unless given explicitly
+inline CommandPriority command_priority(int cmd_id)
+{
+    switch (cmd_id) {
+        case FrameStreamStart:
+        case FrameStreamStop:
+            return CommandPriority_High;
+        case WifiUp:
+        case WifiDown:
+        case WifiSetCredentials:
+        case SendDiscoveryMessage:
+            return CommandPriority_Low;
+        default:
+            return CommandPriority_Normal;
+    }
+}
+
+enum PriorityPolicy
+{
+    PriorityPolicy_Strict,      // always the highest non empty lane, lower lanes may starve
+    PriorityPolicy_Weighted     // each lane gets a number of commands per round according to its weight
+};
+
+// how an interval command is rescheduled
+enum IntervalPolicy
+{
+    IntervalPolicy_FixedDelay,      // interval_ms after the previous run ended, drifts by runtime and queue latency
+    IntervalPolicy_FixedRate,       // on the grid start + n * interval_ms; missed deadlines are skipped
+    IntervalPolicy_FixedRateCatchUp // on the grid as well, but after missed deadlines it runs once right away
+};
+
+// lateness buckets: < 1 ms, then [2^(i-1), 2^i) ms, the last one >= 64 ms
+enum { kLatenessBuckets = 8 };
+
+// the runs of an interval command, see CommandQueue::get_interval_stats
+struct IntervalStats {
+    IntervalStats() : runs(0), missed(0), max_lateness_ms(0), lateness_histogram() {}
+    uint32_t runs;
+    uint32_t missed;            // deadlines that passed without a run (fixed rate only)
+    uint32_t max_lateness_ms;   // start of the run after its deadline
+    std::array<uint32_t, kLatenessBuckets> lateness_histogram;
 };
 
+inline size_t lateness_bucket(uint32_t lateness_ms)
+{
+    size_t bucket = 0;
+    while (lateness_ms > 0 && bucket < kLatenessBuckets - 1) {
+        lateness_ms >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+// queue wait (enqueue or due time until start) and execution time of the commands of one priority
+struct CommandPriorityStats {
+    CommandPriorityStats() : executed(0), total_wait_us(0), max_wait_us(0), total_exec_us(0), max_exec_us(0) {}
+    uint32_t executed;
+    uint64_t total_wait_us;
+    uint32_t max_wait_us;
+    uint64_t total_exec_us;
+    uint32_t max_exec_us;
+};
+
+// latency buckets: < 16 us, then [2^(i+3), 2^(i+4)) us, the last one >= 16 ms
+enum { kLatencyBuckets = 12 };
+
+inline size_t latency_bucket(uint64_t latency_us)
+{
+    size_t bucket = 0;
+    latency_us >>= 4;
+    while (latency_us > 0 && bucket < kLatencyBuckets - 1) {
+        latency_us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+// the commands of one CommandID (commands without id count as Unknown), see CommandQueue::get_command_stats
+struct CommandStats {
+    CommandStats() : executed(0), dropped(0), rejected(0), max_wait_us(0), max_run_us(0), wait_histogram(), run_histogram() {}
+    uint32_t executed;
+    uint32_t dropped;       // the queue was full
+    uint32_t rejected;      // no free FuncContext
+    uint32_t max_wait_us;   // enqueue or due time until start
+    uint32_t max_run_us;
+    std::array<uint32_t, kLatencyBuckets> wait_histogram;
+    std::array<uint32_t, kLatencyBuckets> run_histogram;
+};
+
+// trace thread ids from here on are used for the queue wait spans
+enum { kCommandWaitTraceTrack = 128 };
+
 struct IntStatus {
     IntStatus() : status(0) {}
 
@@ -44,7 +176,11 @@ struct IntStatus {
         status = 0;
     }
     int wait_for(uint32_t timeout_ms) {
+        const uint32_t start_ms = timeout_ms != WICED_NEVER_TIMEOUT ? nowMs() : 0;
         while (status == 0) {
+            if (timeout_ms != WICED_NEVER_TIMEOUT && nowMs() - start_ms >= timeout_ms) {
+                return -1;
+            }
             wiced_rtos_thread_yield();
         }
         return 0;
@@ -62,18 +198,22 @@ struct RefCounter {
         ref_count.fetch_add(1);
     }
 
-    void dec_ref_count()
+    // returns the remaining references
+    int dec_ref_count()
     {
-        ref_count.fetch_sub(1);
+        return ref_count.fetch_sub(1) - 1;
     }
     std::atomic<int>  ref_count;
 };
 
 
 
-template<typename STATUS>
+template<typename STATUS, size_t FUNC_CAPACITY = kDefaultFuncCapacity>
 struct FuncContextT : public RefCounter {
-    FuncContextT() :  func(), status(), cancelled(0), scheduled_ms(), cmd_id(-1),interval_ms(-1) {
+    FuncContextT() :  func(), status(), cancelled(0), scheduled_ms(), cmd_id(-1),interval_ms(-1), delayed(false),
+                      priority(CommandPriority_Normal), enqueued_us(0), interval_policy(IntervalPolicy_FixedDelay),
+                      late_ms(0), runs(0), missed(0), max_lateness_ms(0), lateness_histogram(),
+                      result(), future_state(FutureState_Pending), continuation_idx(0), parent_idx(-1) {
     }
     virtual ~FuncContextT()
     {
@@ -85,222 +225,1001 @@ struct FuncContextT : public RefCounter {
         cmd_id = -1;
         interval_ms = -1;
         cancelled = 0;
+        delayed = false;
+        priority = CommandPriority_Normal;
+        enqueued_us = 0;
+        interval_policy = IntervalPolicy_FixedDelay;
+        late_ms = 0;
+        runs = 0;
+        missed = 0;
+        max_lateness_ms = 0;
+        for (size_t i=0; i < lateness_histogram.size(); i++) {
+            lateness_histogram[i] = 0;
+        }
+        future_state = FutureState_Pending;
+        continuation_idx = 0;
+        parent_idx = -1;
+    }
+    template<typename R>
+    void set_result(const R& value) {
+        static_assert(sizeof(R) <= kCommandResultCapacity, "the result does not fit into the FuncContext");
+        static_assert(std::is_trivially_copyable<R>::value, "results are copied with memcpy");
+        memcpy(&result, &value, sizeof(R));
     }
-    FuncType  func;
+    template<typename R>
+    void get_result(R* value) const {
+        memcpy(value, &result, sizeof(R));
+    }
+    void get_interval_stats(IntervalStats* stats) const {
+        stats->runs = runs;
+        stats->missed = missed;
+        stats->max_lateness_ms = max_lateness_ms;
+        for (size_t i=0; i < lateness_histogram.size(); i++) {
+            stats->lateness_histogram[i] = lateness_histogram[i];
+        }
+    }
+    InlineFunction<void(void), FUNC_CAPACITY> func;
     STATUS    status;
     std::atomic<int>  cancelled;
-    int       scheduled_ms;
+    uint32_t  scheduled_ms;
     int       cmd_id;
     int       interval_ms;
+    bool      delayed;      // goes to the timer heap instead of being executed right away
+    CommandPriority priority;
+    uint64_t  enqueued_us;  // when it was queued or became due
+    IntervalPolicy interval_policy;
+    uint32_t  late_ms;      // how late the timer was when it became due
+    // written by the processing thread, read by get_interval_stats
+    std::atomic<uint32_t> runs;
+    std::atomic<uint32_t> missed;
+    std::atomic<uint32_t> max_lateness_ms;
+    std::array<std::atomic<uint32_t>, kLatenessBuckets> lateness_histogram;
+    // futures, see CommandQueue::submit
+    enum {
+        FutureState_Pending,
+        FutureState_Continuation,   // continuation_idx runs once the result is there
+        FutureState_Done
+    };
+    typename std::aligned_storage<kCommandResultCapacity, alignof(std::max_align_t)>::type result;
+    std::atomic<int> future_state;
+    uint32_t  continuation_idx;
+    int       parent_idx;   // a continuation holds a reference on the context of its input
+#ifdef MOTESQUE_ENABLE_COMMAND_STATS
+    // enqueued_us is the time the command was put on the queue or became due
+    uint64_t  dequeued_us;
+    uint64_t  completed_us;
+#endif
+};
+
+/**
+ * The result of a command scheduled with CommandQueue::submit. It holds a reference on the context of the command,
+ * where the result is stored, so no allocation is involved. Move only, the reference is dropped on destruction,
+ * after get() or when then() hands it on to the continuation.
+ */
+template<typename R, typename QUEUE>
+class CommandFutureT
+{
+    CommandFutureT(const CommandFutureT& rhs);
+    CommandFutureT& operator=(const CommandFutureT& rhs);
+public:
+    CommandFutureT() : m_queue(NULL), m_idx(0) {}
+    CommandFutureT(QUEUE* queue, size_t idx) : m_queue(queue), m_idx(idx) {}
+    CommandFutureT(CommandFutureT&& rhs) : m_queue(rhs.m_queue), m_idx(rhs.m_idx) {
+        rhs.m_queue = NULL;
+    }
+    CommandFutureT& operator=(CommandFutureT&& rhs) {
+        if (this != &rhs) {
+            reset();
+            m_queue = rhs.m_queue;
+            m_idx = rhs.m_idx;
+            rhs.m_queue = NULL;
+        }
+        return *this;
+    }
+    ~CommandFutureT() {
+        reset();
+    }
+
+    // false if scheduling failed or the result was taken already
+    bool valid() const {
+        return m_queue != NULL;
+    }
+
+    // whether the result is there, without waiting
+    bool ready() const {
+        return valid() && m_queue->context(m_idx)->future_state == QUEUE::FuncContext::FutureState_Done;
+    }
+
+    // wait up to timeout_ms for the result. Returns 0 if it is there
+    int wait_for(uint32_t timeout_ms) {
+        if (!valid()) {
+            return -1;
+        }
+        if (!ready()) {
+            m_queue->context(m_idx)->status.wait_for(timeout_ms);
+        }
+        return ready() ? 0 : -1;
+    }
+
+    // wait up to timeout_ms and take the result. The future is invalid afterwards if it succeeded
+    int get(R* value, uint32_t timeout_ms) {
+        if (wait_for(timeout_ms) != 0) {
+            return -1;
+        }
+        m_queue->context(m_idx)->get_result(value);
+        reset();
+        return 0;
+    }
+
+    // run func(result) on the processing thread once the result is there, without blocking the caller.
+    // Returns the future of func's result, this future is invalid afterwards
+    template<typename FuncT>
+    CommandFutureT<typename std::result_of<FuncT(R)>::type, QUEUE> then(FuncT func) {
+        typedef typename std::result_of<FuncT(R)>::type R2;
+        if (!valid()) {
+            return CommandFutureT<R2, QUEUE>();
+        }
+        QUEUE* queue = m_queue;
+        // the continuation takes over our reference
+        m_queue = NULL;
+        return queue->template chain<R, R2>(m_idx, func);
+    }
+
+    void reset() {
+        if (m_queue) {
+            m_queue->release_context(m_idx);
+            m_queue = NULL;
+        }
+    }
+private:
+    QUEUE* m_queue;
+    size_t m_idx;
+};
+
+/**
+ * The contexts of a command queue. Free contexts are kept on a lock free free list of indices, so acquiring and
+ * releasing a context is constant time and safe from several producer threads. An open addressing id -> context
+ * index serves cancel().
+ */
+template<typename CONTEXT, int SIZE>
+class FuncContextPoolT
+{
+    FuncContextPoolT(const FuncContextPoolT& rhs);
+    FuncContextPoolT& operator=(const FuncContextPoolT& rhs);
+
+    enum { kNil = 0xffffffff };
+    // the id index has at least twice as many slots as contexts, so probe sequences stay short
+    enum { kIdSlots = SIZE <= 4 ? 8 : (SIZE <= 32 ? 64 : (SIZE <= 256 ? 512 : 4096)) };
+    static_assert(SIZE <= kIdSlots / 2, "CommandQueue SIZE too large for the id index");
+
+    struct IdSlot {
+        IdSlot() : id(-1), idx(kNil) {}
+        int      id;
+        uint32_t idx;   // kNil if the slot is empty
+    };
+
+    class SpinLock
+    {
+    public:
+      SpinLock(std::atomic_flag* flag) : m_flag(flag) {
+          while (m_flag->test_and_set(std::memory_order_acquire)) {
+              wiced_rtos_thread_yield();
+          }
+      }
+      ~SpinLock() {
+          m_flag->clear(std::memory_order_release);
+      }
+    private:
+      std::atomic_flag* m_flag;
+    };
+
+public:
+    FuncContextPoolT() :
+        m_func_contexts(),
+        m_free_head(0),
+        m_free_next(),
+        m_id_slots()
+    {
+        m_id_lock.clear();
+        // create n contexts, all of them on the free list
+        for (size_t i=0; i < m_func_contexts.size(); i++) {
+            CONTEXT* p = new CONTEXT();
+            m_func_contexts[i] = p;
+            m_free_next[i] = (i + 1 < m_func_contexts.size()) ? (uint32_t)(i + 1) : (uint32_t)kNil;
+        }
+        m_free_head = make_head(0, m_func_contexts.empty() ? (uint32_t)kNil : 0);
+    }
+
+    ~FuncContextPoolT() {
+        for (size_t i=0; i < m_func_contexts.size(); i++) {
+            delete m_func_contexts[i];
+        }
+    }
+
+    CONTEXT* operator[](size_t idx) const {
+        return m_func_contexts[idx];
+    }
+
+    // pop a context off the free list and take the first reference.
+    // The tag in the upper half of the head is bumped on every change, which protects against ABA
+    int acquire(size_t* idx) {
+        uint64_t head = m_free_head.load(std::memory_order_acquire);
+        while (true) {
+            const uint32_t first = (uint32_t)head;
+            if (first == kNil) {
+                // no available func context to execute command
+                return -1;
+            }
+            const uint64_t next_head = make_head((uint32_t)(head >> 32) + 1, m_free_next[first].load(std::memory_order_relaxed));
+            if (m_free_head.compare_exchange_weak(head, next_head, std::memory_order_acquire, std::memory_order_acquire)) {
+                *idx = first;
+                CONTEXT* func_context = m_func_contexts[first];
+                func_context->reset();
+                func_context->inc_ref_count();
+                return 0;
+            }
+        }
+    }
+
+    // drop a reference. The last one puts the context back on the free list
+    void release(size_t idx) {
+        CONTEXT* func_context = m_func_contexts[idx];
+        if (func_context->dec_ref_count() > 0) {
+            return;
+        }
+        // release the captures
+        func_context->func = nullptr;
+        if (func_context->cmd_id >= 0) {
+            remove_id(idx, func_context->cmd_id);
+        }
+        uint64_t head = m_free_head.load(std::memory_order_relaxed);
+        while (true) {
+            m_free_next[idx].store((uint32_t)head, std::memory_order_relaxed);
+            const uint64_t next_head = make_head((uint32_t)(head >> 32) + 1, (uint32_t)idx);
+            if (m_free_head.compare_exchange_weak(head, next_head, std::memory_order_release, std::memory_order_relaxed)) {
+                return;
+            }
+        }
+    }
+
+    void set_id(size_t idx, int id) {
+        m_func_contexts[idx]->cmd_id = id;
+        if (id < 0) {
+            return;
+        }
+        SpinLock sl(&m_id_lock);
+        size_t slot = id_hash(id);
+        while (m_id_slots[slot].idx != kNil) {
+            slot = (slot + 1) % kIdSlots;
+        }
+        m_id_slots[slot].id = id;
+        m_id_slots[slot].idx = (uint32_t)idx;
+    }
+
+    // calls func(context) for the first context with this id, while the id holds on to it. Returns -1 if there is none
+    template<typename FuncT>
+    int with_id(int id, FuncT func) {
+        if (id < 0) {
+            return -1;
+        }
+        SpinLock sl(&m_id_lock);
+        for (size_t slot = id_hash(id); m_id_slots[slot].idx != kNil; slot = (slot + 1) % kIdSlots) {
+            if (m_id_slots[slot].id == id) {
+                func(m_func_contexts[m_id_slots[slot].idx]);
+                return 0;
+            }
+        }
+        return -1;
+    }
+
+    // cancels all pending commands with this id
+    int cancel(int id) {
+        if (id < 0) {
+            return 0;
+        }
+        SpinLock sl(&m_id_lock);
+        for (size_t slot = id_hash(id); m_id_slots[slot].idx != kNil; slot = (slot + 1) % kIdSlots) {
+            if (m_id_slots[slot].id == id) {
+                // need to avoid that it is executed
+                m_func_contexts[m_id_slots[slot].idx]->cancelled = 1;
+            }
+        }
+        return 0;
+    }
+
+private:
+    static uint64_t make_head(uint32_t tag, uint32_t idx) {
+        return ((uint64_t)tag << 32) | idx;
+    }
+
+    size_t id_hash(int id) const {
+        return ((uint32_t)id * 2654435761u) % kIdSlots;
+    }
+
+    void remove_id(size_t idx, int id) {
+        SpinLock sl(&m_id_lock);
+        size_t slot = id_hash(id);
+        while (m_id_slots[slot].idx != idx) {
+            assert(m_id_slots[slot].idx != kNil);
+            slot = (slot + 1) % kIdSlots;
+        }
+        // backward shift deletion, moves the following entries of the probe sequence into the gap
+        size_t gap = slot;
+        for (size_t next = (gap + 1) % kIdSlots; m_id_slots[next].idx != kNil; next = (next + 1) % kIdSlots) {
+            const size_t home = id_hash(m_id_slots[next].id);
+            // the entry may move if its home is not within (gap, next]
+            if ((next > gap && (home <= gap || home > next)) || (next < gap && home <= gap && home > next)) {
+                m_id_slots[gap] = m_id_slots[next];
+                gap = next;
+            }
+        }
+        m_id_slots[gap] = IdSlot();
+    }
+
+    std::array<CONTEXT*, SIZE>              m_func_contexts;
+    std::atomic<uint64_t>                   m_free_head;    // tag << 32 | index of the first free context
+    std::array<std::atomic<uint32_t>, SIZE> m_free_next;
+    std::atomic_flag                        m_id_lock;
+    std::array<IdSlot, kIdSlots>            m_id_slots;
 };
 
 /**
- * A queue which contains std::function pointers for cross thread execution.
+ * A binary min-heap of context indices on their deadline. Not thread safe.
+ * Deadlines are compared wrap around safe, they must be less than 2^31 ms apart.
+ */
+template<int SIZE>
+class TimerHeapT
+{
+    struct Timer {
+        uint32_t scheduled_ms;
+        uint32_t idx;
+    };
+public:
+    TimerHeapT() : m_timers(), m_num_timers(0) {}
+
+    bool empty() const {
+        return m_num_timers == 0;
+    }
+
+    size_t size() const {
+        return m_num_timers;
+    }
+
+    // deadline of the first timer, only valid if not empty
+    uint32_t next_ms() const {
+        return m_timers[0].scheduled_ms;
+    }
+
+    // whether the first timer is due at now_ms
+    bool due(uint32_t now_ms) const {
+        return m_num_timers > 0 && (int32_t)(m_timers[0].scheduled_ms - now_ms) <= 0;
+    }
+
+    // time until the first timer is due, capped at max_ms
+    uint32_t wait_ms(uint32_t now_ms, uint32_t max_ms) const {
+        if (m_num_timers == 0) {
+            return max_ms;
+        }
+        const int32_t until_due = (int32_t)(m_timers[0].scheduled_ms - now_ms);
+        return std::min<uint32_t>(max_ms, until_due > 0 ? (uint32_t)until_due : 0);
+    }
+
+    void push(size_t idx, uint32_t scheduled_ms) {
+        // there is never more than one heap entry per context
+        assert(m_num_timers < SIZE);
+        Timer timer = { scheduled_ms, (uint32_t)idx };
+        size_t pos = m_num_timers++;
+        // sift up
+        while (pos > 0 && before(timer, m_timers[(pos - 1) / 2])) {
+            m_timers[pos] = m_timers[(pos - 1) / 2];
+            pos = (pos - 1) / 2;
+        }
+        m_timers[pos] = timer;
+    }
+
+    size_t pop() {
+        const uint32_t first = m_timers[0].idx;
+        const Timer last = m_timers[--m_num_timers];
+        size_t pos = 0;
+        // sift down
+        while (true) {
+            size_t child = 2*pos + 1;
+            if (child >= m_num_timers) {
+                break;
+            }
+            if (child + 1 < m_num_timers && before(m_timers[child + 1], m_timers[child])) {
+                child++;
+            }
+            if (!before(m_timers[child], last)) {
+                break;
+            }
+            m_timers[pos] = m_timers[child];
+            pos = child;
+        }
+        m_timers[pos] = last;
+        return first;
+    }
+
+private:
+    static bool before(const Timer& lhs, const Timer& rhs) {
+        return (int32_t)(lhs.scheduled_ms - rhs.scheduled_ms) < 0;
+    }
+
+    std::array<Timer, SIZE> m_timers;
+    size_t                  m_num_timers;
+};
+
+/**
+ * A queue which contains functions for cross thread execution. The functions are stored inline in the contexts, with
+ * up to FUNC_CAPACITY bytes of captures, so scheduling never allocates.
  * It is especially useful to execute lambda functions in a different thread context. It also supports the
- * delayed scheduling of  functions
+ * delayed scheduling of  functions. Delayed and interval commands travel through the same queue and are kept in a
+ * min-heap on scheduled_ms, which is private to the thread calling process()
+ * Commands have a priority. The processing thread sorts them into one lane per priority and picks the next command
+ * by the PriorityPolicy.
  * It assumes that the provided queue types are threadsafe, ideally lock free.
  *
  */
-template<template<typename> class QueueT, int SIZE, typename STATUS>
+template<template<typename> class QueueT, int SIZE, typename STATUS, size_t FUNC_CAPACITY = kDefaultFuncCapacity>
 class CommandQueue
 {
+    // fifo of context indices, private to the processing thread
+    struct Lane {
+        Lane() : items(), head(0), count(0) {}
+        void push(uint32_t idx) {
+            assert(count < SIZE);
+            items[(head + count++) % SIZE] = idx;
+        }
+        uint32_t pop() {
+            const uint32_t idx = items[head];
+            head = (head + 1) % SIZE;
+            count--;
+            return idx;
+        }
+        std::array<uint32_t, SIZE> items;
+        size_t head;
+        size_t count;
+    };
+
+    struct PriorityStats {
+        PriorityStats() : executed(0), total_wait_us(0), max_wait_us(0), total_exec_us(0), max_exec_us(0) {}
+        std::atomic<uint32_t> executed;
+        std::atomic<uint64_t> total_wait_us;
+        std::atomic<uint32_t> max_wait_us;
+        std::atomic<uint64_t> total_exec_us;
+        std::atomic<uint32_t> max_exec_us;
+    };
+
+#ifdef MOTESQUE_ENABLE_COMMAND_STATS
+    struct CommandIdStats {
+        CommandIdStats() : executed(0), dropped(0), rejected(0), max_wait_us(0), max_run_us(0), wait_histogram(), run_histogram() {}
+        std::atomic<uint32_t> executed;
+        std::atomic<uint32_t> dropped;
+        std::atomic<uint32_t> rejected;
+        std::atomic<uint32_t> max_wait_us;
+        std::atomic<uint32_t> max_run_us;
+        std::array<std::atomic<uint32_t>, kLatencyBuckets> wait_histogram;
+        std::array<std::atomic<uint32_t>, kLatencyBuckets> run_histogram;
+    };
+#endif
+
 public:
-    typedef FuncContextT<STATUS> FuncContext;
+    typedef FuncContextT<STATUS, FUNC_CAPACITY> FuncContext;
+    template<typename R>
+    using Future = CommandFutureT<R, CommandQueue>;
 
     CommandQueue() :
-        m_commands_later(SIZE),
         m_commands(SIZE),
-        m_func_contexts()
+        m_func_contexts(),
+        m_timers(),
+        m_lanes(),
+        m_policy(PriorityPolicy_Strict),
+        m_weights(),
+        m_credits(),
+        m_stats()
     {
-        // create n contexts
-        for (size_t i=0; i < m_func_contexts.size(); i++) {
-            FuncContext* p = new FuncContext();
-            m_func_contexts[i] = p;
-        }
+        m_weights[CommandPriority_High] = 4;
+        m_weights[CommandPriority_Normal] = 2;
+        m_weights[CommandPriority_Low] = 1;
+        m_credits = m_weights;
     }
 
     virtual ~CommandQueue() {
-        for (size_t i=0; i < m_func_contexts.size(); i++) {
-            delete m_func_contexts[i];
-        }
     }
 
+    // cancels all pending commands with this id
     int cancel(int id) {
-        auto it = std::find_if(m_func_contexts.begin(), m_func_contexts.end(), [id](const FuncContext* ctx) -> bool {
-            return ctx->cmd_id == id && ctx->ref_count > 0;
-        });
-        if (it != m_func_contexts.end()) {
-            // need to avoid that it is executed
-            (*it)->cancelled = 1; 
+        return m_func_contexts.cancel(id);
+    }
+
+    // how the next lane is picked. |weights| (one per priority, > 0) are the commands per round for PriorityPolicy_Weighted.
+    // Set it up before processing starts
+    int set_priority_policy(PriorityPolicy policy, const uint32_t* weights = NULL) {
+        if (weights) {
+            for (int i=0; i < kNumCommandPriorities; i++) {
+                if (weights[i] == 0) {
+                    return -1;
+                }
+            }
+            std::copy(weights, weights + kNumCommandPriorities, m_weights.begin());
         }
+        m_policy = policy;
+        m_credits = m_weights;
         return 0;
     }
 
-    int find_available_func_context(size_t* idx) {
-        auto it = std::find_if(m_func_contexts.begin(), m_func_contexts.end(), [](const FuncContext* ctx) -> bool {
-            return ctx->ref_count == 0;
-        });
-        if (it == m_func_contexts.end()) {
-            // no available func context to execute command
+    // queue wait and execution times of the commands of a priority. Updated by the processing thread
+    int get_priority_stats(CommandPriority priority, CommandPriorityStats* stats) const {
+        if (priority < 0 || priority >= kNumCommandPriorities) {
             return -1;
         }
-        *idx = std::distance(m_func_contexts.begin(), it);
+        const PriorityStats& s = m_stats[priority];
+        stats->executed = s.executed;
+        stats->total_wait_us = s.total_wait_us;
+        stats->max_wait_us = s.max_wait_us;
+        stats->total_exec_us = s.total_exec_us;
+        stats->max_exec_us = s.max_exec_us;
         return 0;
     }
 
+    // queue wait, run time and failed scheduling of the commands with this CommandID.
+    // Returns -1 if the queue was built without MOTESQUE_ENABLE_COMMAND_STATS
+    int get_command_stats(int cmd_id, CommandStats* stats) const {
+#ifdef MOTESQUE_ENABLE_COMMAND_STATS
+        if (cmd_id < 0 || cmd_id >= kNumCommandIDs) {
+            return -1;
+        }
+        const CommandIdStats& s = m_command_stats[cmd_id];
+        stats->executed = s.executed;
+        stats->dropped = s.dropped;
+        stats->rejected = s.rejected;
+        stats->max_wait_us = s.max_wait_us;
+        stats->max_run_us = s.max_run_us;
+        for (size_t i=0; i < kLatencyBuckets; i++) {
+            stats->wait_histogram[i] = s.wait_histogram[i];
+            stats->run_histogram[i] = s.run_histogram[i];
+        }
+        return 0;
+#else
+        return -1;
+#endif
+    }
+
     /**
      * Put a function type on the queue;
      * Make it waitable as well. This way we can do interleaving
      */
     template<typename FuncT>
-    int execute_async(FuncT func, bool wait=false) {
+    int execute_async(FuncT func, bool wait=false, CommandPriority priority=CommandPriority_Normal) {
         size_t func_context_idx = 0;
-        if (find_available_func_context(&func_context_idx) < 0) {
+        if (m_func_contexts.acquire(&func_context_idx) < 0) {
+            count_rejected(Unknown);
             return -1;
         }
         FuncContext* func_context = m_func_contexts[func_context_idx];
-        func_context->reset();
-        // wrap lambda in std::function to be easy assignable
-        func_context->func = FuncType(func);
+        // stored inline, fails to compile if the captures exceed FUNC_CAPACITY
+        func_context->func = func;
         func_context->scheduled_ms = 0;
+        func_context->priority = priority;
+        func_context->enqueued_us = nowUs();
         func_context->status.clear();
-        func_context->inc_ref_count();
+        if (wait) {
+            // the waiter holds its own reference, otherwise the context could be reused before we woke up
+            func_context->inc_ref_count();
+        }
         int rc = -1;
         if ((rc = m_commands.put(func_context_idx, 100)) != 0 ) {
             // cannot schedule at this time, abort
-            func_context->dec_ref_count();
+            count_dropped(Unknown);
+            if (wait) {
+                func_context->dec_ref_count();
+            }
+            m_func_contexts.release(func_context_idx);
             return -1;
         }
         if (wait) {
             wiced_rtos_thread_yield();
-            func_context->status.wait_for(WICED_NEVER_TIMEOUT); 
+            func_context->status.wait_for(WICED_NEVER_TIMEOUT);
+            m_func_contexts.release(func_context_idx);
         }
         return 0;
     }
 
     /**
-     * Put a function type on the queue with delay;
+     * Put a function returning a value on the queue. The value has to be trivially copyable and fit into
+     * kCommandResultCapacity. The returned future is invalid if the command could not be scheduled
+     */
+    template<typename FuncT>
+    Future<typename std::result_of<FuncT()>::type> submit(FuncT func, CommandPriority priority=CommandPriority_Normal) {
+        typedef typename std::result_of<FuncT()>::type R;
+        size_t func_context_idx = 0;
+        if (m_func_contexts.acquire(&func_context_idx) < 0) {
+            count_rejected(Unknown);
+            return Future<R>();
+        }
+        FuncContext* func_context = m_func_contexts[func_context_idx];
+        func_context->func = [func, func_context]() {
+            func_context->set_result(func());
+        };
+        func_context->scheduled_ms = 0;
+        func_context->priority = priority;
+        func_context->enqueued_us = nowUs();
+        func_context->status.clear();
+        // one reference for the execution, one for the future
+        func_context->inc_ref_count();
+        if (m_commands.put(func_context_idx, 100) != 0) {
+            count_dropped(Unknown);
+            func_context->dec_ref_count();
+            m_func_contexts.release(func_context_idx);
+            return Future<R>();
+        }
+        return Future<R>(this, func_context_idx);
+    }
+
+    /**
+     * Put a function type on the queue with delay; the priority follows from the id
      */
     template<typename FuncT>
     int execute_async_later(FuncT func, uint32_t delay_ms, int id = -1) {
+        return execute_async_later(func, delay_ms, id, command_priority(id));
+    }
+
+    template<typename FuncT>
+    int execute_async_later(FuncT func, uint32_t delay_ms, int id, CommandPriority priority) {
         size_t func_context_idx = 0;
-        if (find_available_func_context(&func_context_idx) < 0) {
+        if (m_func_contexts.acquire(&func_context_idx) < 0) {
+            count_rejected(id);
             return -1;
         }
         FuncContext* func_context = m_func_contexts[func_context_idx];
-        func_context->reset();
-        // wrap lambda in std::function to be easy assignable
-        func_context->func = FuncType(func);
+        // stored inline, fails to compile if the captures exceed FUNC_CAPACITY
+        func_context->func = func;
         func_context->scheduled_ms = nowMs() + delay_ms;
+        func_context->delayed = true;
+        func_context->priority = priority;
         func_context->status.clear();
-        func_context->inc_ref_count();
-        func_context->cmd_id = id;
+        m_func_contexts.set_id(func_context_idx, id);
         int rc = -1;
-        if ((rc = m_commands_later.put(func_context_idx, 100)) != 0 ) {
+        if ((rc = m_commands.put(func_context_idx, 100)) != 0 ) {
             // cannot schedule at this time, abort
-            func_context->dec_ref_count();
+            count_dropped(id);
+            m_func_contexts.release(func_context_idx);
             return -1;
         }
         return 0;
     }
 
     template<typename FuncT>
-    int execute_async_interval(FuncT func, uint32_t interval_ms, int id = -1)
+    int execute_async_interval(FuncT func, uint32_t interval_ms, int id = -1) {
+        return execute_async_interval(func, interval_ms, id, command_priority(id));
+    }
+
+    template<typename FuncT>
+    int execute_async_interval(FuncT func, uint32_t interval_ms, int id, CommandPriority priority,
+                               IntervalPolicy policy = IntervalPolicy_FixedDelay)
     {
         size_t func_context_idx = 0;
-        if (find_available_func_context(&func_context_idx) < 0) {
+        if (m_func_contexts.acquire(&func_context_idx) < 0) {
+            count_rejected(id);
             return -1;
         }
         FuncContext* func_context = m_func_contexts[func_context_idx];
-        func_context->reset();
-        func_context->func = FuncType(func);
+        func_context->func = func;
         func_context->scheduled_ms = nowMs() + interval_ms;
+        func_context->delayed = true;
+        func_context->priority = priority;
         func_context->status.clear();
-        func_context->inc_ref_count();
-        func_context->cmd_id = id;
         func_context->interval_ms = interval_ms;
+        func_context->interval_policy = policy;
+        m_func_contexts.set_id(func_context_idx, id);
         int rc = -1;
-        if ((rc = m_commands_later.put(func_context_idx, 100)) != 0 ) {
+        if ((rc = m_commands.put(func_context_idx, 100)) != 0 ) {
             // cannot schedule at this time, abort
-            func_context->dec_ref_count();
+            count_dropped(id);
+            m_func_contexts.release(func_context_idx);
             return -1;
         }
         return 0;
     }
 
+    // runs, missed deadlines and lateness of the (first) interval command with this id
+    int get_interval_stats(int id, IntervalStats* stats) {
+        return m_func_contexts.with_id(id, [stats](const FuncContext* func_context) {
+            func_context->get_interval_stats(stats);
+        });
+    }
 
+    /**
+     * Execute the next command and all due timers. Waits at most timeout_ms for a command, less if a timer is due earlier.
+     * Must always be called from the same thread.
+     */
     void process(uint32_t timeout_ms) {
-        enqueue_delayed_commands();
-        size_t func_context_idx = 0;
-        if (0 == m_commands.pop(&func_context_idx, timeout_ms)) {
+        // one command plus one for every timer which became due
+        const size_t due_timers = collect(timeout_ms);
+        run(due_timers + 1, 0);
+    }
+
+    /**
+     * Drain up to max_items commands, including due timers, in the order of the priority policy.
+     * Stops early once budget_us (0 for no limit) are used up, at least one command is executed.
+     * Waits at most timeout_ms if there is nothing to do. Returns the number of commands executed
+     */
+    size_t process_batch(size_t max_items, uint32_t budget_us, uint32_t timeout_ms = 0) {
+        collect(timeout_ms);
+        return run(max_items, budget_us);
+    }
+
+private:
+        // move new commands into the lanes or the timer heap and due timers into the lanes.
+        // Returns the number of timers which became due
+        size_t collect(uint32_t timeout_ms) {
+            uint32_t now = nowMs();
+            // no need to sleep if there is work left from the last batch
+            uint32_t wait_ms = pending() > 0 ? 0 : m_timers.wait_ms(now, timeout_ms);
+            size_t func_context_idx = 0;
+            while (0 == m_commands.pop(&func_context_idx, wait_ms)) {
+                if (wait_ms > 0) {
+                    // we might have slept
+                    now = nowMs();
+                    wait_ms = 0;
+                }
+                FuncContext* func_context = m_func_contexts[func_context_idx];
+                if (func_context->delayed) {
+                    m_timers.push(func_context_idx, func_context->scheduled_ms);
+                }
+                else {
+                    m_lanes[func_context->priority].push((uint32_t)func_context_idx);
+                }
+            }
+            if (wait_ms > 0) {
+                // slept until the next deadline or the timeout without a command
+                now = nowMs();
+            }
+            size_t due_timers = 0;
+            const uint64_t now_us = m_timers.due(now) ? nowUs() : 0;
+            while (m_timers.due(now)) {
+                func_context_idx = m_timers.pop();
+                FuncContext* func_context = m_func_contexts[func_context_idx];
+                func_context->enqueued_us = now_us;
+                func_context->late_ms = now - func_context->scheduled_ms;
+                m_lanes[func_context->priority].push((uint32_t)func_context_idx);
+                due_timers++;
+            }
+            return due_timers;
+        }
+
+        size_t pending() const {
+            size_t count = 0;
+            for (int i=0; i < kNumCommandPriorities; i++) {
+                count += m_lanes[i].count;
+            }
+            return count;
+        }
+
+        size_t run(size_t max_items, uint32_t budget_us) {
+            const uint64_t start_us = budget_us > 0 ? nowUs() : 0;
+            size_t executed = 0;
+            int lane = -1;
+            while (executed < max_items && (lane = next_lane()) >= 0) {
+                execute(m_lanes[lane].pop());
+                executed++;
+                if (budget_us > 0 && nowUs() - start_us >= budget_us) {
+                    break;
+                }
+            }
+            return executed;
+        }
+
+        int next_lane() {
+            if (m_policy == PriorityPolicy_Strict) {
+                for (int i=0; i < kNumCommandPriorities; i++) {
+                    if (m_lanes[i].count > 0) {
+                        return i;
+                    }
+                }
+                return -1;
+            }
+            // weighted: the highest lane which has work and credits left. A new round once no such lane is left
+            for (int round=0; round < 2; round++) {
+                for (int i=0; i < kNumCommandPriorities; i++) {
+                    if (m_lanes[i].count > 0 && m_credits[i] > 0) {
+                        m_credits[i]--;
+                        return i;
+                    }
+                }
+                m_credits = m_weights;
+            }
+            return -1;
+        }
+
+        template<typename, typename> friend class CommandFutureT;
+
+        FuncContext* context(size_t idx) const {
+            return m_func_contexts[idx];
+        }
+
+        void release_context(size_t idx) {
+            m_func_contexts.release(idx);
+        }
+
+        // schedule func(result of parent_idx) once the parent is done. Takes over the reference the future had on the parent
+        template<typename R, typename R2, typename FuncT>
+        Future<R2> chain(size_t parent_idx, FuncT func) {
+            FuncContext* parent = m_func_contexts[parent_idx];
+            size_t func_context_idx = 0;
+            if (m_func_contexts.acquire(&func_context_idx) < 0) {
+                count_rejected(Unknown);
+                m_func_contexts.release(parent_idx);
+                return Future<R2>();
+            }
+            FuncContext* func_context = m_func_contexts[func_context_idx];
+            func_context->func = [func, parent, func_context]() {
+                R value;
+                parent->get_result(&value);
+                func_context->set_result(func(value));
+            };
+            func_context->scheduled_ms = 0;
+            func_context->priority = parent->priority;
+            func_context->status.clear();
+            func_context->parent_idx = (int)parent_idx;
+            // one reference for the execution, one for the future
+            func_context->inc_ref_count();
+            parent->continuation_idx = (uint32_t)func_context_idx;
+            int state = FuncContext::FutureState_Pending;
+            if (!parent->future_state.compare_exchange_strong(state, FuncContext::FutureState_Continuation)) {
+                // the parent is done already, schedule it ourselves
+                func_context->enqueued_us = nowUs();
+                if (m_commands.put(func_context_idx, 100) != 0) {
+                    count_dropped(Unknown);
+                    func_context->dec_ref_count();
+                    m_func_contexts.release(func_context_idx);
+                    m_func_contexts.release(parent_idx);
+                    return Future<R2>();
+                }
+            }
+            return Future<R2>(this, func_context_idx);
+        }
+
+        // the command is done, wake up the future and start a continuation
+        void complete(FuncContext* func_context) {
+            if (func_context->parent_idx >= 0) {
+                m_func_contexts.release((size_t)func_context->parent_idx);
+                func_context->parent_idx = -1;
+            }
+            if (func_context->future_state.exchange(FuncContext::FutureState_Done) == FuncContext::FutureState_Continuation) {
+                FuncContext* continuation = m_func_contexts[func_context->continuation_idx];
+                continuation->enqueued_us = nowUs();
+                m_lanes[continuation->priority].push(func_context->continuation_idx);
+            }
+        }
+
+        void execute(size_t func_context_idx) {
             FuncContext* func_context = m_func_contexts[func_context_idx];
-            timeout_ms = 0;
             if (func_context->cancelled) {
-                func_context->dec_ref_count();
+                m_func_contexts.release(func_context_idx);
                 return;
             }
+            PriorityStats& stats = m_stats[func_context->priority];
+            const uint64_t start_us = nowUs();
             // call the function
             func_context->func();
+            const uint32_t wait_us = (uint32_t)(start_us - func_context->enqueued_us);
+            const uint64_t end_us = nowUs();
+            const uint32_t exec_us = (uint32_t)(end_us - start_us);
+#ifdef MOTESQUE_ENABLE_COMMAND_STATS
+            func_context->dequeued_us = start_us;
+            func_context->completed_us = end_us;
+            account_command(func_context, func_context_idx);
+#endif
+            stats.executed++;
+            stats.total_wait_us += wait_us;
+            stats.max_wait_us = std::max<uint32_t>(stats.max_wait_us, wait_us);
+            stats.total_exec_us += exec_us;
+            stats.max_exec_us = std::max<uint32_t>(stats.max_exec_us, exec_us);
             if (func_context->interval_ms > 0) {
-               // execute after interval time
-               func_context->scheduled_ms = nowMs() + func_context->interval_ms;
-               if (m_commands_later.put(func_context_idx, 100) != 0 ) {
-                   // cannot schedule at this time, abort execution of this interval function
-                   func_context->dec_ref_count();
-               }    
+                account_run(func_context, func_context->late_ms + wait_us / 1000);
+                reschedule(func_context);
+                m_timers.push(func_context_idx, func_context->scheduled_ms);
             }
             else {
+                complete(func_context);
                 // set the status to wake up waiting threads
                 func_context->status.set();
-                func_context->dec_ref_count();
+                m_func_contexts.release(func_context_idx);
             }
         }
-    }
 
-private:
-        void enqueue_delayed_commands() {
-            FuncContext* func_context = NULL;
-            FuncContext* func_context_start = NULL;
-            uint32_t now = nowMs();
-            int rc;
-            size_t func_context_idx = 0;
-            // iterate through the pending commands and and put other queue
-            while ( (rc = m_commands_later.pop(&func_context_idx, 0)) == 0) {
-                func_context = m_func_contexts[func_context_idx];
-                if (now >= (uint32_t)func_context->scheduled_ms) {
-                    // should run
-                    // note that we do not have increase the ref count here because we already did though for the later queue
-                    if ((rc = m_commands.put(func_context_idx, 0)) != 0 ) {
-                        // cannot schedule, cleanup and fail silently.
-                        func_context->dec_ref_count();
-                    }
-                    // exit here since we messed up the func_context_start loop detection.
-                    // This is really bad design and needs to be reimplemented 
-                    break;
+        void count_rejected(int cmd_id) {
+#ifdef MOTESQUE_ENABLE_COMMAND_STATS
+            m_command_stats[stats_id(cmd_id)].rejected++;
+#endif
+        }
+
+        void count_dropped(int cmd_id) {
+#ifdef MOTESQUE_ENABLE_COMMAND_STATS
+            m_command_stats[stats_id(cmd_id)].dropped++;
+#endif
+        }
+
+#ifdef MOTESQUE_ENABLE_COMMAND_STATS
+        static int stats_id(int cmd_id) {
+            return cmd_id >= 0 && cmd_id < kNumCommandIDs ? cmd_id : Unknown;
+        }
+
+        // called by the processing thread after the command ran
+        void account_command(const FuncContext* func_context, size_t func_context_idx) {
+            const uint64_t wait_us = func_context->dequeued_us - func_context->enqueued_us;
+            const uint64_t run_us = func_context->completed_us - func_context->dequeued_us;
+            CommandIdStats& s = m_command_stats[stats_id(func_context->cmd_id)];
+            s.executed++;
+            s.max_wait_us = std::max<uint32_t>(s.max_wait_us, (uint32_t)wait_us);
+            s.max_run_us = std::max<uint32_t>(s.max_run_us, (uint32_t)run_us);
+            s.wait_histogram[latency_bucket(wait_us)]++;
+            s.run_histogram[latency_bucket(run_us)]++;
+#ifdef MOTESQUE_ENABLE_EVENT_TRACE
+            // the trace has its own clock, place the spans relative to its now
+            uint64_t trace_now = 0;
+            lw_event_trace::query_counter(&trace_now);
+            const uint64_t completed = trace_now - (nowUs() - func_context->completed_us);
+            const uint64_t dequeued = completed - run_us;
+            const char* name = command_name(func_context->cmd_id);
+            lw_event_trace::LwEventTraceLogger& logger = lw_event_trace::LwEventTraceLogger::get_instance();
+            // waits overlap, every context gets a track of its own. A context waits at most once at a time
+            const uint32_t wait_track = kCommandWaitTraceTrack + (uint32_t)func_context_idx % (255 - kCommandWaitTraceTrack);
+            logger.addEventTrace("CommandQueue.wait", name, wait_track, dequeued - wait_us, 'B');
+            logger.addEventTrace("CommandQueue.wait", name, wait_track, dequeued, 'E');
+            const uint32_t thread_id = lw_event_trace::get_current_thread_id();
+            logger.addEventTrace("CommandQueue.run", name, thread_id, dequeued, 'B');
+            logger.addEventTrace("CommandQueue.run", name, thread_id, completed, 'E');
+#endif
+        }
+#endif
+
+        void account_run(FuncContext* func_context, uint32_t lateness_ms) {
+            func_context->runs++;
+            func_context->max_lateness_ms = std::max<uint32_t>(func_context->max_lateness_ms, lateness_ms);
+            func_context->lateness_histogram[lateness_bucket(lateness_ms)]++;
+        }
+
+        void reschedule(FuncContext* func_context) {
+            const uint32_t now = nowMs();
+            const uint32_t interval_ms = (uint32_t)func_context->interval_ms;
+            if (func_context->interval_policy == IntervalPolicy_FixedDelay) {
+                // execute after interval time
+                func_context->scheduled_ms = now + interval_ms;
+                return;
+            }
+            // anchored to the previous deadline, so the runtime does not add up
+            uint32_t next_ms = func_context->scheduled_ms + interval_ms;
+            if ((int32_t)(next_ms - now) < 0) {
+                // the deadlines next_ms + k * interval_ms for k in [0, passed) are gone already
+                const uint32_t passed = (now - next_ms - 1) / interval_ms + 1;
+                if (func_context->interval_policy == IntervalPolicy_FixedRateCatchUp) {
+                    // run once right away, on the last deadline that passed
+                    func_context->missed += passed - 1;
+                    next_ms += (passed - 1) * interval_ms;
                 }
                 else {
-                    // reenter the queue
-                    m_commands_later.put(func_context_idx, 0);
-                }
-                // check whether we looped around
-                if (func_context == func_context_start) {
-                    return;
-                }
-                // save the start for loop detection
-                if (func_context_start == NULL) {
-                    func_context_start = func_context;
+                    func_context->missed += passed;
+                    next_ms += passed * interval_ms;
                 }
             }
+            func_context->scheduled_ms = next_ms;
         }
 
 private:
-    QueueT<size_t>   m_commands_later;
-    QueueT<size_t>   m_commands;
-    std::array<FuncContext*, SIZE> m_func_contexts;
-
+    QueueT<size_t>                       m_commands;
+    FuncContextPoolT<FuncContext, SIZE>  m_func_contexts;
+    TimerHeapT<SIZE>                     m_timers;
+    std::array<Lane, kNumCommandPriorities>     m_lanes;
+    PriorityPolicy                              m_policy;
+    std::array<uint32_t, kNumCommandPriorities> m_weights;
+    std::array<uint32_t, kNumCommandPriorities> m_credits;
+    std::array<PriorityStats, kNumCommandPriorities> m_stats;
+#ifdef MOTESQUE_ENABLE_COMMAND_STATS
+    std::array<CommandIdStats, kNumCommandIDs>  m_command_stats;
+#endif
 };
 
 
 } // end ns
-
-
@@ -1,4 +1,11 @@
 #pragma once
+#ifdef __linux__
+#include "futex.h"
+
+// host builds sleep on a futex with a real timed wait
+typedef motesque::FutexEventFlag EventFlagStatus;
+
+#else
 #include "wiced_rtos.h"
 
 struct EventFlagStatus {
@@ -29,8 +36,10 @@ struct EventFlagStatus {
 
     int wait_for(uint32_t timeout_ms) {
         uint32_t flags_set = 0;
-        wiced_result_t rc = wiced_rtos_wait_for_event_flags(&event_flags, 1 ,&flags_set, WICED_TRUE, WAIT_FOR_ANY_EVENT, 2000);
+        wiced_result_t rc = wiced_rtos_wait_for_event_flags(&event_flags, 1 ,&flags_set, WICED_TRUE, WAIT_FOR_ANY_EVENT, timeout_ms);
         return (rc == WICED_SUCCESS) ? 0: -1;
     }
     wiced_event_flags_t event_flags;
 };
+
+#endif
@@ -0,0 +1,119 @@
+#pragma once
+#include <atomic>
+#include <climits>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace motesque
+{
+
+/* LOCK and EVENT_FLAG policies for host (linux) builds of the util containers, e.g.
+ * SequentialBufferT<FutexLock, FutexEventFlag> or CommandQueue<..., FutexEventFlag>.
+ * Both sleep in the kernel instead of spinning and only enter it when there actually is contention. */
+
+// a timeout which never expires, same value as WICED_NEVER_TIMEOUT
+enum { kFutexNeverTimeout = 0xffffffff };
+
+inline long futex_wait(std::atomic<int>* addr, int expected, const struct timespec* timeout)
+{
+    return syscall(SYS_futex, reinterpret_cast<int*>(addr), FUTEX_WAIT_PRIVATE, expected, timeout, NULL, 0);
+}
+
+inline long futex_wake(std::atomic<int>* addr, int count)
+{
+    return syscall(SYS_futex, reinterpret_cast<int*>(addr), FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+inline uint64_t futex_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// A mutex after Drepper's "Futexes Are Tricky": 0 unlocked, 1 locked, 2 locked with (possible) waiters.
+// An uncontended lock / unlock is a single atomic operation each.
+class FutexLock
+{
+    FutexLock(const FutexLock& rhs);
+    FutexLock& operator=(const FutexLock& rhs);
+public:
+    FutexLock() : m_state(0) {}
+
+    void lock() {
+        int c = 0;
+        if (m_state.compare_exchange_strong(c, 1, std::memory_order_acquire)) {
+            return;
+        }
+        // contended, announce a waiter and sleep until the holder wakes us
+        if (c != 2) {
+            c = m_state.exchange(2, std::memory_order_acquire);
+        }
+        while (c != 0) {
+            futex_wait(&m_state, 2, NULL);
+            c = m_state.exchange(2, std::memory_order_acquire);
+        }
+    }
+    bool try_lock() {
+        int c = 0;
+        return m_state.compare_exchange_strong(c, 1, std::memory_order_acquire);
+    }
+    void unlock() {
+        if (m_state.exchange(0, std::memory_order_release) == 2) {
+            futex_wake(&m_state, 1);
+        }
+    }
+private:
+    std::atomic<int> m_state;
+};
+
+// An event flag with the semantics of the WICED EventFlagStatus: set() wakes all waiters,
+// a successful wait_for() consumes (clears) the flag, wait_for() returns -1 on timeout.
+struct FutexEventFlag {
+    FutexEventFlag() : status(0), waiters(0) {}
+
+    void set() {
+        // seq_cst on status and waiters: either we see the waiter or the waiter sees the flag
+        status.store(1);
+        // skip the syscall if nobody sleeps
+        if (waiters.load() > 0) {
+            futex_wake(&status, INT_MAX);
+        }
+    }
+    void clear() {
+        status.store(0, std::memory_order_release);
+    }
+    int wait_for(uint32_t timeout_ms) {
+        const uint64_t deadline_ns = futex_now_ns() + (uint64_t)timeout_ms * 1000000ull;
+        while (true) {
+            int expected = 1;
+            if (status.compare_exchange_strong(expected, 0, std::memory_order_acquire)) {
+                return 0;
+            }
+            struct timespec timeout;
+            struct timespec* timeout_ptr = NULL;
+            if (timeout_ms != kFutexNeverTimeout) {
+                const uint64_t now_ns = futex_now_ns();
+                if (now_ns >= deadline_ns) {
+                    return -1;
+                }
+                // FUTEX_WAIT takes a relative timeout
+                timeout.tv_sec = (time_t)((deadline_ns - now_ns) / 1000000000ull);
+                timeout.tv_nsec = (long)((deadline_ns - now_ns) % 1000000000ull);
+                timeout_ptr = &timeout;
+            }
+            waiters.fetch_add(1);
+            // returns right away if the flag was set in the meantime
+            futex_wait(&status, 0, timeout_ptr);
+            waiters.fetch_sub(1);
+        }
+    }
+    std::atomic<int> status;
+    std::atomic<int> waiters;
+};
+
+}
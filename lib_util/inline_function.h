@@ -0,0 +1,146 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace motesque
+{
+
+template<typename SIGNATURE, size_t CAPACITY>
+class InlineFunction;
+
+/* A std::function replacement which never allocates. The callable is stored in a buffer of CAPACITY bytes inside
+ * the object; a callable which does not fit is a compile time error instead of a heap allocation.
+ * Calling an empty InlineFunction is undefined, check with operator bool first. */
+template<typename R, typename... Args, size_t CAPACITY>
+class InlineFunction<R(Args...), CAPACITY>
+{
+    enum Operation {
+        Operation_Copy,
+        Operation_Move,
+        Operation_Destroy
+    };
+    typedef R (*InvokeFunc)(void* storage, Args... args);
+    typedef void (*ManageFunc)(Operation op, void* dst, void* src);
+
+    template<typename F>
+    static R invoke(void* storage, Args... args) {
+        return (*static_cast<F*>(storage))(std::forward<Args>(args)...);
+    }
+
+    template<typename F>
+    static void manage(Operation op, void* dst, void* src) {
+        switch (op) {
+            case Operation_Copy:
+                new (dst) F(*static_cast<const F*>(src));
+                break;
+            case Operation_Move:
+                new (dst) F(std::move(*static_cast<F*>(src)));
+                static_cast<F*>(src)->~F();
+                break;
+            case Operation_Destroy:
+                static_cast<F*>(dst)->~F();
+                break;
+        }
+    }
+
+public:
+    InlineFunction() : m_invoke(NULL), m_manage(NULL) {}
+
+    InlineFunction(std::nullptr_t) : m_invoke(NULL), m_manage(NULL) {}
+
+    template<typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, InlineFunction>::value>::type>
+    InlineFunction(F&& func) : m_invoke(NULL), m_manage(NULL) {
+        assign(std::forward<F>(func));
+    }
+
+    InlineFunction(const InlineFunction& rhs) : m_invoke(NULL), m_manage(NULL) {
+        if (rhs.m_manage) {
+            rhs.m_manage(Operation_Copy, &m_storage, const_cast<void*>(static_cast<const void*>(&rhs.m_storage)));
+            m_invoke = rhs.m_invoke;
+            m_manage = rhs.m_manage;
+        }
+    }
+
+    InlineFunction(InlineFunction&& rhs) : m_invoke(NULL), m_manage(NULL) {
+        take(rhs);
+    }
+
+    ~InlineFunction() {
+        reset();
+    }
+
+    InlineFunction& operator=(const InlineFunction& rhs) {
+        if (this != &rhs) {
+            InlineFunction tmp(rhs);
+            reset();
+            take(tmp);
+        }
+        return *this;
+    }
+
+    InlineFunction& operator=(InlineFunction&& rhs) {
+        if (this != &rhs) {
+            reset();
+            take(rhs);
+        }
+        return *this;
+    }
+
+    InlineFunction& operator=(std::nullptr_t) {
+        reset();
+        return *this;
+    }
+
+    template<typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, InlineFunction>::value>::type>
+    InlineFunction& operator=(F&& func) {
+        reset();
+        assign(std::forward<F>(func));
+        return *this;
+    }
+
+    R operator()(Args... args) const {
+        return m_invoke(const_cast<void*>(static_cast<const void*>(&m_storage)), std::forward<Args>(args)...);
+    }
+
+    explicit operator bool() const {
+        return m_invoke != NULL;
+    }
+
+    // destroys the stored callable together with its captures
+    void reset() {
+        if (m_manage) {
+            m_manage(Operation_Destroy, &m_storage, NULL);
+        }
+        m_invoke = NULL;
+        m_manage = NULL;
+    }
+
+private:
+    template<typename F>
+    void assign(F&& func) {
+        typedef typename std::decay<F>::type FuncT;
+        static_assert(sizeof(FuncT) <= CAPACITY, "the callable does not fit into the InlineFunction, increase CAPACITY or capture less");
+        static_assert(alignof(FuncT) <= alignof(std::max_align_t), "the callable is over aligned");
+        new (&m_storage) FuncT(std::forward<F>(func));
+        m_invoke = &invoke<FuncT>;
+        m_manage = &manage<FuncT>;
+    }
+
+    void take(InlineFunction& rhs) {
+        if (rhs.m_manage) {
+            rhs.m_manage(Operation_Move, &m_storage, &rhs.m_storage);
+            m_invoke = rhs.m_invoke;
+            m_manage = rhs.m_manage;
+            rhs.m_invoke = NULL;
+            rhs.m_manage = NULL;
+        }
+    }
+
+    typename std::aligned_storage<CAPACITY, alignof(std::max_align_t)>::type m_storage;
+    InvokeFunc m_invoke;
+    ManageFunc m_manage;
+};
+
+}
@@ -1,5 +1,6 @@
 
 #include "wiced.h"
+#include "micro_clock.h"
 
 namespace motesque {
 
@@ -8,4 +9,9 @@ uint32_t nowMs() {
     return host_rtos_get_time();
 }
 
+// return current time in microseconds
+uint64_t nowUs() {
+    return get_time_micros();
+}
+
 }; // end ns
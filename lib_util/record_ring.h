@@ -0,0 +1,262 @@
+#pragma once
+#include <cassert>
+#include <algorithm>
+#include <type_traits>
+#include <stdint.h>
+#include <string.h>
+namespace motesque
+{
+
+/* A thread safe single producer, single consumer ring of fixed size records, e.g. FrameMessages or sensor packets.
+ * It follows the design of SequentialBufferT (indempotent request / commit and a watermark event), but counts in
+ * records, so a consumer never sees half a record at the wrap point. Batches are handed out as spans of whole
+ * records, which are contiguous up to the end of the ring. The storage is cache line aligned. */
+template<typename T, typename LOCK, typename EVENT_FLAG>
+class RecordRingT
+{
+    RecordRingT(const RecordRingT& rhs);
+    RecordRingT& operator=(const RecordRingT& rhs);
+
+    enum { kCacheLineSize = 64 };
+
+class ScopedLock
+{
+public:
+  ScopedLock(LOCK* lock) : m_lock(lock){
+      m_lock->lock();
+  }
+  ~ScopedLock() {
+      m_lock->unlock();
+  }
+private:
+  LOCK* m_lock;
+
+};
+
+public:
+    // |num_records| must be > 0
+    RecordRingT(size_t num_records);
+    virtual ~RecordRingT();
+    // clear the ring
+    void clear();
+    // copy one record into the ring. Fails if the ring is full
+    int push(const T& record);
+    // copy |count| records into the ring. Fails if not all of them fit
+    int push_n(const T* records, size_t count);
+    // get a span of up to |max_count| free contiguous slots to fill in place
+    int reserve_push_n(T** records, size_t max_count, size_t* count);
+    // publish |count| records of the reserved span. Fires the watermark event like push
+    int commit_push(size_t count);
+    // get a span of up to |max_count| records. Optionally waits for reached watermark timeout milliseconds
+    int request_pop_n(const T** records, size_t max_count, size_t* count, uint32_t timeout_ms);
+    // advance the read cursor by |count| records
+    int commit_pop(size_t count);
+    // copy up to |max_count| records out of the ring, across the wrap point
+    int pop_n(T* records, size_t max_count, size_t* count, uint32_t timeout_ms);
+    // the number of free slots
+    size_t free() const;
+    // the number of records stored
+    size_t size() const;
+    // the number of slots
+    size_t capacity() const {
+        return m_capacity;
+    }
+    // watermark in records for signalling mechanism
+    int set_watermark(size_t threshold_records);
+private:
+    void publish(size_t count);
+
+    static_assert(std::is_trivially_copyable<T>::value, "RecordRingT records are copied with memcpy");
+
+    uint8_t* const m_memory;
+    T* const       m_records;
+    const size_t   m_capacity;
+    size_t         m_read_idx;
+    size_t         m_write_idx;
+    size_t         m_count;
+    size_t         m_reserved;
+    mutable LOCK   m_lock;
+    EVENT_FLAG     m_watermark_event;
+    size_t         m_watermark_records;
+};
+
+template<typename T, typename LOCK, typename EVENT_FLAG>
+RecordRingT<T, LOCK, EVENT_FLAG>::RecordRingT(size_t num_records)
+: m_memory(new uint8_t[num_records*sizeof(T) + kCacheLineSize]),
+  // align the first record to a cache line
+  m_records((T*)(m_memory + (kCacheLineSize - (uintptr_t)m_memory % kCacheLineSize) % kCacheLineSize)),
+  m_capacity(num_records),
+  m_read_idx(0),
+  m_write_idx(0),
+  m_count(0),
+  m_reserved(0),
+  m_lock(),
+  m_watermark_records(1)
+{
+    // the indices wrap modulo the number of records
+    assert(num_records > 0);
+    clear();
+}
+
+template<typename T, typename LOCK, typename EVENT_FLAG>
+RecordRingT<T, LOCK, EVENT_FLAG>::~RecordRingT()
+{
+    delete[] m_memory;
+}
+
+template<typename T, typename LOCK, typename EVENT_FLAG>
+void RecordRingT<T, LOCK, EVENT_FLAG>::clear()
+{
+    ScopedLock sl(&m_lock);
+    m_read_idx = 0;
+    m_write_idx = 0;
+    m_count = 0;
+    m_reserved = 0;
+}
+
+template<typename T, typename LOCK, typename EVENT_FLAG>
+int RecordRingT<T, LOCK, EVENT_FLAG>::set_watermark(size_t threshold_records)
+{
+    m_watermark_records = threshold_records;
+    return 0;
+}
+
+template<typename T, typename LOCK, typename EVENT_FLAG>
+size_t RecordRingT<T, LOCK, EVENT_FLAG>::free() const
+{
+    ScopedLock sl(&m_lock);
+    return m_capacity - m_count;
+}
+
+template<typename T, typename LOCK, typename EVENT_FLAG>
+size_t RecordRingT<T, LOCK, EVENT_FLAG>::size() const
+{
+    ScopedLock sl(&m_lock);
+    return m_count;
+}
+
+template<typename T, typename LOCK, typename EVENT_FLAG>
+void RecordRingT<T, LOCK, EVENT_FLAG>::publish(size_t count)
+{
+    bool signal = false;
+    {
+        ScopedLock sl(&m_lock);
+        m_write_idx = (m_write_idx + count) % m_capacity;
+        m_count += count;
+        signal = m_count >= m_watermark_records;
+    }
+    if (signal) {
+        // notfiy readers on watermark
+        m_watermark_event.set();
+    }
+}
+
+template<typename T, typename LOCK, typename EVENT_FLAG>
+int RecordRingT<T, LOCK, EVENT_FLAG>::push(const T& record)
+{
+    return push_n(&record, 1);
+}
+
+template<typename T, typename LOCK, typename EVENT_FLAG>
+int RecordRingT<T, LOCK, EVENT_FLAG>::push_n(const T* records, size_t count)
+{
+    size_t write_idx = 0;
+    {
+        ScopedLock sl(&m_lock);
+        if (count == 0 || m_capacity - m_count < count) {
+            // ring is full. Notify any waiting readers to do their job...
+            m_watermark_event.set();
+            return -1;
+        }
+        write_idx = m_write_idx;
+    }
+    // the slots are ours until published, copy without holding the lock
+    size_t append_count = std::min<size_t>(count, m_capacity - write_idx);
+    memcpy(m_records + write_idx, records, append_count*sizeof(T));
+    if (count > append_count) {
+        memcpy(m_records, records + append_count, (count - append_count)*sizeof(T));
+    }
+    publish(count);
+    return 0;
+}
+
+template<typename T, typename LOCK, typename EVENT_FLAG>
+int RecordRingT<T, LOCK, EVENT_FLAG>::reserve_push_n(T** records, size_t max_count, size_t* count)
+{
+    ScopedLock sl(&m_lock);
+    // contiguous free slots: until the end or until the read index
+    size_t contiguous = m_capacity - m_count;
+    if (m_write_idx >= m_read_idx) {
+        contiguous = std::min<size_t>(contiguous, m_capacity - m_write_idx);
+    }
+    *count = std::min<size_t>(contiguous, max_count);
+    *records = m_records + m_write_idx;
+    m_reserved = *count;
+    if (*count == 0) {
+        m_watermark_event.set();
+        return -1;
+    }
+    return 0;
+}
+
+template<typename T, typename LOCK, typename EVENT_FLAG>
+int RecordRingT<T, LOCK, EVENT_FLAG>::commit_push(size_t count)
+{
+    {
+        ScopedLock sl(&m_lock);
+        if (count > m_reserved) {
+            return -1;
+        }
+        m_reserved = 0;
+    }
+    if (count > 0) {
+        publish(count);
+    }
+    return 0;
+}
+
+template<typename T, typename LOCK, typename EVENT_FLAG>
+int RecordRingT<T, LOCK, EVENT_FLAG>::request_pop_n(const T** records, size_t max_count, size_t* count, uint32_t timeout_ms)
+{
+    // if we use timeouts, we wait until the watermark is reached. If it is not, my might read whatever is present
+    if (timeout_ms > 0 && m_watermark_event.wait_for(timeout_ms) != 0) {
+        if (size() == 0) {
+            *count = 0;
+            return -1; // timed out, no records to read
+        }
+    }
+    ScopedLock sl(&m_lock);
+    // hand out the records until the end
+    *count = std::min<size_t>(std::min<size_t>(m_count, m_capacity - m_read_idx), max_count);
+    *records = m_records + m_read_idx;
+    return *count > 0 ? 0 : -1;
+}
+
+template<typename T, typename LOCK, typename EVENT_FLAG>
+int RecordRingT<T, LOCK, EVENT_FLAG>::commit_pop(size_t count)
+{
+    ScopedLock sl(&m_lock);
+    if (count > m_count) {
+        return -1;
+    }
+    m_read_idx = (m_read_idx + count) % m_capacity;
+    m_count -= count;
+    return 0;
+}
+
+template<typename T, typename LOCK, typename EVENT_FLAG>
+int RecordRingT<T, LOCK, EVENT_FLAG>::pop_n(T* records, size_t max_count, size_t* count, uint32_t timeout_ms)
+{
+    *count = 0;
+    const T* span = NULL;
+    size_t span_count = 0;
+    // at most two spans, before and after the wrap point
+    while (*count < max_count && 0 == request_pop_n(&span, max_count - *count, &span_count, *count == 0 ? timeout_ms : 0)) {
+        memcpy(records + *count, span, span_count*sizeof(T));
+        commit_pop(span_count);
+        *count += span_count;
+    }
+    return *count > 0 ? 0 : -1;
+}
+
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#ifdef __linux__
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+namespace motesque
+{
+
+/* Storage policies for the ring buffers (SequentialBufferT, SpscSequentialBufferT).
+ * A policy owns the memory and tells the buffer whether the memory is mirrored, i.e. whether
+ * data()[size() + i] aliases data()[i]. On a mirrored storage any region of up to size() bytes starting
+ * inside the ring is contiguous, so neither reads nor writes have to be split at the wrap point. */
+
+// plain heap memory, works on every target
+class HeapRingStorage
+{
+    HeapRingStorage(const HeapRingStorage& rhs);
+    HeapRingStorage& operator=(const HeapRingStorage& rhs);
+public:
+    HeapRingStorage(size_t size)
+    : m_data(new uint8_t[size]),
+      m_size(size)
+    {
+    }
+    ~HeapRingStorage()
+    {
+        delete[] m_data;
+    }
+    uint8_t* data() const {
+        return m_data;
+    }
+    size_t size() const {
+        return m_size;
+    }
+    bool is_mirrored() const {
+        return false;
+    }
+private:
+    uint8_t* m_data;
+    size_t   m_size;
+};
+
+#ifdef __linux__
+// Maps the same pages twice back-to-back in virtual memory. Requires an MMU, hence linux hosts only.
+// The size is rounded up to a multiple of the page size. If the mapping cannot be established
+// we fall back to heap memory and is_mirrored() returns false.
+class MirroredRingStorage
+{
+    MirroredRingStorage(const MirroredRingStorage& rhs);
+    MirroredRingStorage& operator=(const MirroredRingStorage& rhs);
+public:
+    MirroredRingStorage(size_t size)
+    : m_data(NULL),
+      m_size(0),
+      m_mirrored(false)
+    {
+        const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+        size_t mapped_size = ((size + page_size - 1) / page_size) * page_size;
+        if (mapped_size > 0 && 0 == map(mapped_size)) {
+            m_size = mapped_size;
+            m_mirrored = true;
+        }
+        else {
+            m_data = new uint8_t[size];
+            m_size = size;
+        }
+    }
+    ~MirroredRingStorage()
+    {
+        if (m_mirrored) {
+            munmap(m_data, 2*m_size);
+        }
+        else {
+            delete[] m_data;
+        }
+    }
+    uint8_t* data() const {
+        return m_data;
+    }
+    size_t size() const {
+        return m_size;
+    }
+    bool is_mirrored() const {
+        return m_mirrored;
+    }
+private:
+    int map(size_t size) {
+#ifdef SYS_memfd_create
+        int fd = (int)syscall(SYS_memfd_create, "motesque_ring", 0);
+        if (fd < 0) {
+            return -1;
+        }
+        if (0 != ftruncate(fd, (off_t)size)) {
+            close(fd);
+            return -1;
+        }
+        // reserve the address range for both copies, then map the file twice into it
+        void* reserved = mmap(NULL, 2*size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (reserved == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        uint8_t* base = (uint8_t*)reserved;
+        if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+            mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            munmap(reserved, 2*size);
+            close(fd);
+            return -1;
+        }
+        // the mappings keep the memory alive
+        close(fd);
+        m_data = base;
+        return 0;
+#else
+        (void)size;
+        return -1;
+#endif
+    }
+
+    uint8_t* m_data;
+    size_t   m_size;
+    bool     m_mirrored;
+};
+#endif
+
+}
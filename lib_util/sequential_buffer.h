@@ -4,12 +4,34 @@
 #include <iterator>     // std::distance
 //https://en.cppreference.com/w/cpp/atomic/memory_order
 #include <string.h>
+#include "ring_storage.h"
 namespace motesque
 {
 
+extern uint32_t nowMs();
+
+// What write does when the data does not fit
+enum OverflowPolicy {
+    OverflowPolicy_Reject,      // the write fails, the newest data is lost
+    OverflowPolicy_DropOldest   // whole records (one per write) are dropped from the front to make room
+};
+
+// Counters to size buffers from field data
+struct SequentialBufferStats {
+    uint64_t dropped_bytes;     // bytes of the records dropped by OverflowPolicy_DropOldest
+    uint32_t dropped_records;   // records dropped by OverflowPolicy_DropOldest
+    uint64_t rejected_bytes;    // bytes of the writes which failed because the data did not fit
+    uint32_t rejected_writes;   // writes which failed because the data did not fit
+    size_t   high_water_mark;   // the maximum amount of data stored
+    uint32_t full_count;        // how often the buffer ran full
+    uint32_t time_full_ms;      // time between running full and the reader making room again
+};
+
 /* A thread safe single producer, single consumer byte buffer. The main feature are indempotent reads to work
- * well with tcp / sd card writes and a signalling mechanism to wait for new data. */
-template<typename LOCK, typename EVENT_FLAG>
+ * well with tcp / sd card writes and a signalling mechanism to wait for new data.
+ * With a mirrored STORAGE (see ring_storage.h) writes are a single memcpy and request_read hands out all stored
+ * data at once, instead of stopping at the wrap point. */
+template<typename LOCK, typename EVENT_FLAG, typename STORAGE = HeapRingStorage>
 class SequentialBufferT
 {
     SequentialBufferT(const SequentialBufferT& rhs);
@@ -36,6 +58,13 @@ public:
     void clear();
     // write data to buffer. Fails if not enough space is available to write all the data
     int write(const uint8_t* data, size_t data_size);
+    // write data to buffer, waits up to timeout milliseconds for the reader to make enough space
+    int write(const uint8_t* data, size_t data_size, uint32_t timeout_ms);
+    // get a write pointer to |size| contiguous free bytes, e.g. to serialize a message in place.
+    // Fails if the free space is not contiguous (use a mirrored STORAGE to avoid that)
+    int reserve_write(size_t size, uint8_t** data);
+    // publish |size| bytes of the reserved region. Fires the watermark event like write
+    int commit_write(size_t size);
     // get a read pointer to the underlying data. Optionally waits for reached watermark timeout milliseconds
     int request_read(const uint8_t** data, size_t* available_size, uint32_t timeout_ms);
     // advance the read cursor
@@ -46,77 +75,323 @@ public:
     size_t size() const;
     // watermark for signalling mechanism
     int set_watermark(size_t threshold_bytes);
+    // free space at which waiting writers are woken up, so they can write in batches instead of per commit_read
+    int set_low_watermark(size_t threshold_bytes);
+    // OverflowPolicy_DropOldest needs to remember the size of up to |max_records| records.
+    // Records handed out by request_read and not committed yet are never dropped, the ones behind them are instead.
+    // A write is only rejected if what the reader holds leaves too little room.
+    int set_overflow_policy(OverflowPolicy policy, size_t max_records);
+    // drop, full and fill level statistics
+    void get_stats(SequentialBufferStats* stats) const;
+    void reset_stats();
 private:
+    // the record bookkeeping for OverflowPolicy_DropOldest. Must be called with the lock held. With |contiguous| the
+    // room must be in one piece from the write cursor, as reserve_write needs it
+    bool make_room(size_t data_size, bool contiguous);
+    // the room for a write with the cursors at |read_ptr| and |write_ptr| and |free_bytes| free
+    size_t room(const uint8_t* read_ptr, const uint8_t* write_ptr, size_t free_bytes, bool contiguous) const;
+    // moves |move_size| bytes from offset |src| to the offset |dst| before it, both may wrap around
+    void move_data(size_t dst, size_t src, size_t move_size);
+    void push_record(size_t record_size);
+    // a write of |data_size| bytes was rejected or a record of |data_size| bytes dropped
+    void account_overflow(size_t data_size, bool rejected);
+
+    STORAGE  m_storage;
     uint8_t* const m_data;
     uint8_t* const m_data_end;
     uint8_t* m_read_ptr;
     uint8_t* m_write_ptr;
     size_t   m_free;
-    LOCK     m_lock;
+    size_t   m_reserved;
+    mutable LOCK m_lock;
     EVENT_FLAG m_watermark_event;
     size_t   m_watermark_bytes;
+    EVENT_FLAG m_space_event;
+    size_t   m_low_watermark_bytes;
+    size_t   m_space_wanted;     // the size a blocked writer waits for
+    OverflowPolicy m_overflow_policy;
+    uint32_t* m_records;         // ring of record sizes, oldest at m_record_head
+    size_t   m_max_records;
+    size_t   m_record_head;
+    size_t   m_record_count;
+    size_t   m_record_offset;    // bytes of the oldest record the reader already committed
+    size_t   m_pinned;           // bytes handed out by request_read and not committed yet
+    bool     m_full;
+    uint32_t m_full_since_ms;
+    SequentialBufferStats m_stats;
 };
 
-template<typename LOCK, typename EVENT_FLAG>
-SequentialBufferT<LOCK, EVENT_FLAG>::SequentialBufferT(size_t size)
-: m_data(new uint8_t[size]),
-  m_data_end(m_data+ size),
+template<typename LOCK, typename EVENT_FLAG, typename STORAGE>
+SequentialBufferT<LOCK, EVENT_FLAG, STORAGE>::SequentialBufferT(size_t size)
+: m_storage(size),
+  m_data(m_storage.data()),
+  m_data_end(m_data + m_storage.size()),
   m_read_ptr(m_data),
   m_write_ptr(m_data),
   m_free(0),
+  m_reserved(0),
   m_lock(),
-  m_watermark_bytes(1)
+  m_watermark_bytes(1),
+  m_low_watermark_bytes(1),
+  m_space_wanted(0),
+  m_overflow_policy(OverflowPolicy_Reject),
+  m_records(NULL),
+  m_max_records(0),
+  m_record_head(0),
+  m_record_count(0),
+  m_record_offset(0),
+  m_pinned(0),
+  m_full(false),
+  m_full_since_ms(0),
+  m_stats()
 {
     clear();
+    reset_stats();
 }
 
-template<typename LOCK, typename EVENT_FLAG>
-SequentialBufferT<LOCK, EVENT_FLAG>::~SequentialBufferT()
+template<typename LOCK, typename EVENT_FLAG, typename STORAGE>
+SequentialBufferT<LOCK, EVENT_FLAG, STORAGE>::~SequentialBufferT()
 {
-    delete[] m_data;
+    delete[] m_records;
 }
 
 
-template<typename LOCK, typename EVENT_FLAG>
-int SequentialBufferT<LOCK, EVENT_FLAG>::set_watermark(size_t mark_bytes)
+template<typename LOCK, typename EVENT_FLAG, typename STORAGE>
+int SequentialBufferT<LOCK, EVENT_FLAG, STORAGE>::set_watermark(size_t mark_bytes)
 {
     m_watermark_bytes =  mark_bytes;
     return 0;
 }
 
-template<typename LOCK, typename EVENT_FLAG>
-size_t SequentialBufferT<LOCK, EVENT_FLAG>::free() const
+template<typename LOCK, typename EVENT_FLAG, typename STORAGE>
+int SequentialBufferT<LOCK, EVENT_FLAG, STORAGE>::set_low_watermark(size_t mark_bytes)
+{
+    m_low_watermark_bytes = mark_bytes;
+    return 0;
+}
+
+template<typename LOCK, typename EVENT_FLAG, typename STORAGE>
+size_t SequentialBufferT<LOCK, EVENT_FLAG, STORAGE>::free() const
 {
     return m_free;
 }
 
-template<typename LOCK, typename EVENT_FLAG>
-size_t SequentialBufferT<LOCK, EVENT_FLAG>::size() const
+template<typename LOCK, typename EVENT_FLAG, typename STORAGE>
+size_t SequentialBufferT<LOCK, EVENT_FLAG, STORAGE>::size() const
 {
     assert((size_t)std::distance(m_data, m_data_end) >= m_free);
     return (size_t)std::distance(m_data, m_data_end)  - m_free;
 }
 
-template<typename LOCK, typename EVENT_FLAG>
-void SequentialBufferT<LOCK, EVENT_FLAG>::clear()
+template<typename LOCK, typename EVENT_FLAG, typename STORAGE>
+void SequentialBufferT<LOCK, EVENT_FLAG, STORAGE>::clear()
 {
     ScopedLock sl(&m_lock);
     m_read_ptr  = m_data;
     m_write_ptr = m_data;
     m_free = std::distance(m_data, m_data_end);
+    m_reserved = 0;
+    m_record_head = 0;
+    m_record_count = 0;
+    m_record_offset = 0;
+    m_pinned = 0;
 }
 
-template<typename LOCK, typename EVENT_FLAG>
-int SequentialBufferT<LOCK, EVENT_FLAG>::write(const uint8_t* data, size_t data_size)
+template<typename LOCK, typename EVENT_FLAG, typename STORAGE>
+int SequentialBufferT<LOCK, EVENT_FLAG, STORAGE>::set_overflow_policy(OverflowPolicy policy, size_t max_records)
 {
-    if ( data_size == 0 || ( m_free < data_size ) ) {
-        // buffer is full. Notify any waiting readers to do their job...
+    if (policy == OverflowPolicy_DropOldest && max_records == 0) {
+        return -1;
+    }
+    ScopedLock sl(&m_lock);
+    if (size() > 0) {
+        // we do not know the record boundaries of what is already stored
+        return -1;
+    }
+    delete[] m_records;
+    m_records = NULL;
+    m_max_records = 0;
+    if (policy == OverflowPolicy_DropOldest) {
+        m_records = new uint32_t[max_records];
+        m_max_records = max_records;
+    }
+    m_record_head = 0;
+    m_record_count = 0;
+    m_record_offset = 0;
+    m_overflow_policy = policy;
+    return 0;
+}
+
+template<typename LOCK, typename EVENT_FLAG, typename STORAGE>
+void SequentialBufferT<LOCK, EVENT_FLAG, STORAGE>::get_stats(SequentialBufferStats* stats) const
+{
+    ScopedLock sl(&m_lock);
+    *stats = m_stats;
+}
+
+template<typename LOCK, typename EVENT_FLAG, typename STORAGE>
+void SequentialBufferT<LOCK, EVENT_FLAG, STORAGE>::reset_stats()
+{
+    ScopedLock sl(&m_lock);
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_stats.high_water_mark = size();
+    m_full = false;
+}
+
+template<typename LOCK, typename EVENT_FLAG, typename STORAGE>
+void SequentialBufferT<LOCK, EVENT_FLAG, STORAGE>::account_overflow(size_t data_size, bool rejected)
+{
+    if (rejected) {
+        m_stats.rejected_bytes += data_size;
+        m_stats.rejected_writes++;
+    }
+    else {
+        m_stats.dropped_bytes += data_size;
+        m_stats.dropped_records++;
+    }
+    if (!m_full) {
+        m_full = true;
+        m_full_since_ms = nowMs();
+        m_stats.full_count++;
+    }
+}
+
+template<typename LOCK, typename EVENT_FLAG, typename STORAGE>
+void SequentialBufferT<LOCK, EVENT_FLAG, STORAGE>::push_record(size_t record_size)
+{
+    if (m_records) {
+        assert(m_record_count < m_max_records);
+        m_records[(m_record_head + m_record_count) % m_max_records] = (uint32_t)record_size;
+        m_record_count++;
+    }
+    if (size() > m_stats.high_water_mark) {
+        m_stats.high_water_mark = size();
+    }
+}
+
+template<typename LOCK, typename EVENT_FLAG, typename STORAGE>
+size_t SequentialBufferT<LOCK, EVENT_FLAG, STORAGE>::room(const uint8_t* read_ptr, const uint8_t* write_ptr,
+                                                         size_t free_bytes, bool contiguous) const
+{
+    if (!contiguous || m_storage.is_mirrored() || free_bytes == (size_t)std::distance(m_data, m_data_end)) {
+        // an empty buffer starts over at the front
+        return free_bytes;
+    }
+    if (write_ptr >= read_ptr) {
+        // ------------------------#
+        //   |        |
+        //   r        w
+        return std::min<size_t>(free_bytes, std::distance(write_ptr, (const uint8_t*)m_data_end));
+    }
+    return free_bytes;
+}
+
+template<typename LOCK, typename EVENT_FLAG, typename STORAGE>
+void SequentialBufferT<LOCK, EVENT_FLAG, STORAGE>::move_data(size_t dst, size_t src, size_t move_size)
+{
+    // front to back in pieces which do not wrap. dst is before src, so nothing is overwritten before it was moved
+    const size_t capacity = std::distance(m_data, m_data_end);
+    while (move_size > 0) {
+        const size_t n = std::min<size_t>(move_size, std::min<size_t>(capacity - dst, capacity - src));
+        memmove(m_data + dst, m_data + src, n);
+        dst = (dst + n) % capacity;
+        src = (src + n) % capacity;
+        move_size -= n;
+    }
+}
+
+template<typename LOCK, typename EVENT_FLAG, typename STORAGE>
+bool SequentialBufferT<LOCK, EVENT_FLAG, STORAGE>::make_room(size_t data_size, bool contiguous)
+{
+    if (room(m_read_ptr, m_write_ptr, m_free, contiguous) >= data_size &&
+        (m_records == NULL || m_record_count < m_max_records)) {
+        return true;
+    }
+    if (m_overflow_policy != OverflowPolicy_DropOldest) {
+        account_overflow(data_size, true);
+        return false;
+    }
+    // the records (partially) with the reader stay in front, we must not pull them away
+    size_t kept_records = 0;
+    size_t kept_bytes = 0;
+    while (kept_records < m_record_count && (kept_bytes < m_pinned || (kept_records == 0 && m_record_offset > 0))) {
+        kept_bytes += m_records[(m_record_head + kept_records) % m_max_records] - (kept_records == 0 ? m_record_offset : 0);
+        kept_records++;
+    }
+    // find out how many records behind them we need to drop, before dropping anything. Without kept records the read
+    // cursor moves, otherwise the newer records are moved down and the write cursor moves back
+    const size_t capacity = std::distance(m_data, m_data_end);
+    const uint8_t* read_ptr = m_read_ptr;
+    const uint8_t* write_ptr = m_write_ptr;
+    size_t free_bytes = m_free;
+    size_t drop_count = 0;
+    while ((room(read_ptr, write_ptr, free_bytes, contiguous) < data_size || m_record_count - drop_count >= m_max_records) &&
+           kept_records + drop_count < m_record_count) {
+        const size_t record_size = m_records[(m_record_head + kept_records + drop_count) % m_max_records];
+        if (kept_records == 0) {
+            read_ptr = m_data + (std::distance((const uint8_t*)m_data, read_ptr) + record_size) % capacity;
+        }
+        else {
+            write_ptr = m_data + (std::distance((const uint8_t*)m_data, write_ptr) + capacity - record_size) % capacity;
+        }
+        free_bytes += record_size;
+        drop_count++;
+    }
+    if (room(read_ptr, write_ptr, free_bytes, contiguous) < data_size ||
+        m_record_count - drop_count >= m_max_records) {
+        // also when all record slots are with the reader
+        account_overflow(data_size, true);
+        return false;
+    }
+    const size_t drop_bytes = free_bytes - m_free;
+    if (kept_records > 0) {
+        const size_t dst = (std::distance(m_data, m_read_ptr) + kept_bytes) % capacity;
+        const size_t tail_size = size() - kept_bytes - drop_bytes;
+        move_data(dst, (dst + drop_bytes) % capacity, tail_size);
+        m_write_ptr = m_data + (dst + tail_size) % capacity;
+    }
+    else {
+        m_read_ptr = m_data + (std::distance(m_data, m_read_ptr) + drop_bytes) % capacity;
+    }
+    m_free += drop_bytes;
+    for (size_t i=0; i < drop_count; i++) {
+        account_overflow(m_records[(m_record_head + kept_records + i) % m_max_records], false);
+    }
+    for (size_t i=kept_records; i + drop_count < m_record_count; i++) {
+        m_records[(m_record_head + i) % m_max_records] = m_records[(m_record_head + i + drop_count) % m_max_records];
+    }
+    m_record_count -= drop_count;
+    if (size() == 0) {
+        m_read_ptr  = m_data;
+        m_write_ptr = m_data;
+    }
+    return true;
+}
+
+template<typename LOCK, typename EVENT_FLAG, typename STORAGE>
+int SequentialBufferT<LOCK, EVENT_FLAG, STORAGE>::write(const uint8_t* data, size_t data_size)
+{
+    if ( data_size == 0 ) {
          m_watermark_event.set();
          return -1;
     }
     ScopedLock sl(&m_lock);
+    if (!make_room(data_size, false)) {
+        // buffer is full. Notify any waiting readers to do their job...
+         m_watermark_event.set();
+         return -1;
+    }
 
-    if (m_write_ptr >= m_read_ptr) {
+    if (m_storage.is_mirrored()) {
+        // the mirror makes the free space contiguous, wherever the cursors are
+        memcpy(m_write_ptr, data, data_size);
+        m_write_ptr += data_size;
+        if (m_write_ptr >= m_data_end) {
+            m_write_ptr -= std::distance(m_data, m_data_end);
+        }
+        m_free -= data_size;
+    }
+    else if (m_write_ptr >= m_read_ptr) {
         // ------------------------#
         //   |        |
         //   r        w
@@ -147,6 +422,7 @@ int SequentialBufferT<LOCK, EVENT_FLAG>::write(const uint8_t* data, size_t data_
         m_free -= data_size;
         m_write_ptr += data_size;
     }
+    push_record(data_size);
     if (size() >= m_watermark_bytes) {
         // notfiy readers on watermark
         m_watermark_event.set();
@@ -154,23 +430,137 @@ int SequentialBufferT<LOCK, EVENT_FLAG>::write(const uint8_t* data, size_t data_
     return 0;
 }
 
-template<typename LOCK, typename EVENT_FLAG>
-int SequentialBufferT<LOCK, EVENT_FLAG>::commit_read(size_t commit_size)
+template<typename LOCK, typename EVENT_FLAG, typename STORAGE>
+int SequentialBufferT<LOCK, EVENT_FLAG, STORAGE>::write(const uint8_t* data, size_t data_size, uint32_t timeout_ms)
+{
+    if (timeout_ms == 0 || m_overflow_policy == OverflowPolicy_DropOldest ||
+        data_size > (size_t)std::distance(m_data, m_data_end)) {
+        // nothing to wait for
+        return write(data, data_size);
+    }
+    const uint32_t start_ms = nowMs();
+    while (true) {
+        {
+            ScopedLock sl(&m_lock);
+            // clear before checking, a commit_read after the check sets the event again
+            m_space_event.clear();
+            if (m_free >= data_size) {
+                m_space_wanted = 0;
+                break;
+            }
+            m_space_wanted = data_size;
+        }
+        // make the reader do its job
+        m_watermark_event.set();
+        const uint32_t elapsed_ms = nowMs() - start_ms;
+        if (elapsed_ms >= timeout_ms || m_space_event.wait_for(timeout_ms - elapsed_ms) != 0) {
+            break;
+        }
+    }
+    {
+        ScopedLock sl(&m_lock);
+        m_space_wanted = 0;
+    }
+    // accounts for the overflow if we timed out
+    return write(data, data_size);
+}
+
+template<typename LOCK, typename EVENT_FLAG, typename STORAGE>
+int SequentialBufferT<LOCK, EVENT_FLAG, STORAGE>::reserve_write(size_t reserve_size, uint8_t** data)
+{
+    if ( reserve_size == 0 ) {
+        m_watermark_event.set();
+        return -1;
+    }
+    ScopedLock sl(&m_lock);
+    // also fails if the free space is split at the wrap point and no records may be dropped
+    if (!make_room(reserve_size, true)) {
+        // buffer is full. Notify any waiting readers to do their job...
+        m_watermark_event.set();
+        return -1;
+    }
+    if (!m_storage.is_mirrored() && size() == 0) {
+        // nothing is handed out to the reader, start over at the front to get the most contiguous space
+        m_read_ptr  = m_data;
+        m_write_ptr = m_data;
+    }
+    assert(room(m_read_ptr, m_write_ptr, m_free, true) >= reserve_size);
+    m_reserved = reserve_size;
+    *data = m_write_ptr;
+    return 0;
+}
+
+template<typename LOCK, typename EVENT_FLAG, typename STORAGE>
+int SequentialBufferT<LOCK, EVENT_FLAG, STORAGE>::commit_write(size_t commit_size)
+{
+    {
+        ScopedLock sl(&m_lock);
+        if (commit_size > m_reserved) {
+            return -1;
+        }
+        m_reserved = 0;
+        m_write_ptr += commit_size;
+        if (m_write_ptr >= m_data_end) {
+            m_write_ptr -= std::distance(m_data, m_data_end);
+        }
+        m_free -= commit_size;
+        if (commit_size > 0) {
+            push_record(commit_size);
+        }
+    }
+    if (commit_size > 0 && size() >= m_watermark_bytes) {
+        // notfiy readers on watermark
+        m_watermark_event.set();
+    }
+    return 0;
+}
+
+template<typename LOCK, typename EVENT_FLAG, typename STORAGE>
+int SequentialBufferT<LOCK, EVENT_FLAG, STORAGE>::commit_read(size_t commit_size)
 {
     ScopedLock sl(&m_lock);
     m_read_ptr += commit_size;
-    assert(m_read_ptr <= m_data_end);
-    if (m_read_ptr == m_data_end) {
-        m_read_ptr = m_data;
+    if (m_storage.is_mirrored()) {
+        assert(m_read_ptr < m_data_end + std::distance(m_data, m_data_end));
+        if (m_read_ptr >= m_data_end) {
+            m_read_ptr -= std::distance(m_data, m_data_end);
+        }
+    }
+    else {
+        assert(m_read_ptr <= m_data_end);
+        if (m_read_ptr == m_data_end) {
+            m_read_ptr = m_data;
+        }
     }
     m_free += commit_size;
-
+    m_pinned = commit_size < m_pinned ? m_pinned - commit_size : 0;
+    // consume the record sizes
+    size_t remaining = commit_size;
+    while (m_records && remaining > 0 && m_record_count > 0) {
+        const size_t record_rest = m_records[m_record_head] - m_record_offset;
+        if (remaining < record_rest) {
+            m_record_offset += remaining;
+            break;
+        }
+        remaining -= record_rest;
+        m_record_offset = 0;
+        m_record_head = (m_record_head + 1) % m_max_records;
+        m_record_count--;
+    }
+    if (m_full && commit_size > 0) {
+        m_full = false;
+        m_stats.time_full_ms += nowMs() - m_full_since_ms;
+    }
+    if (m_space_wanted > 0 && m_free >= std::max<size_t>(m_space_wanted, m_low_watermark_bytes)) {
+        // wake up the blocked writer
+        m_space_event.set();
+    }
     return 0;
 }
 
 
-template<typename LOCK, typename EVENT_FLAG>
-int SequentialBufferT<LOCK, EVENT_FLAG>::request_read(const uint8_t** data, size_t* available_size, uint32_t timeout_ms)
+template<typename LOCK, typename EVENT_FLAG, typename STORAGE>
+int SequentialBufferT<LOCK, EVENT_FLAG, STORAGE>::request_read(const uint8_t** data, size_t* available_size, uint32_t timeout_ms)
 {
 
     // if we use timeouts, we wait until the watermark is reached. If it is not, my might read whatever is present
@@ -181,7 +571,11 @@ int SequentialBufferT<LOCK, EVENT_FLAG>::request_read(const uint8_t** data, size
     }
 
     ScopedLock sl(&m_lock);
-    if (m_read_ptr < m_write_ptr) {
+    if (m_storage.is_mirrored()) {
+        // everything stored is contiguous
+        *available_size = size();
+    }
+    else if (m_read_ptr < m_write_ptr) {
         // ------------------------#
         //   |        |
         //   r        w
@@ -207,6 +601,7 @@ int SequentialBufferT<LOCK, EVENT_FLAG>::request_read(const uint8_t** data, size
         }
     }
     *data = m_read_ptr;
+    m_pinned = *available_size;
 
     return *available_size > 0 ? 0 : -1;
 }
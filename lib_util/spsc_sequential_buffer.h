@@ -0,0 +1,181 @@
+#pragma once
+#include <atomic>
+#include <cassert>
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+#include "ring_storage.h"
+namespace motesque
+{
+
+/* A lock free single producer, single consumer byte buffer with the same interface as SequentialBufferT.
+ * The producer owns the write cursor, the consumer owns the read cursor; each is published with release semantics
+ * and observed by the other side with acquire semantics, so no mutex is needed on the data path.
+ * Both cursors run in [0, 2*capacity) which lets us tell a full from an empty buffer without an extra counter.
+ * write() may only be called from one thread, request_read()/commit_read() only from one (other) thread.
+ * As with SequentialBufferT, a mirrored STORAGE removes the split at the wrap point. */
+template<typename EVENT_FLAG, typename STORAGE = HeapRingStorage>
+class SpscSequentialBufferT
+{
+    SpscSequentialBufferT(const SpscSequentialBufferT& rhs);
+    SpscSequentialBufferT& operator=(const SpscSequentialBufferT& rhs);
+
+    enum { kCacheLineSize = 64 };
+
+public:
+    SpscSequentialBufferT(size_t size);
+    virtual ~SpscSequentialBufferT();
+    // clear the buffer. Must not be called while a producer or consumer is active
+    void clear();
+    // write data to buffer. Fails if not enough space is available to write all the data
+    int write(const uint8_t* data, size_t data_size);
+    // get a read pointer to the underlying data. Optionally waits for reached watermark timeout milliseconds
+    int request_read(const uint8_t** data, size_t* available_size, uint32_t timeout_ms);
+    // advance the read cursor
+    int commit_read(size_t size);
+    // the amount of data available for writes
+    size_t free() const;
+    // the amount of data stored
+    size_t size() const;
+    // watermark for signalling mechanism
+    int set_watermark(size_t threshold_bytes);
+private:
+    size_t used(size_t read_pos, size_t write_pos) const {
+        return write_pos >= read_pos ? write_pos - read_pos : write_pos + 2*m_capacity - read_pos;
+    }
+    size_t advance(size_t pos, size_t n) const {
+        pos += n;
+        return pos >= 2*m_capacity ? pos - 2*m_capacity : pos;
+    }
+    uint8_t* pointer(size_t pos) const {
+        return m_data + (pos >= m_capacity ? pos - m_capacity : pos);
+    }
+
+    STORAGE        m_storage;
+    uint8_t* const m_data;
+    const size_t   m_capacity;
+    size_t         m_watermark_bytes;
+    // keep the cursors on separate cache lines, otherwise producer and consumer keep stealing the line from each other
+    uint8_t             m_pad0[kCacheLineSize];
+    std::atomic<size_t> m_write_pos;   // written by the producer only
+    uint8_t             m_pad1[kCacheLineSize - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_read_pos;    // written by the consumer only
+    uint8_t             m_pad2[kCacheLineSize - sizeof(std::atomic<size_t>)];
+    EVENT_FLAG          m_watermark_event;
+};
+
+template<typename EVENT_FLAG, typename STORAGE>
+SpscSequentialBufferT<EVENT_FLAG, STORAGE>::SpscSequentialBufferT(size_t size)
+: m_storage(size),
+  m_data(m_storage.data()),
+  m_capacity(m_storage.size()),
+  m_watermark_bytes(1),
+  m_write_pos(0),
+  m_read_pos(0)
+{
+    clear();
+}
+
+template<typename EVENT_FLAG, typename STORAGE>
+SpscSequentialBufferT<EVENT_FLAG, STORAGE>::~SpscSequentialBufferT()
+{
+}
+
+template<typename EVENT_FLAG, typename STORAGE>
+int SpscSequentialBufferT<EVENT_FLAG, STORAGE>::set_watermark(size_t mark_bytes)
+{
+    m_watermark_bytes = mark_bytes;
+    return 0;
+}
+
+template<typename EVENT_FLAG, typename STORAGE>
+size_t SpscSequentialBufferT<EVENT_FLAG, STORAGE>::free() const
+{
+    return m_capacity - size();
+}
+
+template<typename EVENT_FLAG, typename STORAGE>
+size_t SpscSequentialBufferT<EVENT_FLAG, STORAGE>::size() const
+{
+    return used(m_read_pos.load(std::memory_order_acquire), m_write_pos.load(std::memory_order_acquire));
+}
+
+template<typename EVENT_FLAG, typename STORAGE>
+void SpscSequentialBufferT<EVENT_FLAG, STORAGE>::clear()
+{
+    m_read_pos.store(0, std::memory_order_relaxed);
+    m_write_pos.store(0, std::memory_order_release);
+}
+
+template<typename EVENT_FLAG, typename STORAGE>
+int SpscSequentialBufferT<EVENT_FLAG, STORAGE>::write(const uint8_t* data, size_t data_size)
+{
+    const size_t write_pos = m_write_pos.load(std::memory_order_relaxed);
+    // acquire: the consumer must be done with the bytes before we overwrite them
+    const size_t read_pos  = m_read_pos.load(std::memory_order_acquire);
+    const size_t stored    = used(read_pos, write_pos);
+    if ( data_size == 0 || ( m_capacity - stored < data_size ) ) {
+        // buffer is full. Notify any waiting readers to do their job...
+        m_watermark_event.set();
+        return -1;
+    }
+    uint8_t* write_ptr = pointer(write_pos);
+    if (m_storage.is_mirrored()) {
+        // the mirror makes the free space contiguous
+        memcpy(write_ptr, data, data_size);
+    }
+    else {
+        // write the data until the end and maybe wrap around
+        size_t append_size = std::min<size_t>(data_size, m_data + m_capacity - write_ptr);
+        memcpy(write_ptr, data, append_size);
+        // write any rest to the front
+        if (data_size > append_size) {
+            memcpy(m_data, data + append_size, data_size - append_size);
+        }
+    }
+    // release: publish the bytes together with the cursor
+    m_write_pos.store(advance(write_pos, data_size), std::memory_order_release);
+
+    if (stored + data_size >= m_watermark_bytes) {
+        // notfiy readers on watermark
+        m_watermark_event.set();
+    }
+    return 0;
+}
+
+template<typename EVENT_FLAG, typename STORAGE>
+int SpscSequentialBufferT<EVENT_FLAG, STORAGE>::commit_read(size_t commit_size)
+{
+    const size_t read_pos = m_read_pos.load(std::memory_order_relaxed);
+    assert(commit_size <= used(read_pos, m_write_pos.load(std::memory_order_acquire)));
+    assert(m_storage.is_mirrored() || pointer(read_pos) + commit_size <= m_data + m_capacity);
+    // release: hand the bytes back to the producer only after we are done reading them
+    m_read_pos.store(advance(read_pos, commit_size), std::memory_order_release);
+    return 0;
+}
+
+template<typename EVENT_FLAG, typename STORAGE>
+int SpscSequentialBufferT<EVENT_FLAG, STORAGE>::request_read(const uint8_t** data, size_t* available_size, uint32_t timeout_ms)
+{
+    // if we use timeouts, we wait until the watermark is reached. If it is not, my might read whatever is present
+    if (timeout_ms > 0 && m_watermark_event.wait_for(timeout_ms) != 0) {
+        if (size() == 0) {
+            *available_size = 0;
+            return -1; // timed out, no data to read
+        }
+    }
+    const size_t read_pos  = m_read_pos.load(std::memory_order_relaxed);
+    // acquire: pairs with the release in write(), makes the written bytes visible
+    const size_t write_pos = m_write_pos.load(std::memory_order_acquire);
+    const uint8_t* read_ptr = pointer(read_pos);
+    // hand out the read pointer, at most until the end unless the storage is mirrored
+    *available_size = used(read_pos, write_pos);
+    if (!m_storage.is_mirrored()) {
+        *available_size = std::min<size_t>(*available_size, m_data + m_capacity - read_ptr);
+    }
+    *data = read_ptr;
+
+    return *available_size > 0 ? 0 : -1;
+}
+
+}
@@ -0,0 +1,161 @@
+#include "assert.h"
+#include "../../unittest/catch.hpp"
+#include <mutex>
+#include <atomic>
+#include "../broadcast_sequential_buffer.h"
+
+struct BroadcastTestStatus {
+    BroadcastTestStatus() : status(0) {}
+
+    void set() {
+        status = 1;
+    }
+    void clear() {
+        status = 0;
+    }
+    int wait_for(uint32_t timeout_ms) {
+        return status.exchange(0) == 1 ? 0 : -1;
+    }
+    std::atomic<int> status;
+};
+
+typedef motesque::BroadcastSequentialBufferT<std::mutex, BroadcastTestStatus, 2> BroadcastBuffer;
+using motesque::LagPolicy_Block;
+using motesque::LagPolicy_Skip;
+using motesque::LagPolicy_Detach;
+
+TEST_CASE( "broadcast attach readers") {
+    BroadcastBuffer sqb(100);
+    uint8_t data[10] = {0};
+    // data written before attaching is not delivered
+    REQUIRE(0 == sqb.write(data, sizeof(data)));
+    int sd = sqb.attach_reader(LagPolicy_Block);
+    int tcp = sqb.attach_reader(LagPolicy_Skip);
+    REQUIRE(sd == 0);
+    REQUIRE(tcp == 1);
+    REQUIRE(-1 == sqb.attach_reader(LagPolicy_Block));
+    REQUIRE(0 == sqb.size(sd));
+    REQUIRE(100 == sqb.free());
+    REQUIRE(0 == sqb.detach_reader(tcp));
+    REQUIRE(!sqb.is_attached(tcp));
+    REQUIRE(1 == sqb.attach_reader(LagPolicy_Block));
+}
+
+TEST_CASE( "broadcast readers advance independently") {
+    BroadcastBuffer sqb(100);
+    int sd = sqb.attach_reader(LagPolicy_Block);
+    int tcp = sqb.attach_reader(LagPolicy_Block);
+    uint8_t data[60];
+    for (size_t i=0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)i;
+    }
+    REQUIRE(0 == sqb.write(data, 60));
+    const uint8_t* read_ptr;
+    size_t available;
+    REQUIRE(0 == sqb.request_read(sd, &read_ptr, &available, 0));
+    REQUIRE(60 == available);
+    REQUIRE(0 == sqb.commit_read(sd, 60));
+    // the slowest reader bounds the free space
+    REQUIRE(40 == sqb.free());
+    REQUIRE(-1 == sqb.write(data, 60));
+    REQUIRE(0 == sqb.request_read(tcp, &read_ptr, &available, 0));
+    REQUIRE(60 == available);
+    REQUIRE(59 == read_ptr[59]);
+    REQUIRE(0 == sqb.commit_read(tcp, 30));
+    REQUIRE(70 == sqb.free());
+    // wraps around
+    REQUIRE(0 == sqb.write(data, 60));
+    REQUIRE(0 == sqb.request_read(sd, &read_ptr, &available, 0));
+    REQUIRE(40 == available);
+    REQUIRE(0 == sqb.commit_read(sd, 40));
+    REQUIRE(0 == sqb.request_read(sd, &read_ptr, &available, 0));
+    REQUIRE(20 == available);
+    REQUIRE(59 == read_ptr[19]);
+    REQUIRE(0 == sqb.commit_read(sd, 20));
+    REQUIRE(90 == sqb.size(tcp));
+}
+
+TEST_CASE( "broadcast lagging reader is skipped") {
+    BroadcastBuffer sqb(100);
+    int sd = sqb.attach_reader(LagPolicy_Block);
+    int tcp = sqb.attach_reader(LagPolicy_Skip);
+    uint8_t data[80] = {0};
+    const uint8_t* read_ptr;
+    const uint8_t* tcp_ptr;
+    size_t available;
+    REQUIRE(0 == sqb.write(data, 60));
+    REQUIRE(0 == sqb.request_read(tcp, &tcp_ptr, &available, 0));
+    REQUIRE(0 == sqb.request_read(sd, &read_ptr, &available, 0));
+    REQUIRE(0 == sqb.commit_read(sd, 60));
+    // the tcp reader is still sending what it got, the write must not tear it
+    data[0] = 0xfe;
+    REQUIRE(-1 == sqb.write(data, 60));
+    REQUIRE(0 == tcp_ptr[0]);
+    REQUIRE(0 == sqb.lost_bytes(tcp));
+    REQUIRE(0 == sqb.commit_read(tcp, 60));
+    REQUIRE(0 == sqb.write(data, 30));
+    REQUIRE(0 == sqb.request_read(sd, &read_ptr, &available, 0));
+    REQUIRE(0 == sqb.commit_read(sd, 30));
+    // the tcp reader did not keep up, it loses its 30 bytes, recording goes on
+    data[0] = 0xfd;
+    REQUIRE(0 == sqb.write(data, 80));
+    REQUIRE(30 == sqb.lost_bytes(tcp));
+    REQUIRE(0 == sqb.request_read(tcp, &read_ptr, &available, 0));
+    REQUIRE(10 == available);
+    REQUIRE(0xfd == read_ptr[0]);
+    REQUIRE(0 == sqb.commit_read(tcp, 10));
+    REQUIRE(70 == sqb.size(tcp));
+    REQUIRE(80 == sqb.size(sd));
+}
+
+TEST_CASE( "broadcast lagging reader is detached") {
+    BroadcastBuffer sqb(100);
+    int sd = sqb.attach_reader(LagPolicy_Block);
+    int tcp = sqb.attach_reader(LagPolicy_Detach);
+    uint8_t data[60] = {0};
+    const uint8_t* read_ptr;
+    size_t available;
+    REQUIRE(0 == sqb.write(data, 60));
+    REQUIRE(0 == sqb.request_read(sd, &read_ptr, &available, 0));
+    REQUIRE(0 == sqb.commit_read(sd, 60));
+    REQUIRE(0 == sqb.write(data, 60));
+    REQUIRE(!sqb.is_attached(tcp));
+    REQUIRE(-1 == sqb.request_read(tcp, &read_ptr, &available, 0));
+    REQUIRE(0 == available);
+    REQUIRE(sqb.is_attached(sd));
+    // a reader is not detached while it reads
+    tcp = sqb.attach_reader(LagPolicy_Detach);
+    REQUIRE(0 == sqb.request_read(sd, &read_ptr, &available, 0));
+    REQUIRE(0 == sqb.commit_read(sd, available));
+    REQUIRE(0 == sqb.request_read(sd, &read_ptr, &available, 0));
+    REQUIRE(0 == sqb.commit_read(sd, available));
+    REQUIRE(0 == sqb.write(data, 60));
+    REQUIRE(0 == sqb.request_read(tcp, &read_ptr, &available, 0));
+    REQUIRE(60 == available);
+    REQUIRE(0 == sqb.request_read(sd, &read_ptr, &available, 0));
+    REQUIRE(0 == sqb.commit_read(sd, 60));
+    REQUIRE(40 == sqb.free());
+    REQUIRE(-1 == sqb.write(data, 60));
+    REQUIRE(sqb.is_attached(tcp));
+    REQUIRE(0 == sqb.commit_read(tcp, 60));
+    REQUIRE(0 == sqb.write(data, 60));
+}
+
+TEST_CASE( "broadcast watermark per reader") {
+    BroadcastBuffer sqb(100);
+    sqb.set_watermark(20);
+    int sd = sqb.attach_reader(LagPolicy_Block);
+    uint8_t data[10] = {0};
+    const uint8_t* read_ptr;
+    size_t available;
+    REQUIRE(0 == sqb.write(data, 10));
+    // below the watermark, times out but hands out what is there
+    REQUIRE(0 == sqb.request_read(sd, &read_ptr, &available, 10));
+    REQUIRE(10 == available);
+    REQUIRE(0 == sqb.write(data, 10));
+    int tcp = sqb.attach_reader(LagPolicy_Skip);
+    // nothing for the new reader yet
+    REQUIRE(-1 == sqb.request_read(tcp, &read_ptr, &available, 10));
+    REQUIRE(0 == sqb.request_read(sd, &read_ptr, &available, 10));
+    REQUIRE(20 == available);
+}
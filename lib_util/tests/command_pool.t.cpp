@@ -0,0 +1,173 @@
+#include "assert.h"
+#include "../../unittest/catch.hpp"
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <mutex>
+#include <iostream>
+#include "../futex.h"
+#include "../command_pool.h"
+
+using namespace motesque;
+
+typedef CommandPool<FutexLock, FutexEventFlag, 64, 4> TestCommandPool;
+
+// runs the worker threads of a pool until destroyed
+struct PoolRunner {
+    PoolRunner(TestCommandPool& pool) : should_process(true) {
+        for (int i=0; i < 4; i++) {
+            threads.push_back(std::thread([this, &pool, i]() {
+                while (should_process) {
+                    pool.process(i, 10);
+                }
+            }));
+        }
+    }
+    ~PoolRunner() {
+        should_process = false;
+        for (size_t i=0; i < threads.size(); i++) {
+            threads[i].join();
+        }
+    }
+    std::atomic<bool> should_process;
+    std::vector<std::thread> threads;
+};
+
+TEST_CASE( "command pool executes on all workers") {
+    TestCommandPool pool;
+    std::atomic<int> counter(0);
+    auto f = [&counter]() {
+        counter++;
+    };
+    {
+        PoolRunner runner(pool);
+        for (int i=0; i < 10000; i++) {
+            while (pool.execute_async(f) != 0) {
+                std::this_thread::yield();
+            }
+        }
+        // waits until the function ran
+        REQUIRE(0 == pool.execute_async(f, true));
+        while (counter < 10001) {
+            std::this_thread::yield();
+        }
+    }
+    REQUIRE(counter == 10001);
+}
+
+TEST_CASE( "command pool steals from a blocked worker") {
+    TestCommandPool pool;
+    std::atomic<int> started(0);
+    std::atomic<int> done(0);
+    std::atomic<bool> release_slow(false);
+    // two commands per worker, the first command to run blocks its worker.
+    // The other command of that worker only completes if it gets stolen
+    for (int i=0; i < 8; i++) {
+        REQUIRE(0 == pool.execute_async([&]() {
+            if (started++ == 0) {
+                while (!release_slow) {
+                    std::this_thread::yield();
+                }
+            }
+            done++;
+        }));
+    }
+    PoolRunner runner(pool);
+    auto start = std::chrono::steady_clock::now();
+    while (done < 7 && std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+        std::this_thread::yield();
+    }
+    REQUIRE(done == 7);
+    release_slow = true;
+    while (done < 8) {
+        std::this_thread::yield();
+    }
+}
+
+TEST_CASE( "command pool keeps serial keys in order") {
+    TestCommandPool pool;
+    std::vector<int> sequence;
+    std::atomic<int> done(0);
+    const int kNumCommands = 5000;
+    {
+        PoolRunner runner(pool);
+        for (int i=0; i < kNumCommands; i++) {
+            // no lock needed, all commands with key 7 run on the same worker one after another
+            while (pool.execute_async([&sequence, &done, i]() { sequence.push_back(i); done++; }, false, 7) != 0) {
+                std::this_thread::yield();
+            }
+            // noise for the other workers
+            pool.execute_async([]() {});
+        }
+        while (done < kNumCommands) {
+            std::this_thread::yield();
+        }
+    }
+    REQUIRE(sequence.size() == (size_t)kNumCommands);
+    bool in_order = true;
+    for (int i=0; i < kNumCommands; i++) {
+        in_order = in_order && sequence[i] == i;
+    }
+    REQUIRE(in_order);
+}
+
+TEST_CASE( "command pool timers and cancel") {
+    TestCommandPool pool;
+    std::atomic<int> later(0);
+    std::atomic<int> interval(0);
+    REQUIRE(0 == pool.execute_async_later([&later]() { later++; }, 5));
+    REQUIRE(0 == pool.execute_async_later([&later]() { later += 100; }, 5, 3));
+    REQUIRE(0 == pool.execute_async_interval([&interval]() { interval++; }, 1, 9));
+    pool.cancel(3);
+    // single threaded, the fake clock advances with every call
+    for (int i=0; i < 200; i++) {
+        pool.process(i % 4, 0);
+    }
+    REQUIRE(later == 1);
+    REQUIRE(interval > 10);
+    pool.cancel(9);
+    for (int i=0; i < 20; i++) {
+        pool.process(i % 4, 0);
+    }
+    const int stopped = interval;
+    for (int i=0; i < 200; i++) {
+        pool.process(i % 4, 0);
+    }
+    REQUIRE(interval == stopped);
+    REQUIRE(0 == pool.pending());
+}
+
+// a timer lock which another worker seems to hold while |busy|
+struct ContendedLock {
+    void lock() {
+        m_lock.lock();
+    }
+    void unlock() {
+        m_lock.unlock();
+    }
+    bool try_lock() {
+        return !busy && m_lock.try_lock();
+    }
+    FutexLock m_lock;
+    static std::atomic<bool> busy;
+};
+std::atomic<bool> ContendedLock::busy(false);
+
+TEST_CASE( "command pool does not sleep past a timer while another worker dispatches") {
+    CommandPool<ContendedLock, FutexEventFlag, 8, 2> pool;
+    std::atomic<int> later(0);
+    REQUIRE(0 == pool.execute_async_later([&later]() { later++; }, 5));
+    ContendedLock::busy = true;
+    // worker 1 was not woken up by the new timer, it must not wait the full second
+    auto start = std::chrono::steady_clock::now();
+    pool.process(1, 1000);
+    const double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    REQUIRE(elapsed_ms < 500);
+    REQUIRE(later == 0);
+    ContendedLock::busy = false;
+    for (int i=0; i < 20 && later == 0; i++) {
+        pool.process(i % 2, 0);
+    }
+    REQUIRE(later == 1);
+}
+
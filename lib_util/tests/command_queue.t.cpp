@@ -7,6 +7,8 @@
 #include <iostream>
 #include "../command_queue.h"
 #include <unistd.h>
+#include <vector>
+#include <string>
 using namespace motesque;
 
 namespace motesque {
@@ -15,7 +17,8 @@ void delayMs(uint32_t ms) {
     usleep(ms * 1000);
 }
 
-static uint32_t now = 0;
+// advanced by the worker threads of the pool tests as well
+static std::atomic<uint32_t> now(0);
 
 uint32_t nowMs() {
     uint32_t ticks = now;
@@ -23,6 +26,10 @@ uint32_t nowMs() {
     return ticks;
 }
 
+uint64_t nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 };
 
 template<typename T>
@@ -123,6 +130,37 @@ TEST_CASE( "command queue execute_async_later") {
     REQUIRE( counter == 1);
 }
 
+// a queue which lets the fake clock run while pop() waits in vain
+template<typename T>
+struct SleepingQueueTest : public QueueTest<T>
+{
+    SleepingQueueTest(size_t size)
+    : QueueTest<T>(size) {
+    }
+    int pop(T* cmd, int waitMs) {
+        if (QueueTest<T>::pop(cmd, 0) == 0) {
+            return 0;
+        }
+        now += waitMs;
+        return -1;
+    }
+};
+
+TEST_CASE( "command queue process fires a timer it waited for") {
+    now = 0;
+    typedef CommandQueue<SleepingQueueTest, 1, IntStatus> TestCommandQueue;
+    TestCommandQueue cmdQueue;
+    int counter = 0;
+    REQUIRE(0 == cmdQueue.execute_async_later([&counter]() { counter++; }, 50));
+    // moves the command to the timers
+    cmdQueue.process(0);
+    REQUIRE(counter == 0);
+    // sleeps until the deadline and runs it in the same call
+    cmdQueue.process(100);
+    REQUIRE(counter == 1);
+    REQUIRE(now < 60);
+}
+
 typedef CommandQueue<QueueTest, 3, IntStatus> TestCommandQueue;
 volatile bool command_queue_should_process = true;
 void command_queue_process(TestCommandQueue& cmdQueue) {
@@ -195,3 +233,324 @@ TEST_CASE( "command queue interval" ) {
     REQUIRE(counter == 10);
 
 }
+
+TEST_CASE( "command queue cancel many ids" ) {
+    typedef CommandQueue<QueueTest, 40, IntStatus> LargeCommandQueue;
+    LargeCommandQueue cmdQueue;
+    int counter = 0;
+    auto f = [&counter]() {
+        counter++;
+    };
+    now = 0;
+    // ids colliding in the index and duplicate ids
+    for (int i=0; i < 40; i++) {
+        REQUIRE(0 == cmdQueue.execute_async_later(f, 1000, (i % 20) * 64));
+    }
+    // all contexts are taken
+    REQUIRE(-1 == cmdQueue.execute_async(f));
+    for (int i=0; i < 20; i += 2) {
+        cmdQueue.cancel(i * 64);
+    }
+    now = 2000;
+    for (int i=0; i < 200; i++) {
+        cmdQueue.process(0);
+    }
+    // half of the ids were cancelled, each of them twice
+    REQUIRE(counter == 20);
+    // all contexts are back
+    for (int i=0; i < 40; i++) {
+        REQUIRE(0 == cmdQueue.execute_async_later(f, 0, i));
+    }
+    cmdQueue.cancel(3);
+    for (int i=0; i < 100; i++) {
+        cmdQueue.process(0);
+    }
+    REQUIRE(counter == 59);
+}
+
+TEST_CASE( "command queue several producers" ) {
+    typedef CommandQueue<QueueTest, 64, IntStatus> LargeCommandQueue;
+    LargeCommandQueue cmdQueue;
+    std::atomic<int> counter(0);
+    auto f = [&counter]() {
+        counter++;
+    };
+    const int kNumProducers = 4;
+    const int kNumCommands = 2000;
+    std::atomic<int> num_producers(kNumProducers);
+    std::vector<std::thread> producers;
+    for (int p=0; p < kNumProducers; p++) {
+        producers.push_back(std::thread([&]() {
+            for (int i=0; i < kNumCommands; i++) {
+                while (cmdQueue.execute_async(f) != 0) {
+                    std::this_thread::yield();
+                }
+            }
+            num_producers--;
+        }));
+    }
+    while (num_producers > 0 || counter < kNumProducers * kNumCommands) {
+        cmdQueue.process(0);
+    }
+    for (size_t p=0; p < producers.size(); p++) {
+        producers[p].join();
+    }
+    REQUIRE(counter == kNumProducers * kNumCommands);
+}
+
+TEST_CASE( "command queue fires all due timers in order" ) {
+    typedef CommandQueue<QueueTest, 16, IntStatus> LargeCommandQueue;
+    LargeCommandQueue cmdQueue;
+    std::vector<int> fired;
+    // close to the wrap around of the clock
+    now = 0xffffffff - 20;
+    const int delays[] = { 500, 100, 400, 300, 200, 600, 50, 450 };
+    for (size_t i=0; i < sizeof(delays)/sizeof(delays[0]); i++) {
+        int delay = delays[i];
+        REQUIRE(0 == cmdQueue.execute_async_later([&fired, delay]() { fired.push_back(delay); }, delay));
+    }
+    cmdQueue.process(0);
+    REQUIRE(fired.empty());
+    // the clock wrapped around, everything up to 450 ms is due in a single call
+    now += 460;
+    cmdQueue.process(0);
+    REQUIRE(fired.size() == 6);
+    for (size_t i=1; i < fired.size(); i++) {
+        REQUIRE(fired[i-1] < fired[i]);
+    }
+    now += 200;
+    cmdQueue.process(0);
+    REQUIRE(fired.size() == 8);
+    REQUIRE(fired.back() == 600);
+}
+
+TEST_CASE( "command queue strict priorities" ) {
+    typedef CommandQueue<QueueTest, 16, IntStatus> LargeCommandQueue;
+    LargeCommandQueue cmdQueue;
+    std::vector<int> order;
+    REQUIRE(0 == cmdQueue.execute_async([&order]() { order.push_back(CommandPriority_Low); }, false, CommandPriority_Low));
+    REQUIRE(0 == cmdQueue.execute_async([&order]() { order.push_back(CommandPriority_Normal); }));
+    REQUIRE(0 == cmdQueue.execute_async([&order]() { order.push_back(CommandPriority_High); }, false, CommandPriority_High));
+    // the priority of timers follows from the command id
+    REQUIRE(0 == cmdQueue.execute_async_later([&order]() { order.push_back(CommandPriority_High); }, 0, FrameStreamStart));
+    REQUIRE(3 == cmdQueue.process_batch(3, 0));
+    REQUIRE(1 == cmdQueue.process_batch(3, 0));
+    REQUIRE(order.size() == 4);
+    REQUIRE(order[0] == CommandPriority_High);
+    REQUIRE(order[1] == CommandPriority_High);
+    REQUIRE(order[2] == CommandPriority_Normal);
+    REQUIRE(order[3] == CommandPriority_Low);
+
+    motesque::CommandPriorityStats stats;
+    REQUIRE(0 == cmdQueue.get_priority_stats(CommandPriority_High, &stats));
+    REQUIRE(stats.executed == 2);
+    REQUIRE(0 == cmdQueue.get_priority_stats(CommandPriority_Low, &stats));
+    REQUIRE(stats.executed == 1);
+    REQUIRE(stats.total_wait_us >= stats.max_wait_us);
+}
+
+TEST_CASE( "command queue weighted priorities" ) {
+    typedef CommandQueue<QueueTest, 16, IntStatus> LargeCommandQueue;
+    LargeCommandQueue cmdQueue;
+    const uint32_t weights[] = { 2, 1, 1 };
+    REQUIRE(0 == cmdQueue.set_priority_policy(PriorityPolicy_Weighted, weights));
+    std::string order;
+    for (int i=0; i < 4; i++) {
+        cmdQueue.execute_async([&order]() { order += 'L'; }, false, CommandPriority_Low);
+        cmdQueue.execute_async([&order]() { order += 'N'; }, false, CommandPriority_Normal);
+        cmdQueue.execute_async([&order]() { order += 'H'; }, false, CommandPriority_High);
+    }
+    REQUIRE(12 == cmdQueue.process_batch(100, 0));
+    // low priorities get their share instead of starving
+    REQUIRE(order == "HHNLHHNLNLNL");
+}
+
+TEST_CASE( "command queue batch budget" ) {
+    typedef CommandQueue<QueueTest, 16, IntStatus> LargeCommandQueue;
+    LargeCommandQueue cmdQueue;
+    int counter = 0;
+    for (int i=0; i < 10; i++) {
+        cmdQueue.execute_async([&counter]() { counter++; usleep(2000); });
+    }
+    size_t executed = cmdQueue.process_batch(10, 5000);
+    REQUIRE(executed >= 1);
+    REQUIRE(executed <= 3);
+    // the rest is left for the next batch
+    while (counter < 10) {
+        REQUIRE(cmdQueue.process_batch(10, 0) > 0);
+    }
+    motesque::CommandPriorityStats stats;
+    cmdQueue.get_priority_stats(CommandPriority_Normal, &stats);
+    REQUIRE(stats.executed == 10);
+    REQUIRE(stats.max_exec_us >= 2000);
+}
+
+TEST_CASE( "command queue fixed rate interval does not drift" ) {
+    TestCommandQueue cmdQueue;
+    std::vector<uint32_t> fixed_rate_runs;
+    std::vector<uint32_t> fixed_delay_runs;
+    now = 1000;
+    // both take 3 ms to run
+    REQUIRE(0 == cmdQueue.execute_async_interval([&fixed_rate_runs]() { fixed_rate_runs.push_back(now); now += 3; },
+                                                 10, 1, CommandPriority_Normal, IntervalPolicy_FixedRate));
+    REQUIRE(0 == cmdQueue.execute_async_interval([&fixed_delay_runs]() { fixed_delay_runs.push_back(now); now += 3; },
+                                                 10, 2, CommandPriority_Normal, IntervalPolicy_FixedDelay));
+    while (fixed_rate_runs.size() < 20) {
+        cmdQueue.process(0);
+    }
+    // every run starts on the grid of the first deadline. It may be late by the other command, but it does not add up
+    for (size_t i=0; i < fixed_rate_runs.size(); i++) {
+        REQUIRE(fixed_rate_runs[i] - (1010 + 10*i) < 10);
+    }
+    // the runtime adds up
+    REQUIRE(fixed_delay_runs.size() < fixed_rate_runs.size());
+    motesque::IntervalStats stats;
+    REQUIRE(0 == cmdQueue.get_interval_stats(1, &stats));
+    REQUIRE(stats.runs == 20);
+    REQUIRE(stats.missed == 0);
+    REQUIRE(-1 == cmdQueue.get_interval_stats(3, &stats));
+    cmdQueue.cancel(1);
+    cmdQueue.cancel(2);
+}
+
+// the first run takes 35 ms, three more deadlines pass in the meantime
+static void run_slow_interval(IntervalPolicy policy, motesque::IntervalStats* stats)
+{
+    TestCommandQueue cmdQueue;
+    int runs = 0;
+    now = 0;
+    REQUIRE(0 == cmdQueue.execute_async_interval([&runs]() { if (runs++ == 0) now += 35; },
+                                                 10, 1, CommandPriority_Normal, policy));
+    for (int i=0; i < 70; i++) {
+        cmdQueue.process(0);
+    }
+    REQUIRE(0 == cmdQueue.get_interval_stats(1, stats));
+    cmdQueue.cancel(1);
+}
+
+TEST_CASE( "command queue fixed rate missed deadlines" ) {
+    motesque::IntervalStats skip_stats;
+    motesque::IntervalStats catch_up_stats;
+    run_slow_interval(IntervalPolicy_FixedRate, &skip_stats);
+    run_slow_interval(IntervalPolicy_FixedRateCatchUp, &catch_up_stats);
+    REQUIRE(skip_stats.missed == 3);
+    // catch up runs one of the missed deadlines late instead of skipping it
+    REQUIRE(catch_up_stats.missed == 2);
+    REQUIRE(catch_up_stats.runs == skip_stats.runs + 1);
+    REQUIRE(catch_up_stats.max_lateness_ms > 0);
+    uint32_t histogram_runs = 0;
+    for (size_t i=0; i < catch_up_stats.lateness_histogram.size(); i++) {
+        histogram_runs += catch_up_stats.lateness_histogram[i];
+    }
+    REQUIRE(histogram_runs == catch_up_stats.runs);
+}
+
+TEST_CASE( "command queue future with timeout" ) {
+    typedef CommandQueue<QueueTest, 4, IntStatus> SmallCommandQueue;
+    SmallCommandQueue cmdQueue;
+    SmallCommandQueue::Future<int> future = cmdQueue.submit([]() { return 42; });
+    REQUIRE(future.valid());
+    int value = 0;
+    // nobody processes yet
+    REQUIRE(-1 == future.wait_for(10));
+    REQUIRE(-1 == future.get(&value, 0));
+    REQUIRE(future.valid());
+    cmdQueue.process(0);
+    REQUIRE(future.ready());
+    REQUIRE(0 == future.get(&value, 10));
+    REQUIRE(value == 42);
+    REQUIRE(!future.valid());
+    // dropping a future does not leak its context
+    for (int i=0; i < 10; i++) {
+        SmallCommandQueue::Future<double> dropped = cmdQueue.submit([]() { return 1.5; });
+        REQUIRE(dropped.valid());
+        cmdQueue.process(0);
+    }
+    SmallCommandQueue::Future<int> waited = cmdQueue.submit([]() { return 7; });
+    std::thread t([&cmdQueue]() {
+        cmdQueue.process(0);
+    });
+    REQUIRE(0 == waited.get(&value, WICED_NEVER_TIMEOUT));
+    REQUIRE(value == 7);
+    t.join();
+}
+
+TEST_CASE( "command queue future continuations" ) {
+    typedef CommandQueue<QueueTest, 4, IntStatus> SmallCommandQueue;
+    SmallCommandQueue cmdQueue;
+    std::vector<std::string> trace;
+    SmallCommandQueue::Future<int> future = cmdQueue.submit([&trace]() { trace.push_back("a"); return 20; })
+        .then([&trace](int x) { trace.push_back("b"); return x + 1; })
+        .then([&trace](int x) { trace.push_back("c"); return x * 2; });
+    REQUIRE(future.valid());
+    REQUIRE(trace.empty());
+    // one command per process call, a continuation is queued when its input is done
+    cmdQueue.process(0);
+    REQUIRE(trace == std::vector<std::string>({"a"}));
+    cmdQueue.process(0);
+    cmdQueue.process(0);
+    int value = 0;
+    REQUIRE(0 == future.get(&value, 0));
+    REQUIRE(value == 42);
+    REQUIRE(trace == std::vector<std::string>({"a", "b", "c"}));
+    // then after the result is there
+    SmallCommandQueue::Future<int> done = cmdQueue.submit([]() { return 1; });
+    cmdQueue.process(0);
+    REQUIRE(done.ready());
+    SmallCommandQueue::Future<float> next = done.then([](int x) { return x + 0.5f; });
+    REQUIRE(!done.valid());
+    cmdQueue.process(0);
+    float f = 0;
+    REQUIRE(0 == next.get(&f, 0));
+    REQUIRE(f == 1.5f);
+    // all contexts are back, the queue is usable to the last slot
+    std::vector<SmallCommandQueue::Future<int>> futures;
+    for (int i=0; i < 4; i++) {
+        futures.push_back(cmdQueue.submit([i]() { return i; }));
+        REQUIRE(futures.back().valid());
+    }
+    REQUIRE(!cmdQueue.submit([]() { return 0; }).valid());
+}
+
+// a queue with room for half of the contexts, so it can be full while contexts are left
+template<typename T>
+struct HalfQueueTest : public QueueTest<T>
+{
+    HalfQueueTest(size_t size)
+    : QueueTest<T>(size / 2) {
+    }
+};
+
+TEST_CASE( "command queue chain onto a done future with a full queue" ) {
+    typedef CommandQueue<HalfQueueTest, 4, IntStatus> SmallCommandQueue;
+    SmallCommandQueue cmdQueue;
+    SmallCommandQueue::Future<int> done = cmdQueue.submit([]() { return 1; });
+    cmdQueue.process(0);
+    REQUIRE(done.ready());
+    REQUIRE(0 == cmdQueue.execute_async([]() {}));
+    REQUIRE(0 == cmdQueue.execute_async([]() {}));
+    // a context is left for the continuation, but the queue is full
+    SmallCommandQueue::Future<int> next = done.then([](int x) { return x + 1; });
+    REQUIRE(!next.valid());
+    REQUIRE(!done.valid());
+    cmdQueue.process(0);
+    cmdQueue.process(0);
+    // the contexts of the parent and the continuation are back
+    std::vector<SmallCommandQueue::Future<int>> futures;
+    for (int i=0; i < 4; i++) {
+        futures.push_back(cmdQueue.submit([i]() { return i; }));
+        REQUIRE(futures.back().valid());
+        cmdQueue.process(0);
+    }
+    REQUIRE(!cmdQueue.submit([]() { return 0; }).valid());
+}
+
+TEST_CASE( "command queue without stats" ) {
+    // the default build, see command_queue_stats.t.cpp for the instrumented one
+    typedef CommandQueue<QueueTest, 2, IntStatus> SmallCommandQueue;
+    SmallCommandQueue cmdQueue;
+    REQUIRE(0 == cmdQueue.execute_async([]() {}));
+    cmdQueue.process(0);
+    motesque::CommandStats stats;
+    REQUIRE(-1 == cmdQueue.get_command_stats(Unknown, &stats));
+}
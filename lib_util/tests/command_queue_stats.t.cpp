@@ -0,0 +1,91 @@
+#include "../../unittest/catch.hpp"
+#include <chrono>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "../command_queue.h"
+using namespace motesque;
+
+// Built into run_command_stats_tests with MOTESQUE_ENABLE_COMMAND_STATS and MOTESQUE_ENABLE_EVENT_TRACE. The
+// instrumentation changes the layout of the queue, so it cannot share a binary with the default build.
+
+namespace motesque {
+
+void delayMs(uint32_t ms) {
+    usleep(ms * 1000);
+}
+
+static uint32_t now = 0;
+
+uint32_t nowMs() {
+    return now++;
+}
+
+uint64_t nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+};
+
+template<typename T>
+struct QueueTest
+{
+    QueueTest(size_t size)
+    : queueSize(size){
+
+    }
+    int put(const T& cmd, int waitMs) {
+        std::unique_lock<std::mutex> lck(mutex);
+        if (queue.size() < queueSize) {
+            queue.push(cmd);
+            return 0;
+        }
+        return -1;
+    }
+    int pop(T* cmd, int waitMs) {
+        std::unique_lock<std::mutex> lck(mutex);
+        if (queue.empty()) {
+            return -1;
+        }
+        *cmd = queue.front();
+        queue.pop();
+        return 0;
+    }
+    std::queue<T> queue;
+    size_t queueSize;
+    std::mutex mutex;
+};
+
+TEST_CASE( "command queue per command stats" ) {
+    typedef CommandQueue<QueueTest, 2, IntStatus> SmallCommandQueue;
+    SmallCommandQueue cmdQueue;
+    lw_event_trace::LwEventTraceLogger::get_instance().enable(1024);
+    REQUIRE(0 == cmdQueue.execute_async_later([]() { usleep(2000); }, 0, FrameStreamStart));
+    REQUIRE(0 == cmdQueue.execute_async([]() {}));
+    // no free context left
+    REQUIRE(-1 == cmdQueue.execute_async_later([]() {}, 0, FrameStreamStart));
+    for (int i=0; i < 10; i++) {
+        cmdQueue.process(0);
+    }
+    lw_event_trace::LwEventTraceLogger::get_instance().disable();
+    motesque::CommandStats stats;
+    REQUIRE(0 == cmdQueue.get_command_stats(FrameStreamStart, &stats));
+    REQUIRE(stats.executed == 1);
+    REQUIRE(stats.rejected == 1);
+    REQUIRE(stats.dropped == 0);
+    REQUIRE(stats.max_run_us >= 2000);
+    REQUIRE(stats.run_histogram[latency_bucket(stats.max_run_us)] == 1);
+    REQUIRE(0 == cmdQueue.get_command_stats(Unknown, &stats));
+    REQUIRE(stats.executed == 1);
+    REQUIRE(-1 == cmdQueue.get_command_stats(kNumCommandIDs, &stats));
+    // a wait and a run span per command
+    const std::vector<lw_event_trace::TraceEvent>& events = lw_event_trace::LwEventTraceLogger::get_instance().get_events();
+    REQUIRE(events.size() == 8);
+    size_t frame_stream_spans = 0;
+    for (size_t i=0; i < events.size(); i++) {
+        frame_stream_spans += std::string(events[i].name) == "FrameStreamStart";
+    }
+    REQUIRE(frame_stream_spans == 4);
+}
@@ -0,0 +1,148 @@
+#include "assert.h"
+#include "../../unittest/catch.hpp"
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <iostream>
+#include <time.h>
+#include "../futex.h"
+#include "../event_flag_status.h"
+#include "../sequential_buffer.h"
+#include "../record_ring.h"
+#include "../command_queue.h"
+
+using namespace motesque;
+
+static long long thread_cpu_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+TEST_CASE( "futex lock mutual exclusion") {
+    FutexLock lock;
+    long long counter = 0;
+    const int kNumThreads = 4;
+    const int kNumIncrements = 100000;
+    std::vector<std::thread> threads;
+    for (int t=0; t < kNumThreads; t++) {
+        threads.push_back(std::thread([&]() {
+            for (int i=0; i < kNumIncrements; i++) {
+                lock.lock();
+                counter++;
+                lock.unlock();
+            }
+        }));
+    }
+    for (size_t t=0; t < threads.size(); t++) {
+        threads[t].join();
+    }
+    REQUIRE(counter == (long long)kNumThreads * kNumIncrements);
+    REQUIRE(lock.try_lock());
+    REQUIRE(!lock.try_lock());
+    lock.unlock();
+}
+
+TEST_CASE( "futex event flag timed wait sleeps") {
+    EventFlagStatus flag;
+    auto start = std::chrono::steady_clock::now();
+    long long cpu_start = thread_cpu_us();
+    REQUIRE(-1 == flag.wait_for(100));
+    long long cpu_us = thread_cpu_us() - cpu_start;
+    long long elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    REQUIRE(elapsed_ms >= 100);
+    // sleeping, not burning a core
+    REQUIRE(cpu_us < 20000);
+}
+
+TEST_CASE( "futex event flag set and clear") {
+    EventFlagStatus flag;
+    flag.set();
+    // consumed by the wait
+    REQUIRE(0 == flag.wait_for(0));
+    REQUIRE(-1 == flag.wait_for(0));
+    flag.set();
+    flag.clear();
+    REQUIRE(-1 == flag.wait_for(10));
+    // wakes up a sleeping waiter
+    std::thread setter([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        flag.set();
+    });
+    REQUIRE(0 == flag.wait_for(kFutexNeverTimeout));
+    setter.join();
+}
+
+TEST_CASE( "futex sequential buffer producer consumer") {
+    SequentialBufferT<FutexLock, FutexEventFlag> sqb(4096);
+    sqb.set_watermark(1024);
+    const size_t kNumChunks = 20000;
+    bool sequence_ok = true;
+    std::thread consumer([&]() {
+        uint8_t expected = 0;
+        size_t remaining = kNumChunks * 32;
+        while (remaining > 0) {
+            const uint8_t* read_ptr;
+            size_t available = 0;
+            if (sqb.request_read(&read_ptr, &available, 100) != 0) {
+                continue;
+            }
+            for (size_t i=0; i < available; i++) {
+                if (read_ptr[i] != expected++) {
+                    sequence_ok = false;
+                }
+            }
+            sqb.commit_read(available);
+            remaining -= available;
+        }
+    });
+    uint8_t chunk[32];
+    uint8_t counter = 0;
+    for (size_t i=0; i < kNumChunks; i++) {
+        for (size_t k=0; k < sizeof(chunk); k++) {
+            chunk[k] = counter++;
+        }
+        REQUIRE(0 == sqb.write(chunk, sizeof(chunk), 10000));
+    }
+    consumer.join();
+    REQUIRE(sequence_ok);
+}
+
+template<typename T>
+struct FutexTestQueue
+{
+    FutexTestQueue(size_t size) : m_records(size) {}
+    int put(const T& cmd, int waitMs) {
+        return m_records.push(cmd);
+    }
+    int pop(T* cmd, int waitMs) {
+        size_t count = 0;
+        return m_records.pop_n(cmd, 1, &count, waitMs);
+    }
+    RecordRingT<T, FutexLock, FutexEventFlag> m_records;
+};
+
+TEST_CASE( "futex command queue execute with wait") {
+    CommandQueue<FutexTestQueue, 3, EventFlagStatus> cmdQueue;
+    int counter = 0;
+    auto f = [&counter]() {
+        counter++;
+    };
+    const int kNumTries = 10000;
+    std::atomic<bool> should_process(true);
+    std::thread t([&]() {
+        while (should_process) {
+            cmdQueue.process(10);
+        }
+    });
+    auto start = std::chrono::steady_clock::now();
+    for (int i=0; i < kNumTries; i++) {
+        REQUIRE(0 == cmdQueue.execute_async(f, true));
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    should_process = false;
+    t.join();
+    std::cout << "Command Queue Execute (futex) elapsed: " << duration << " us, tries: " << kNumTries << std::endl;
+    REQUIRE(counter == kNumTries);
+}
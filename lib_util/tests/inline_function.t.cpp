@@ -0,0 +1,100 @@
+#include "assert.h"
+#include "../../unittest/catch.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include "../inline_function.h"
+#include "../record_ring.h"
+#include "../command_queue.h"
+
+using namespace motesque;
+
+// count every heap allocation of the test binary
+static std::atomic<size_t> inline_function_allocations(0);
+
+void* operator new(size_t size)
+{
+    inline_function_allocations++;
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+TEST_CASE( "inline function copy move and reset") {
+    std::shared_ptr<int> shared = std::make_shared<int>(41);
+    InlineFunction<int(int), 32> f = [shared](int x) { return *shared + x; };
+    REQUIRE(f);
+    REQUIRE(f(1) == 42);
+    REQUIRE(shared.use_count() == 2);
+    InlineFunction<int(int), 32> g(f);
+    REQUIRE(shared.use_count() == 3);
+    InlineFunction<int(int), 32> h(std::move(g));
+    REQUIRE(!g);
+    REQUIRE(shared.use_count() == 3);
+    REQUIRE(h(2) == 43);
+    f = nullptr;
+    h.reset();
+    REQUIRE(!f);
+    REQUIRE(shared.use_count() == 1);
+}
+
+template<typename T>
+struct AllocFreeTestQueue
+{
+    AllocFreeTestQueue(size_t size) : m_records(size) {}
+    int put(const T& cmd, int waitMs) {
+        return m_records.push(cmd);
+    }
+    int pop(T* cmd, int waitMs) {
+        size_t count = 0;
+        return m_records.pop_n(cmd, 1, &count, 0);
+    }
+    RecordRingT<T, std::mutex, IntStatus> m_records;
+};
+
+TEST_CASE( "command queue dispatch does not allocate") {
+    CommandQueue<AllocFreeTestQueue, 8, IntStatus> cmdQueue;
+    // larger than the small buffer of std::function
+    uint64_t a = 1, b = 2, c = 3;
+    uint64_t sum = 0;
+    auto f = [&sum, a, b, c]() {
+        sum += a + b + c;
+    };
+    {
+        // std::function would allocate for this lambda
+        const size_t allocations_before = inline_function_allocations;
+        std::function<void(void)> heap_func(f);
+        REQUIRE(inline_function_allocations > allocations_before);
+    }
+    // warm up
+    REQUIRE(0 == cmdQueue.execute_async(f));
+    cmdQueue.process(0);
+    // no REQUIRE in the loop, the assertions allocate themselves
+    int failed = 0;
+    const size_t allocations_before = inline_function_allocations;
+    for (int i=0; i < 1000; i++) {
+        failed += cmdQueue.execute_async(f) != 0;
+        failed += cmdQueue.execute_async_later(f, 0) != 0;
+        cmdQueue.process(0);
+        cmdQueue.process(0);
+    }
+    const size_t allocations = inline_function_allocations - allocations_before;
+    REQUIRE(failed == 0);
+    REQUIRE(allocations == 0);
+    REQUIRE(sum == 2001 * 6);
+}
@@ -0,0 +1,169 @@
+#include "assert.h"
+#include "../../unittest/catch.hpp"
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include "../record_ring.h"
+
+struct RecordRingTestStatus {
+    RecordRingTestStatus() : status(0) {}
+
+    void set() {
+        status = 1;
+    }
+    void clear() {
+        status = 0;
+    }
+    int wait_for(uint32_t timeout_ms) {
+        return status.exchange(0) == 1 ? 0 : -1;
+    }
+    std::atomic<int> status;
+};
+
+struct TestPacket {
+    uint64_t timestamp_us;
+    float    acc_g[3];
+    float    gyr_rps[3];
+};
+
+typedef motesque::RecordRingT<TestPacket, std::mutex, RecordRingTestStatus> PacketRing;
+
+static TestPacket make_packet(uint64_t ts) {
+    TestPacket p;
+    memset(&p, 0, sizeof(p));
+    p.timestamp_us = ts;
+    return p;
+}
+
+TEST_CASE( "record ring ctor") {
+    PacketRing ring(10);
+    REQUIRE(10 == ring.free());
+    REQUIRE(0 == ring.size());
+    const TestPacket* span;
+    size_t count;
+    REQUIRE(-1 == ring.request_pop_n(&span, 10, &count, 0));
+    REQUIRE(0 == count);
+    // the first slot is cache line aligned
+    TestPacket* slots;
+    REQUIRE(0 == ring.reserve_push_n(&slots, 1, &count));
+    REQUIRE(0 == (uintptr_t)slots % 64);
+}
+
+TEST_CASE( "record ring push pop wraps on record boundaries") {
+    PacketRing ring(10);
+    TestPacket packets[10];
+    for (int i=0; i < 10; i++) {
+        packets[i] = make_packet(i);
+    }
+    REQUIRE(0 == ring.push_n(packets, 7));
+    REQUIRE(-1 == ring.push_n(packets, 4));
+    const TestPacket* span;
+    size_t count;
+    REQUIRE(0 == ring.request_pop_n(&span, 5, &count, 0));
+    REQUIRE(5 == count);
+    // indempotent
+    REQUIRE(0 == ring.request_pop_n(&span, 5, &count, 0));
+    REQUIRE(5 == count);
+    REQUIRE(4 == span[4].timestamp_us);
+    REQUIRE(0 == ring.commit_pop(5));
+    // 2 stored, wraps after 3 more
+    REQUIRE(0 == ring.push_n(packets, 8));
+    REQUIRE(0 == ring.free());
+    REQUIRE(-1 == ring.push(packets[0]));
+    REQUIRE(0 == ring.request_pop_n(&span, 100, &count, 0));
+    // only until the end of the ring, but whole records
+    REQUIRE(5 == count);
+    REQUIRE(5 == span[0].timestamp_us);
+    REQUIRE(2 == span[4].timestamp_us);
+    REQUIRE(0 == ring.commit_pop(5));
+    REQUIRE(0 == ring.request_pop_n(&span, 100, &count, 0));
+    REQUIRE(5 == count);
+    REQUIRE(3 == span[0].timestamp_us);
+    REQUIRE(-1 == ring.commit_pop(6));
+    REQUIRE(0 == ring.commit_pop(5));
+    REQUIRE(0 == ring.size());
+}
+
+TEST_CASE( "record ring pop_n copies across the wrap") {
+    PacketRing ring(10);
+    TestPacket packets[10];
+    for (int i=0; i < 10; i++) {
+        packets[i] = make_packet(i);
+    }
+    TestPacket out[10];
+    size_t count;
+    REQUIRE(0 == ring.push_n(packets, 8));
+    REQUIRE(0 == ring.pop_n(out, 8, &count, 0));
+    REQUIRE(0 == ring.push_n(packets, 6));
+    REQUIRE(0 == ring.pop_n(out, 10, &count, 0));
+    REQUIRE(6 == count);
+    for (int i=0; i < 6; i++) {
+        REQUIRE((uint64_t)i == out[i].timestamp_us);
+    }
+    REQUIRE(-1 == ring.pop_n(out, 10, &count, 0));
+    REQUIRE(0 == count);
+}
+
+TEST_CASE( "record ring reserve_push_n fills in place") {
+    PacketRing ring(10);
+    ring.set_watermark(4);
+    TestPacket* slots;
+    size_t count;
+    REQUIRE(0 == ring.reserve_push_n(&slots, 3, &count));
+    REQUIRE(3 == count);
+    for (size_t i=0; i < count; i++) {
+        slots[i] = make_packet(100 + i);
+    }
+    REQUIRE(-1 == ring.commit_push(4));
+    REQUIRE(0 == ring.commit_push(3));
+    const TestPacket* span;
+    // below the watermark, times out but hands out what is there
+    REQUIRE(0 == ring.request_pop_n(&span, 10, &count, 10));
+    REQUIRE(3 == count);
+    REQUIRE(102 == span[2].timestamp_us);
+    REQUIRE(0 == ring.commit_pop(3));
+    // contiguous until the end
+    REQUIRE(0 == ring.reserve_push_n(&slots, 10, &count));
+    REQUIRE(7 == count);
+    REQUIRE(0 == ring.commit_push(7));
+    REQUIRE(0 == ring.reserve_push_n(&slots, 10, &count));
+    REQUIRE(3 == count);
+    REQUIRE(0 == ring.commit_push(3));
+    REQUIRE(-1 == ring.reserve_push_n(&slots, 10, &count));
+    REQUIRE(0 == count);
+}
+
+TEST_CASE( "record ring producer consumer") {
+    PacketRing ring(64);
+    const uint64_t kNumPackets = 100000;
+    std::atomic<bool> sequence_ok(true);
+    std::thread consumer([&]() {
+        uint64_t expected = 0;
+        while (expected < kNumPackets) {
+            const TestPacket* span;
+            size_t count;
+            if (ring.request_pop_n(&span, 16, &count, 0) != 0) {
+                std::this_thread::yield();
+                continue;
+            }
+            for (size_t i=0; i < count; i++) {
+                if (span[i].timestamp_us != expected++) {
+                    sequence_ok = false;
+                }
+            }
+            ring.commit_pop(count);
+        }
+    });
+    TestPacket batch[8];
+    for (uint64_t ts=0; ts < kNumPackets; ts += 8) {
+        for (int i=0; i < 8; i++) {
+            batch[i] = make_packet(ts + i);
+        }
+        size_t n = (size_t)std::min<uint64_t>(8, kNumPackets - ts);
+        while (ring.push_n(batch, n) != 0) {
+            std::this_thread::yield();
+        }
+    }
+    consumer.join();
+    REQUIRE(sequence_ok);
+}
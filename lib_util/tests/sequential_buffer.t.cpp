@@ -7,7 +7,8 @@
 #include <iostream>
 #include "../sequential_buffer.h"
 #include <unistd.h>
-#include <mutex>
+#include <vector>
+#include <condition_variable>
 
 static uint32_t clock_counter = 0;
 
@@ -162,5 +163,441 @@ TEST_CASE( "write_commit_read_with_timeout")
     REQUIRE(clock_counter == 0);
 }
 
+typedef motesque::SequentialBufferT<std::mutex, SeqTestIntStatus, motesque::MirroredRingStorage> MirroredSequentialBuffer;
+
+TEST_CASE( "mirrored storage aliases the ring") {
+    motesque::MirroredRingStorage storage(100);
+    REQUIRE(storage.is_mirrored());
+    // rounded up to pages
+    REQUIRE(storage.size() >= 100);
+    storage.data()[0] = 0xab;
+    REQUIRE(storage.data()[storage.size()] == 0xab);
+    storage.data()[2*storage.size()-1] = 0xcd;
+    REQUIRE(storage.data()[storage.size()-1] == 0xcd);
+}
+
+TEST_CASE( "mirrored wrapping reads are contiguous") {
+    MirroredSequentialBuffer sqb(4096);
+    const size_t capacity = sqb.free();
+    std::vector<uint8_t> data(capacity);
+    for (size_t i=0; i < data.size(); i++) {
+        data[i] = (uint8_t)(i*7);
+    }
+    const uint8_t* read_ptr;
+    size_t available;
+    // move the cursors close to the end
+    REQUIRE(0 == sqb.write(data.data(), capacity - 10));
+    REQUIRE(0 == sqb.request_read(&read_ptr, &available, 0));
+    REQUIRE(capacity - 10 == available);
+    REQUIRE(0 == sqb.commit_read(available));
+    // this write wraps around
+    REQUIRE(0 == sqb.write(data.data(), 100));
+    REQUIRE(0 == sqb.request_read(&read_ptr, &available, 0));
+    // all 100 bytes in one go
+    REQUIRE(100 == available);
+    REQUIRE(0 == memcmp(read_ptr, data.data(), 100));
+    REQUIRE(0 == sqb.commit_read(available));
+    REQUIRE(-1 == sqb.request_read(&read_ptr, &available, 0));
+    // fill completely across the wrap
+    REQUIRE(0 == sqb.write(data.data(), capacity));
+    REQUIRE(0 == sqb.free());
+    REQUIRE(0 == sqb.request_read(&read_ptr, &available, 0));
+    REQUIRE(capacity == available);
+    REQUIRE(0 == memcmp(read_ptr, data.data(), capacity));
+    REQUIRE(0 == sqb.commit_read(available));
+    REQUIRE(capacity == sqb.free());
+}
+
+TEST_CASE( "mirrored random write read")
+{
+    MirroredSequentialBuffer sqb(4096);
+    uint8_t data[1000];
+    uint8_t counter = 0;
+    uint8_t expected = 0;
+    srand(100);
+    for (int i=0 ; i < 10000; ++i) {
+        size_t to_write = rand() % sizeof(data);
+        for (size_t k=0; k < to_write; k++) {
+            data[k] = counter + k;
+        }
+        if (0 == sqb.write(data, to_write)) {
+            counter += to_write;
+        }
+        const uint8_t* read_ptr;
+        size_t available = 0;
+        if (rand() % 3 == 1 && 0 == sqb.request_read(&read_ptr, &available, 0)) {
+            // whatever is stored is handed out at once
+            REQUIRE(available == sqb.size());
+            bool sequence_ok = true;
+            for (size_t k=0; k < available; k++) {
+                sequence_ok &= read_ptr[k] == expected++;
+            }
+            REQUIRE(sequence_ok);
+            REQUIRE(0 == sqb.commit_read(available));
+        }
+    }
+}
+
+TEST_CASE( "reserve_write commit_write") {
+    SequentialBuffer sqb(100);
+    uint8_t* write_ptr = NULL;
+    const uint8_t* read_ptr;
+    size_t available;
+    REQUIRE(-1 == sqb.reserve_write(101, &write_ptr));
+    REQUIRE(0 == sqb.reserve_write(60, &write_ptr));
+    memset(write_ptr, 0xab, 60);
+    // nothing published yet
+    REQUIRE(0 == sqb.size());
+    // cannot commit more than reserved
+    REQUIRE(-1 == sqb.commit_write(61));
+    REQUIRE(0 == sqb.commit_write(50));
+    REQUIRE(50 == sqb.size());
+    REQUIRE(0 == sqb.request_read(&read_ptr, &available, 0));
+    REQUIRE(50 == available);
+    REQUIRE(0xab == read_ptr[49]);
+    REQUIRE(0 == sqb.commit_read(30));
+    // 80 bytes free, but only 50 contiguous at the end
+    REQUIRE(80 == sqb.free());
+    REQUIRE(-1 == sqb.reserve_write(60, &write_ptr));
+    REQUIRE(0 == sqb.reserve_write(50, &write_ptr));
+    REQUIRE(0 == sqb.commit_write(50));
+    // wrapped, the front is contiguous now
+    REQUIRE(0 == sqb.reserve_write(20, &write_ptr));
+    REQUIRE(0 == sqb.commit_write(20));
+    REQUIRE(10 == sqb.free());
+    // an empty buffer starts over at the front
+    REQUIRE(0 == sqb.request_read(&read_ptr, &available, 0));
+    REQUIRE(0 == sqb.commit_read(available));
+    REQUIRE(0 == sqb.request_read(&read_ptr, &available, 0));
+    REQUIRE(0 == sqb.commit_read(available));
+    REQUIRE(0 == sqb.reserve_write(100, &write_ptr));
+}
+
+TEST_CASE( "reserve_write commit_write watermark") {
+    SequentialBuffer sqb(100);
+    sqb.set_watermark(40);
+    uint8_t* write_ptr = NULL;
+    const uint8_t* read_ptr;
+    size_t available = 0;
+    REQUIRE(0 == sqb.reserve_write(20, &write_ptr));
+    REQUIRE(0 == sqb.commit_write(20));
+    // below watermark
+    REQUIRE(0 == sqb.request_read(&read_ptr, &available, 100));
+    REQUIRE(100 == clock_counter);
+    REQUIRE(0 == sqb.reserve_write(20, &write_ptr));
+    REQUIRE(0 == sqb.commit_write(20));
+    REQUIRE(0 == sqb.request_read(&read_ptr, &available, 100));
+    REQUIRE(0 == clock_counter);
+    REQUIRE(40 == available);
+}
 
+TEST_CASE( "mirrored reserve_write across the wrap") {
+    MirroredSequentialBuffer sqb(4096);
+    const size_t capacity = sqb.free();
+    uint8_t* write_ptr = NULL;
+    const uint8_t* read_ptr;
+    size_t available;
+    REQUIRE(0 == sqb.reserve_write(capacity - 10, &write_ptr));
+    REQUIRE(0 == sqb.commit_write(capacity - 10));
+    REQUIRE(0 == sqb.request_read(&read_ptr, &available, 0));
+    REQUIRE(0 == sqb.commit_read(available));
+    REQUIRE(0 == sqb.reserve_write(100, &write_ptr));
+    for (size_t i=0; i < 100; i++) {
+        write_ptr[i] = (uint8_t)i;
+    }
+    REQUIRE(0 == sqb.commit_write(100));
+    REQUIRE(0 == sqb.request_read(&read_ptr, &available, 0));
+    REQUIRE(100 == available);
+    REQUIRE(99 == read_ptr[99]);
+}
+
+TEST_CASE( "overflow reject stats") {
+    SequentialBuffer sqb(100);
+    uint8_t data[40] = {0};
+    motesque::SequentialBufferStats stats;
+    REQUIRE(0 == sqb.write(data, 40));
+    REQUIRE(0 == sqb.write(data, 40));
+    REQUIRE(-1 == sqb.write(data, 40));
+    REQUIRE(-1 == sqb.write(data, 30));
+    sqb.get_stats(&stats);
+    REQUIRE(70 == stats.rejected_bytes);
+    REQUIRE(2 == stats.rejected_writes);
+    REQUIRE(0 == stats.dropped_records);
+    REQUIRE(80 == stats.high_water_mark);
+    REQUIRE(1 == stats.full_count);
+    const uint8_t* read_ptr;
+    size_t available;
+    REQUIRE(0 == sqb.request_read(&read_ptr, &available, 0));
+    REQUIRE(0 == sqb.commit_read(available));
+    sqb.get_stats(&stats);
+    REQUIRE(stats.time_full_ms > 0);
+    sqb.reset_stats();
+    sqb.get_stats(&stats);
+    REQUIRE(0 == stats.rejected_writes);
+    REQUIRE(0 == stats.high_water_mark);
+}
 
+TEST_CASE( "overflow drop oldest on record boundaries") {
+    SequentialBuffer sqb(100);
+    REQUIRE(-1 == sqb.set_overflow_policy(motesque::OverflowPolicy_DropOldest, 0));
+    REQUIRE(0 == sqb.set_overflow_policy(motesque::OverflowPolicy_DropOldest, 10));
+    uint8_t data[40];
+    motesque::SequentialBufferStats stats;
+    for (uint8_t i=0; i < 5; i++) {
+        memset(data, i, sizeof(data));
+        REQUIRE(0 == sqb.write(data, 30 + i));
+    }
+    // 30 and 31 were dropped to make room for 33 and 34
+    sqb.get_stats(&stats);
+    REQUIRE(2 == stats.dropped_records);
+    REQUIRE(30 + 31 == stats.dropped_bytes);
+    REQUIRE(32 + 33 + 34 == sqb.size());
+    const uint8_t* read_ptr;
+    size_t available;
+    REQUIRE(0 == sqb.request_read(&read_ptr, &available, 0));
+    // the oldest remaining record starts at the read pointer
+    REQUIRE(2 == read_ptr[0]);
+    REQUIRE(2 == read_ptr[31]);
+    // data handed out to the reader is not dropped
+    REQUIRE(-1 == sqb.write(data, 40));
+    REQUIRE(0 == sqb.commit_read(available));
+    while (0 == sqb.request_read(&read_ptr, &available, 0)) {
+        REQUIRE(0 == sqb.commit_read(available));
+    }
+    REQUIRE(0 == sqb.size());
+    // cannot switch policies while there is data
+    REQUIRE(0 == sqb.write(data, 10));
+    REQUIRE(-1 == sqb.set_overflow_policy(motesque::OverflowPolicy_Reject, 0));
+}
+
+TEST_CASE( "overflow drop oldest when running out of records") {
+    SequentialBuffer sqb(100);
+    REQUIRE(0 == sqb.set_overflow_policy(motesque::OverflowPolicy_DropOldest, 2));
+    uint8_t data[3] = {1, 2, 3};
+    REQUIRE(0 == sqb.write(data, 1));
+    REQUIRE(0 == sqb.write(data + 1, 1));
+    REQUIRE(0 == sqb.write(data + 2, 1));
+    motesque::SequentialBufferStats stats;
+    sqb.get_stats(&stats);
+    REQUIRE(1 == stats.dropped_records);
+    const uint8_t* read_ptr;
+    size_t available;
+    REQUIRE(0 == sqb.request_read(&read_ptr, &available, 0));
+    REQUIRE(2 == available);
+    REQUIRE(2 == read_ptr[0]);
+    REQUIRE(3 == read_ptr[1]);
+}
+
+TEST_CASE( "overflow drop oldest reserve at the wrap point") {
+    SequentialBuffer sqb(100);
+    REQUIRE(0 == sqb.set_overflow_policy(motesque::OverflowPolicy_DropOldest, 10));
+    uint8_t data[40];
+    memset(data, 7, sizeof(data));
+    uint8_t* write_ptr = NULL;
+    motesque::SequentialBufferStats stats;
+    REQUIRE(0 == sqb.write(data, 30));
+    REQUIRE(0 == sqb.write(data, 30));
+    REQUIRE(0 == sqb.write(data, 30));
+    // dropping the first records frees only the front, the buffer runs empty and starts over
+    REQUIRE(0 == sqb.reserve_write(25, &write_ptr));
+    sqb.get_stats(&stats);
+    REQUIRE(3 == stats.dropped_records);
+    REQUIRE(90 == stats.dropped_bytes);
+    REQUIRE(0 == sqb.commit_write(25));
+    REQUIRE(25 == sqb.size());
+
+    // the reader took the first 40, the next 40 follow and 30 wrap to the front
+    sqb.clear();
+    sqb.reset_stats();
+    REQUIRE(0 == sqb.write(data, 40));
+    const uint8_t* read_ptr;
+    size_t available;
+    REQUIRE(0 == sqb.request_read(&read_ptr, &available, 0));
+    REQUIRE(0 == sqb.commit_read(40));
+    REQUIRE(0 == sqb.write(data, 40));
+    REQUIRE(0 == sqb.write(data, 30));
+    // 30 free before the read cursor, dropping the 40 in front of it makes room for 35
+    REQUIRE(0 == sqb.reserve_write(35, &write_ptr));
+    sqb.get_stats(&stats);
+    REQUIRE(1 == stats.dropped_records);
+    REQUIRE(40 == stats.dropped_bytes);
+    REQUIRE(0 == sqb.commit_write(35));
+    REQUIRE(65 == sqb.size());
+
+    // with all records pinned by the reader nothing is dropped and the overflow counts once
+    sqb.clear();
+    sqb.reset_stats();
+    REQUIRE(0 == sqb.write(data, 30));
+    REQUIRE(0 == sqb.write(data, 30));
+    REQUIRE(0 == sqb.write(data, 30));
+    REQUIRE(0 == sqb.request_read(&read_ptr, &available, 0));
+    REQUIRE(-1 == sqb.reserve_write(25, &write_ptr));
+    sqb.get_stats(&stats);
+    REQUIRE(0 == stats.dropped_records);
+    REQUIRE(1 == stats.rejected_writes);
+    REQUIRE(25 == stats.rejected_bytes);
+    REQUIRE(90 == sqb.size());
+}
+
+TEST_CASE( "overflow drop oldest behind the data with the reader") {
+    SequentialBuffer sqb(100);
+    REQUIRE(0 == sqb.set_overflow_policy(motesque::OverflowPolicy_DropOldest, 10));
+    uint8_t data[80];
+    const uint8_t* read_ptr;
+    const uint8_t* next_ptr;
+    size_t available;
+    motesque::SequentialBufferStats stats;
+    memset(data, 1, 30);
+    REQUIRE(0 == sqb.write(data, 30));
+    memset(data, 2, 30);
+    REQUIRE(0 == sqb.write(data, 30));
+    // the reader is in the middle of sending the first two records
+    REQUIRE(0 == sqb.request_read(&read_ptr, &available, 0));
+    REQUIRE(60 == available);
+    REQUIRE(0 == sqb.commit_read(10));
+    memset(data, 3, 30);
+    REQUIRE(0 == sqb.write(data, 30));
+    // the third record goes, the newest data is kept
+    memset(data, 4, 30);
+    REQUIRE(0 == sqb.write(data, 30));
+    sqb.get_stats(&stats);
+    REQUIRE(1 == stats.dropped_records);
+    REQUIRE(30 == stats.dropped_bytes);
+    REQUIRE(0 == stats.rejected_writes);
+    REQUIRE(80 == sqb.size());
+    REQUIRE(1 == read_ptr[29]);
+    REQUIRE(2 == read_ptr[30]);
+    REQUIRE(2 == read_ptr[59]);
+    REQUIRE(0 == sqb.commit_read(50));
+    REQUIRE(0 == sqb.request_read(&next_ptr, &available, 0));
+    REQUIRE(30 == available);
+    REQUIRE(4 == next_ptr[0]);
+    REQUIRE(4 == next_ptr[29]);
+    // the pinned bytes alone leave too little room
+    REQUIRE(-1 == sqb.write(data, 80));
+    sqb.get_stats(&stats);
+    REQUIRE(1 == stats.dropped_records);
+    REQUIRE(1 == stats.rejected_writes);
+    REQUIRE(80 == stats.rejected_bytes);
+    REQUIRE(0 == sqb.write(data, 70));
+    REQUIRE(100 == sqb.size());
+}
+
+TEST_CASE( "overflow drop oldest random write read") {
+    SequentialBuffer sqb(501);
+    REQUIRE(0 == sqb.set_overflow_policy(motesque::OverflowPolicy_DropOldest, 50));
+    // every record is filled with its own length, so the reader can check the framing
+    uint8_t data[100];
+    srand(100);
+    size_t record_rest = 0;
+    uint8_t record_value = 0;
+    bool framing_ok = true;
+    for (int i=0; i < 100000; ++i) {
+        size_t to_write = 1 + rand() % 99;
+        memset(data, (int)to_write, to_write);
+        sqb.write(data, to_write);
+        if (rand() % 4 == 1) {
+            const uint8_t* read_ptr;
+            size_t available;
+            if (0 == sqb.request_read(&read_ptr, &available, 0)) {
+                size_t consume = 1 + rand() % available;
+                for (size_t k=0; k < consume; k++) {
+                    if (record_rest == 0) {
+                        record_value = read_ptr[k];
+                        record_rest = record_value;
+                    }
+                    framing_ok &= read_ptr[k] == record_value;
+                    record_rest--;
+                }
+                REQUIRE(0 == sqb.commit_read(consume));
+            }
+        }
+    }
+    REQUIRE(framing_ok);
+    motesque::SequentialBufferStats stats;
+    sqb.get_stats(&stats);
+    REQUIRE(stats.dropped_records > 0);
+}
+
+TEST_CASE( "blocking write times out") {
+    SequentialBuffer sqb(100);
+    uint8_t data[60] = {0};
+    REQUIRE(0 == sqb.write(data, 60, 100));
+    // nobody reads, the reader is notified and the write times out
+    REQUIRE(-1 == sqb.write(data, 60, 100));
+    motesque::SequentialBufferStats stats;
+    sqb.get_stats(&stats);
+    REQUIRE(1 == stats.rejected_writes);
+    // too large to ever fit
+    REQUIRE(-1 == sqb.write(data, 101, 100));
+}
+
+// a real waitable flag, so the writer sleeps until the reader made space
+struct CvTestStatus {
+    CvTestStatus() : status(0) {}
+
+    void set() {
+        std::unique_lock<std::mutex> lck(mutex);
+        status = 1;
+        cv.notify_all();
+    }
+    void clear() {
+        std::unique_lock<std::mutex> lck(mutex);
+        status = 0;
+    }
+    int wait_for(uint32_t timeout_ms) {
+        std::unique_lock<std::mutex> lck(mutex);
+        if (!cv.wait_for(lck, std::chrono::milliseconds(timeout_ms), [this]() { return status == 1; })) {
+            return -1;
+        }
+        status = 0;
+        return 0;
+    }
+    int status;
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+TEST_CASE( "blocking write with backpressure") {
+    motesque::SequentialBufferT<std::mutex, CvTestStatus> sqb(1000);
+    // wake the writer only once half of the buffer is free
+    sqb.set_low_watermark(500);
+    const size_t kNumChunks = 2000;
+    std::atomic<bool> sequence_ok(true);
+    std::thread consumer([&]() {
+        uint8_t expected = 0;
+        size_t remaining = kNumChunks * 64;
+        while (remaining > 0) {
+            const uint8_t* read_ptr;
+            size_t available = 0;
+            // drain what is there before waiting for the watermark again
+            if (sqb.request_read(&read_ptr, &available, 0) != 0 &&
+                sqb.request_read(&read_ptr, &available, 100) != 0) {
+                continue;
+            }
+            // a slow reader
+            available = std::min<size_t>(available, 100);
+            for (size_t i=0; i < available; i++) {
+                if (read_ptr[i] != expected++) {
+                    sequence_ok = false;
+                }
+            }
+            sqb.commit_read(available);
+            remaining -= available;
+        }
+    });
+    uint8_t chunk[64];
+    uint8_t counter = 0;
+    int failed_writes = 0;
+    for (size_t i=0; i < kNumChunks; i++) {
+        for (size_t k=0; k < sizeof(chunk); k++) {
+            chunk[k] = counter++;
+        }
+        if (0 != sqb.write(chunk, sizeof(chunk), 10000)) {
+            failed_writes++;
+        }
+    }
+    consumer.join();
+    REQUIRE(0 == failed_writes);
+    REQUIRE(sequence_ok);
+}
@@ -0,0 +1,186 @@
+#include "assert.h"
+#include "../../unittest/catch.hpp"
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <iostream>
+#include "../spsc_sequential_buffer.h"
+#include "../sequential_buffer.h"
+
+static uint32_t spsc_clock_counter = 0;
+
+struct SpscTestIntStatus {
+    SpscTestIntStatus() : status(0) {}
+
+    void set() {
+        status = 1;
+    }
+    void clear() {
+        status = 0;
+    }
+    int wait_for(uint32_t timeout_ms) {
+        spsc_clock_counter = 0;
+        while (status == 0 && spsc_clock_counter < timeout_ms) {
+            spsc_clock_counter++;
+        }
+        status = 0;
+        return spsc_clock_counter == timeout_ms ? -1 : 0;
+    }
+    std::atomic<int> status;
+};
+
+typedef motesque::SpscSequentialBufferT<SpscTestIntStatus> SpscSequentialBuffer;
+
+TEST_CASE( "spsc read_empty") {
+    SpscSequentialBuffer sqb(1000);
+    const uint8_t* dst;
+    size_t  request_size = 0;
+    REQUIRE(-1 == sqb.request_read(&dst, &request_size, 0));
+    REQUIRE(request_size == 0);
+    REQUIRE(1000 == sqb.free());
+}
+
+TEST_CASE( "spsc simple writes") {
+    SpscSequentialBuffer sqb(200);
+    uint8_t data[201];
+    // it is to large
+    REQUIRE(-1 == sqb.write(data, 201));
+    // it should fit
+    REQUIRE(0 == sqb.write(data, 200));
+    REQUIRE(200 == sqb.size());
+    REQUIRE(0 == sqb.free());
+    // it is now full
+    REQUIRE(-1 == sqb.write(data, 1));
+}
+
+TEST_CASE( "spsc wrapping writes shift") {
+    SpscSequentialBuffer sqb(100);
+    uint8_t data[100];
+    for (size_t i=0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)i;
+    }
+    REQUIRE(0 == sqb.write(data, 20));
+    const uint8_t* read_ptr;
+    size_t available;
+    REQUIRE(0 == sqb.request_read(&read_ptr, &available, 0));
+    REQUIRE(20 == available);
+    REQUIRE(0 == sqb.commit_read(20));
+    // full write, wraps around after 80 bytes
+    REQUIRE(0 == sqb.write(data, 100));
+    REQUIRE(0 == sqb.free());
+    REQUIRE(0 == sqb.request_read(&read_ptr, &available, 0));
+    REQUIRE(80 == available);
+    REQUIRE(0 == memcmp(read_ptr, data, 80));
+    REQUIRE(0 == sqb.commit_read(80));
+    // should read the rest up front, indempotent
+    REQUIRE(0 == sqb.request_read(&read_ptr, &available, 0));
+    REQUIRE(20 == available);
+    REQUIRE(0 == sqb.request_read(&read_ptr, &available, 0));
+    REQUIRE(20 == available);
+    REQUIRE(0 == memcmp(read_ptr, data + 80, 20));
+    REQUIRE(0 == sqb.commit_read(20));
+    REQUIRE(-1 == sqb.request_read(&read_ptr, &available, 0));
+    REQUIRE(0 == available);
+}
+
+TEST_CASE( "spsc mirrored wrapping reads are contiguous") {
+    motesque::SpscSequentialBufferT<SpscTestIntStatus, motesque::MirroredRingStorage> sqb(4096);
+    const size_t capacity = sqb.free();
+    uint8_t data[100];
+    for (size_t i=0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)i;
+    }
+    const uint8_t* read_ptr;
+    size_t available;
+    // move the cursors close to the end
+    for (size_t i=0; i < capacity - 10; i++) {
+        REQUIRE(0 == sqb.write(data, 1));
+    }
+    REQUIRE(0 == sqb.request_read(&read_ptr, &available, 0));
+    REQUIRE(0 == sqb.commit_read(available));
+    // this write wraps around but is read in one go
+    REQUIRE(0 == sqb.write(data, 100));
+    REQUIRE(0 == sqb.request_read(&read_ptr, &available, 0));
+    REQUIRE(100 == available);
+    REQUIRE(0 == memcmp(read_ptr, data, 100));
+    REQUIRE(0 == sqb.commit_read(available));
+    REQUIRE(capacity == sqb.free());
+}
+
+TEST_CASE( "spsc write_commit_read_with_timeout")
+{
+    SpscSequentialBuffer sqb(1000);
+    const uint8_t* data;
+    size_t available = 0;
+    REQUIRE(-1 == sqb.request_read(&data, &available, 1000));
+    REQUIRE(0 == available);
+    REQUIRE(1000 == spsc_clock_counter);
+    sqb.set_watermark(100);
+    uint8_t buf[100];
+    REQUIRE(0 == sqb.write(buf, 50));
+    // below the watermark, times out but hands out what is there
+    REQUIRE(0 == sqb.request_read(&data, &available, 1000));
+    REQUIRE(50 == available);
+    REQUIRE(0 == sqb.write(buf, 50));
+    REQUIRE(0 == sqb.request_read(&data, &available, 1000));
+    REQUIRE(100 == available);
+    REQUIRE(spsc_clock_counter == 0);
+}
+
+// producer writes a running counter, consumer checks the sequence. Returns the elapsed time in microseconds
+template<typename BufferT>
+static long long run_contention(BufferT& sqb, size_t num_frames, bool* sequence_ok)
+{
+    const size_t kFrameSize = 32;
+    std::atomic<bool> consumer_ok(true);
+    auto start = std::chrono::steady_clock::now();
+    std::thread consumer([&]() {
+        uint8_t expected = 0;
+        size_t remaining = num_frames * kFrameSize;
+        while (remaining > 0) {
+            const uint8_t* read_ptr;
+            size_t available = 0;
+            if (sqb.request_read(&read_ptr, &available, 0) != 0) {
+                std::this_thread::yield();
+                continue;
+            }
+            for (size_t i=0; i < available; i++) {
+                if (read_ptr[i] != expected++) {
+                    consumer_ok = false;
+                }
+            }
+            sqb.commit_read(available);
+            remaining -= available;
+        }
+    });
+    uint8_t frame[kFrameSize];
+    uint8_t counter = 0;
+    for (size_t i=0; i < num_frames; i++) {
+        for (size_t k=0; k < kFrameSize; k++) {
+            frame[k] = counter++;
+        }
+        while (sqb.write(frame, kFrameSize) != 0) {
+            std::this_thread::yield();
+        }
+    }
+    consumer.join();
+    *sequence_ok = consumer_ok;
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+TEST_CASE( "spsc vs locked contention benchmark")
+{
+    const size_t kNumFrames = 200000;
+    bool sequence_ok = false;
+
+    motesque::SequentialBufferT<std::mutex, SpscTestIntStatus> locked(4096);
+    long long locked_us = run_contention(locked, kNumFrames, &sequence_ok);
+    REQUIRE(sequence_ok);
+
+    SpscSequentialBuffer lock_free(4096);
+    long long lock_free_us = run_contention(lock_free, kNumFrames, &sequence_ok);
+    REQUIRE(sequence_ok);
+
+    std::cout << "SequentialBuffer contention, frames: " << kNumFrames << ", locked: " << locked_us
+              << " us, lock free: " << lock_free_us << " us" << std::endl;
+}
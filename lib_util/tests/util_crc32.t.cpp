@@ -0,0 +1,77 @@
+#include "../../unittest/catch.hpp"
+#include "util_crc32.h"
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+using namespace motesque;
+
+TEST_CASE( "crc32 implementations agree") {
+    const uint8_t check[] = "123456789";
+    REQUIRE(0xCBF43926 == crc32(check, 9));
+    REQUIRE(0 == crc32(check, 0));
+
+    std::vector<uint8_t> data(4096 + 64);
+    uint32_t seed = 7;
+    for (size_t i=0; i < data.size(); i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (uint8_t)(seed >> 16);
+    }
+    Crc32Function bytewise = crc32_function(Crc32Impl_Bytewise);
+    REQUIRE(bytewise != NULL);
+    for (int impl=0; impl < kNumCrc32Impls; impl++) {
+        Crc32Function function = crc32_function((Crc32Impl)impl);
+        if (function == NULL) {
+            continue;
+        }
+        INFO(crc32_impl_name((Crc32Impl)impl));
+        REQUIRE(0xCBF43926 == function(0, check, 9));
+        // every tail length and alignment around the block sizes
+        for (size_t offset=0; offset < 16; offset++) {
+            for (size_t size=0; size < 300; size++) {
+                REQUIRE(bytewise(0, data.data() + offset, size) == function(0, data.data() + offset, size));
+            }
+        }
+        REQUIRE(bytewise(0, data.data(), 4096) == function(0, data.data(), 4096));
+    }
+
+    // streaming in uneven pieces
+    uint32_t crc = 0;
+    size_t offset = 0;
+    for (size_t piece=1; offset < data.size(); piece = piece * 3 + 1) {
+        const size_t n = std::min(piece, data.size() - offset);
+        crc = crc32_update(crc, data.data() + offset, n);
+        offset += n;
+    }
+    REQUIRE(crc == crc32(data.data(), data.size()));
+}
+
+// hidden, run with: run_tests "[.bench]"
+TEST_CASE( "crc32 throughput", "[.bench]") {
+    // a slotfs block and a larger buffer
+    const size_t sizes[] = {508, 64 * 1024};
+    std::vector<uint8_t> data(64 * 1024);
+    for (size_t i=0; i < data.size(); i++) {
+        data[i] = (uint8_t)(i * 31);
+    }
+    for (size_t s=0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        const size_t total = 32 * 1024 * 1024;
+        const size_t rounds = total / sizes[s];
+        for (int impl=0; impl < kNumCrc32Impls; impl++) {
+            Crc32Function function = crc32_function((Crc32Impl)impl);
+            if (function == NULL) {
+                continue;
+            }
+            uint32_t crc = 0;
+            auto start = std::chrono::high_resolution_clock::now();
+            for (size_t r=0; r < rounds; r++) {
+                crc = function(crc, data.data(), sizes[s]);
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+            const double mb = rounds * sizes[s] / (1024.0 * 1024.0);
+            std::cout << "crc32 " << crc32_impl_name((Crc32Impl)impl) << ", " << sizes[s] << " bytes: "
+                      << mb / std::chrono::duration<double>(end - start).count() << " MB/s (" << std::hex << crc
+                      << std::dec << ")" << std::endl;
+        }
+    }
+}
@@ -1,8 +1,17 @@
 #include "util_crc32.h"
+#if defined(__x86_64__) || defined(__i386__)
+    #include <cpuid.h>
+    #include <wmmintrin.h>
+    #include <emmintrin.h>
+    #define MOTESQUE_CRC32_PCLMUL
+#endif
+#if defined(__ARM_FEATURE_CRC32)
+    #include <arm_acle.h>
+#endif
 namespace motesque {
 
 static
-const uint32_t crc32_tab[] = {
+constexpr uint32_t crc32_tab[] = {
     0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
     0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
     0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
@@ -48,15 +57,241 @@ const uint32_t crc32_tab[] = {
     0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 };
 
-uint32_t crc32(uint8_t *buf, size_t size)
+// tables[k][b] is the crc of byte b followed by k zero bytes, tables[0] is crc32_tab.
+// Computed by the compiler, so the 16 KB stay in flash next to crc32_tab instead of being built in RAM
+struct Crc32Tables {
+    constexpr Crc32Tables() : t() {
+        for (int b=0; b < 256; b++) {
+            t[0][b] = crc32_tab[b];
+        }
+        for (int k=1; k < 16; k++) {
+            for (int b=0; b < 256; b++) {
+                t[k][b] = (t[k-1][b] >> 8) ^ crc32_tab[t[k-1][b] & 0xFF];
+            }
+        }
+    }
+    uint32_t t[16][256];
+};
+
+static constexpr Crc32Tables crc32_tables = Crc32Tables();
+
+// the original version, one byte per step. Reads the copy in crc32_tables, optimized builds drop crc32_tab itself
+static uint32_t crc32_bytewise(uint32_t crc, const uint8_t *buf, size_t size)
+{
+    const uint8_t *p = buf;
+
+    crc = ~crc;
+    while (size--) {
+        crc = crc32_tables.t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// little endian loads, as on every target we have
+static inline uint32_t load32(const uint8_t *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// slicing-by-8 (Intel, 2008): 8 independent table lookups per 8 bytes instead of a chain of 8
+static uint32_t crc32_slicing8(uint32_t crc, const uint8_t *buf, size_t size)
+{
+    const uint32_t (*t)[256] = crc32_tables.t;
+    crc = ~crc;
+    while (size >= 8) {
+        const uint32_t one = load32(buf) ^ crc;
+        const uint32_t two = load32(buf + 4);
+        crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^ t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+              t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^ t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+        buf += 8;
+        size -= 8;
+    }
+    while (size--) {
+        crc = t[0][(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t crc32_slicing16(uint32_t crc, const uint8_t *buf, size_t size)
+{
+    const uint32_t (*t)[256] = crc32_tables.t;
+    crc = ~crc;
+    while (size >= 16) {
+        const uint32_t one = load32(buf) ^ crc;
+        const uint32_t two = load32(buf + 4);
+        const uint32_t three = load32(buf + 8);
+        const uint32_t four = load32(buf + 12);
+        crc = t[15][one & 0xFF] ^ t[14][(one >> 8) & 0xFF] ^ t[13][(one >> 16) & 0xFF] ^ t[12][one >> 24] ^
+              t[11][two & 0xFF] ^ t[10][(two >> 8) & 0xFF] ^ t[9][(two >> 16) & 0xFF] ^ t[8][two >> 24] ^
+              t[7][three & 0xFF] ^ t[6][(three >> 8) & 0xFF] ^ t[5][(three >> 16) & 0xFF] ^ t[4][three >> 24] ^
+              t[3][four & 0xFF] ^ t[2][(four >> 8) & 0xFF] ^ t[1][(four >> 16) & 0xFF] ^ t[0][four >> 24];
+        buf += 16;
+        size -= 16;
+    }
+    return crc32_slicing8(~crc, buf, size);
+}
+
+#ifdef MOTESQUE_CRC32_PCLMUL
+// Folds 64 bytes per step with carry-less multiplications and reduces with Barrett, see "Fast CRC Computation for
+// Generic Polynomials Using PCLMULQDQ Instruction" (Intel, 2009). |size| >= 64 and a multiple of 16, |crc| is the
+// register, not the final value
+__attribute__((target("pclmul,sse2")))
+static uint32_t crc32_pclmul_blocks(uint32_t crc, const uint8_t *buf, size_t size)
+{
+    // the constants of the paper for the bit reflected polynomial
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+    const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124LL);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    __m128i x1 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+    __m128i x2 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+    __m128i x3 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+    __m128i x4 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    buf += 64;
+    size -= 64;
+
+    // four lanes in parallel
+    while (size >= 64) {
+        const __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        const __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        const __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        const __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(buf + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(buf + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(buf + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(buf + 0x30)));
+        buf += 64;
+        size -= 64;
+    }
+
+    // fold the lanes into one, then the remaining blocks of 16
+    __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x4), x5);
+    while (size >= 16) {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i*)buf)), x5);
+        buf += 16;
+        size -= 16;
+    }
+
+    // 128 to 64 bits
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k5k0, 0x00), x2);
+
+    // Barrett reduction to 32 bits
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t *buf, size_t size)
 {
-    uint8_t *p = buf;
-    uint32_t crc;
+    if (size < 64) {
+        return crc32_slicing16(crc, buf, size);
+    }
+    const size_t blocks = size & ~(size_t)15;
+    crc = ~crc32_pclmul_blocks(~crc, buf, blocks);
+    return crc32_slicing16(crc, buf + blocks, size - blocks);
+}
 
-    crc = ~0U;
+static bool has_pclmul()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    return (ecx & bit_PCLMUL) && (edx & bit_SSE2);
+}
+#endif
+
+#if defined(__ARM_FEATURE_CRC32)
+static uint32_t crc32_arm(uint32_t crc, const uint8_t *buf, size_t size)
+{
+    crc = ~crc;
+    while (size > 0 && ((uintptr_t)buf & 3) != 0) {
+        crc = __crc32b(crc, *buf++);
+        size--;
+    }
+    while (size >= 4) {
+        crc = __crc32w(crc, load32(buf));
+        buf += 4;
+        size -= 4;
+    }
     while (size--) {
-        crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        crc = __crc32b(crc, *buf++);
+    }
+    return ~crc;
+}
+#endif
+
+Crc32Function crc32_function(Crc32Impl impl)
+{
+    switch (impl) {
+#ifdef MOTESQUE_CRC32_PCLMUL
+        case Crc32Impl_Pclmul:      return has_pclmul() ? crc32_pclmul : NULL;
+#endif
+#if defined(__ARM_FEATURE_CRC32)
+        case Crc32Impl_Arm:         return crc32_arm;
+#endif
+        case Crc32Impl_Slicing16:   return crc32_slicing16;
+        case Crc32Impl_Slicing8:    return crc32_slicing8;
+        case Crc32Impl_Bytewise:    return crc32_bytewise;
+        default:                    return NULL;
+    }
+}
+
+const char* crc32_impl_name(Crc32Impl impl)
+{
+    switch (impl) {
+        case Crc32Impl_Pclmul:      return "pclmul";
+        case Crc32Impl_Arm:         return "arm";
+        case Crc32Impl_Slicing16:   return "slicing-by-16";
+        case Crc32Impl_Slicing8:    return "slicing-by-8";
+        case Crc32Impl_Bytewise:    return "bytewise";
+        default:                    return "unknown";
     }
-    return crc ^ ~0U;
+}
+
+// the fastest one, picked once
+static Crc32Function select_crc32()
+{
+    for (int impl=0; impl < kNumCrc32Impls; impl++) {
+        Crc32Function function = crc32_function((Crc32Impl)impl);
+        if (function) {
+            return function;
+        }
+    }
+    return crc32_bytewise;
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *buf, size_t size)
+{
+    static const Crc32Function function = select_crc32();
+    return function(crc, buf, size);
+}
+
+uint32_t crc32(const uint8_t *buf, size_t size)
+{
+    return crc32_update(0, buf, size);
 }
 }
@@ -2,6 +2,26 @@
 #include <cstring>
 namespace motesque
 {
-  uint32_t crc32(uint8_t *buf, size_t size);
-}
+  // the CRC-32 of zlib/IEEE 802.3 over |size| bytes
+  uint32_t crc32(const uint8_t *buf, size_t size);
+
+  // continues the crc of the data before with |buf|, 0 starts a new one: crc32(a + b) == crc32_update(crc32(a), b)
+  uint32_t crc32_update(uint32_t crc, const uint8_t *buf, size_t size);
+
+  // the implementations crc32() picks from, fastest supported first
+  enum Crc32Impl {
+      Crc32Impl_Pclmul,     // x86 carry-less multiply, checked at runtime
+      Crc32Impl_Arm,        // ARMv8 crc instructions, if the target has them (__ARM_FEATURE_CRC32)
+      Crc32Impl_Slicing16,  // 16 KB of const tables
+      Crc32Impl_Slicing8,   // the first 8 KB of the same tables
+      Crc32Impl_Bytewise,   // the first 1 KB of the same tables, the original version
+      kNumCrc32Impls
+  };
 
+  typedef uint32_t (*Crc32Function)(uint32_t crc, const uint8_t *buf, size_t size);
+
+  // the implementation with the signature of crc32_update(), NULL if this target or cpu lacks it
+  Crc32Function crc32_function(Crc32Impl impl);
+
+  const char* crc32_impl_name(Crc32Impl impl);
+}
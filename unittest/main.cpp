@@ -1,3 +1,3 @@
-
 #define CATCH_CONFIG_MAIN  // This tells Catch to provide a main() - only do this in one cpp file
+#define CATCH_CONFIG_NO_POSIX_SIGNALS // SIGSTKSZ is no longer a constant on newer glibc
 #include "../unittest/catch.hpp"